@@ -1,33 +1,62 @@
 
 typedef float value_t;
 
+// The room is stored framed by a layer of ghost cells, as (N+2) x (N+2) matrix holding the
+// cell (i,j) at (i+1)*(N+2) + (j+1). The ghost cells mirror the outermost cells of the room
+// and are refreshed by the boundary kernel after every step, such that the stencil kernel
+// needs no boundary checks.
+
 __kernel void stencil(
     __global const value_t* A, 
     __global value_t* B,
-    int source_x,
-    int source_y,
     int N
 ) {
     // obtain position of this 'thread'
     size_t i = get_global_id(1);
     size_t j = get_global_id(0);
 
-    // center stays constant (the heat is still on)
-    if (i == source_x && j == source_y) {
-        B[i*N+j] = A[i*N+j];
-        return;
-    }
+    // the position of (i,j) within the padded grid and the distance of its rows
+    size_t W = N+2;
+    size_t c = (i+1)*W + (j+1);
 
     // get current temperature at (i,j)
-    value_t tc = A[i*N+j];
+    value_t tc = A[c];
 
-    // get temperatures left/right and up/down
-    value_t tl = ( j !=  0  ) ? A[i*N+(j-1)] : tc;
-    value_t tr = ( j != N-1 ) ? A[i*N+(j+1)] : tc;
-    value_t tu = ( i !=  0  ) ? A[(i-1)*N+j] : tc;
-    value_t td = ( i != N-1 ) ? A[(i+1)*N+j] : tc;
+    // get temperatures left/right and up/down, ghost cells at the walls
+    value_t tl = A[c-1];
+    value_t tr = A[c+1];
+    value_t tu = A[c-W];
+    value_t td = A[c+W];
 
     // update temperature at current point
-    B[i*N+j] = tc + 0.2f * (tl + tr + tu + td + (-4.0f*tc));
+    B[c] = tc + 0.2f * (tl + tr + tu + td + (-4.0f*tc));
+
+}
+
+// completes the step from A to B: re-imposes the heat source and copies the outermost
+// cells of the room to the ghost cells -- one work item per row and column of the room
+__kernel void boundary(
+    __global value_t* B,
+    __global const value_t* A,
+    int source_x,
+    int source_y,
+    int N
+) {
+    size_t k = get_global_id(0);
+    if (k >= N) return;
+
+    size_t W = N+2;
+    size_t s = (source_x+1)*W + (source_y+1);
+
+    // the cell c of the room after this step -- center stays constant (the heat is still on)
+    #define CELL(c) (((c) == s) ? A[c] : B[c])
+
+    B[        k+1    ] = CELL(     W  + k+1);     // upper wall
+    B[(N+1)*W + k+1  ] = CELL(   N*W  + k+1);     // lower wall
+    B[(k+1)*W        ] = CELL((k+1)*W +  1 );     // left wall
+    B[(k+1)*W + N+1  ] = CELL((k+1)*W +  N );     // right wall
+
+    if (k == 0) B[s] = A[s];
 
+    #undef CELL
 }
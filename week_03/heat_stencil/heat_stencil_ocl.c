@@ -18,6 +18,16 @@ void releaseMatrix(Matrix m);
 
 void printTemperature(Matrix m, int N, int M);
 
+// -- ghost cells --
+
+// The room is stored framed by a layer of ghost cells, as (N+2) x (N+2) matrix holding the
+// cell (i,j) at IDX(i,j), on the host as well as on the device (see heat_stencil.cl).
+
+#define IDX(i,j) ((long long)((i)+1)*(N+2) + ((j)+1))
+
+// copies the outermost cells of the room of size N to the adjacent ghost cells
+void refreshGhostCells(Matrix m, int N);
+
 // ----------------------
 
 
@@ -34,20 +44,23 @@ int main(int argc, char** argv) {
     
     // ---------- setup ----------
 
-    // create a buffer for storing temperature fields
-    Matrix A = createMatrix(N,N);
+    // create a buffer for storing temperature fields, including the ghost cells
+    Matrix A = createMatrix(N+2,N+2);
     
     // set up initial conditions in A
     for(int i = 0; i<N; i++) {
         for(int j = 0; j<N; j++) {
-            A[i*N+j] = 273;             // temperature is 0° C everywhere (273 K)
+            A[IDX(i,j)] = 273;          // temperature is 0° C everywhere (273 K)
         }
     }
 
     // and there is a heat source in one corner
     int source_x = N/4;
     int source_y = N/4;
-    A[source_x*N+source_y] = 273 + 60;
+    A[IDX(source_x,source_y)] = 273 + 60;
+
+    // the device updates the ghost cells after every step, initially the host does
+    refreshGhostCells(A, N);
 
     printf("Initial:\n");
     printTemperature(A,N,N);
@@ -67,24 +80,27 @@ int main(int argc, char** argv) {
 
     // Part 2: create memory buffers
     cl_int err;
-    cl_mem devMatA = clCreateBuffer(context, CL_MEM_READ_WRITE, N * N * sizeof(value_t), NULL, &err);
+    cl_mem devMatA = clCreateBuffer(context, CL_MEM_READ_WRITE, (N+2) * (N+2) * sizeof(value_t), NULL, &err);
     CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
-    cl_mem devMatB = clCreateBuffer(context, CL_MEM_READ_WRITE, N * N * sizeof(value_t), NULL, &err);
+    cl_mem devMatB = clCreateBuffer(context, CL_MEM_READ_WRITE, (N+2) * (N+2) * sizeof(value_t), NULL, &err);
     CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
 
     // Part 3: fill memory buffers (transfering A is enough, B can be anything)
-    err = clEnqueueWriteBuffer(command_queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, NULL);
+    err = clEnqueueWriteBuffer(command_queue, devMatA, CL_TRUE, 0, (N+2) * (N+2) * sizeof(value_t), A, 0, NULL, NULL);
     CLU_ERRCHECK(err, "Failed to write matrix A to device");
 
     // Part 4: create kernel from source
     cl_program program = cluBuildProgramFromFile(context, device_id, "heat_stencil.cl", NULL);
     cl_kernel kernel = clCreateKernel(program, "stencil", &err);
     CLU_ERRCHECK(err, "Failed to create mat_mul kernel from program");
+    cl_kernel boundary = clCreateKernel(program, "boundary", &err);
+    CLU_ERRCHECK(err, "Failed to create boundary kernel from program");
 
     // Part 5: set arguments in kernel (those which are constant)
-    clSetKernelArg(kernel, 2, sizeof(int), &source_x);
-    clSetKernelArg(kernel, 3, sizeof(int), &source_y);
-    clSetKernelArg(kernel, 4, sizeof(int), &N);
+    clSetKernelArg(kernel, 2, sizeof(int), &N);
+    clSetKernelArg(boundary, 2, sizeof(int), &source_x);
+    clSetKernelArg(boundary, 3, sizeof(int), &source_y);
+    clSetKernelArg(boundary, 4, sizeof(int), &N);
     
 
     // for each time step ..
@@ -100,6 +116,11 @@ int main(int argc, char** argv) {
         size_t size[2] = {N, N}; // two dimensional range
         CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, kernel, 2, NULL, size, NULL, 0, NULL, NULL), "Failed to enqueue 2D kernel");
 
+        // followed by the update of the walls and the heat source
+        clSetKernelArg(boundary, 0, sizeof(cl_mem), &devMatB);
+        clSetKernelArg(boundary, 1, sizeof(cl_mem), &devMatA);
+        CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, boundary, 1, NULL, size, NULL, 0, NULL, NULL), "Failed to enqueue 1D kernel");
+
         // swap matrices (just handles, no conent)
         cl_mem tmp = devMatA;
         devMatA = devMatB;
@@ -109,7 +130,7 @@ int main(int argc, char** argv) {
         if (!(t%1000)) {
 
             // download state of A to host
-            err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, NULL);
+            err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, (N+2) * (N+2) * sizeof(value_t), A, 0, NULL, NULL);
             CLU_ERRCHECK(err, "Failed to read matrix A from device");
 
             // revert dirty flag
@@ -124,7 +145,7 @@ int main(int argc, char** argv) {
     // get back final version of A
     if (dirty) {
         // download state of A to host
-        err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, NULL);
+        err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, (N+2) * (N+2) * sizeof(value_t), A, 0, NULL, NULL);
         CLU_ERRCHECK(err, "Failed to read matrix A from device");
     }
 
@@ -133,6 +154,7 @@ int main(int argc, char** argv) {
     CLU_ERRCHECK(clFlush(command_queue),    "Failed to flush command queue");
     CLU_ERRCHECK(clFinish(command_queue),   "Failed to wait for command queue completion");
     CLU_ERRCHECK(clReleaseKernel(kernel),   "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseKernel(boundary), "Failed to release kernel");
     CLU_ERRCHECK(clReleaseProgram(program), "Failed to release program");
 
     // free device memory
@@ -158,7 +180,7 @@ int main(int argc, char** argv) {
     bool success = true;
     for(long long i = 0; i<N; i++) {
         for(long long j = 0; j<N; j++) {
-            value_t temp = A[i*N+j];
+            value_t temp = A[IDX(i,j)];
             if (273 <= temp && temp <= 273+60) continue;
             success = false;
             break;
@@ -185,6 +207,20 @@ void releaseMatrix(Matrix m) {
     free(m);
 }
 
+void refreshGhostCells(Matrix m, int N) {
+    // upper and lower wall
+    for(int j = 0; j<N; j++) {
+        m[IDX(-1,j)] = m[IDX( 0 ,j)];
+        m[IDX( N,j)] = m[IDX(N-1,j)];
+    }
+    // left and right wall
+    for(int i = 0; i<N; i++) {
+        m[IDX(i,-1)] = m[IDX(i, 0 )];
+        m[IDX(i, N)] = m[IDX(i,N-1)];
+    }
+}
+
+// prints the N x M room m, stored with ghost cells
 void printTemperature(Matrix m, int N, int M) {
     const char* colors = " .-:=+*#%@";
     const int numColors = 10;
@@ -219,7 +255,8 @@ void printTemperature(Matrix m, int N, int M) {
             value_t max_t = 0;
             for(int x=sH*i; x<sH*i+sH; x++) {
                 for(int y=sW*j; y<sW*j+sW; y++) {
-                    max_t = (max_t < m[x*N+y]) ? m[x*N+y] : max_t;
+                    value_t t = m[(x+1)*(M+2)+(y+1)];
+                    max_t = (max_t < t) ? t : max_t;
                 }
             }
             value_t temp = max_t;
@@ -19,3 +19,24 @@ __kernel void mat_mul(
     }
     c[i*N+j] = sum;
 }
+
+// same as above, for a transposed B -- each work item walks along a row of a and
+// a row of bt, which is the cache friendly pattern if work items run sequentially
+// on a CPU core
+__kernel void mat_mul_bt(
+    __global float* c,
+    __global const float* a,
+    __global const float* bt,
+    int N
+) {
+    size_t i = get_global_id(0);
+    size_t j = get_global_id(1);
+
+    if (i >= N || j >= N) return;
+
+    float sum = 0;
+    for(int k = 0; k<N; k++) {
+        sum += a[i*N+k] * bt[j*N+k];
+    }
+    c[i*N+j] = sum;
+}
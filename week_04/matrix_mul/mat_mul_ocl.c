@@ -3,6 +3,7 @@
 
 #include "utils.h"
 #include "cl_utils.h"
+#include "sparse.h"
 
 typedef float value_t;
 
@@ -19,6 +20,26 @@ void releaseMatrix(Matrix m);
 
 unsigned long long getElapsed(cl_event event);
 
+// -- layout utilities --
+
+// the work group size of the tiled transpose kernel (TILE in transpose.cl)
+#define TRANSPOSE_TILE 16
+
+size_t roundUpToTile(size_t value);
+
+// -- sparse utilities --
+
+typedef struct _cl_csr_matrix {
+    cl_mem row_ptr;
+    cl_mem col_idx;
+    cl_mem values;
+} cl_csr_matrix;
+
+// copies m to the device, the time of all its transfers in ns is stored in elapsed
+cl_csr_matrix uploadCSR(cl_context context, cl_command_queue queue, const csr_matrix* m, unsigned long long* elapsed);
+
+void releaseDeviceCSR(cl_csr_matrix m);
+
 // ----------------------
 
 int main(int argc, char** argv) {
@@ -50,11 +71,28 @@ int main(int argc, char** argv) {
     Matrix C = createMatrix(N,N);
 
     timestamp begin = now();
-    
+
+    // If one of the operands is mostly zeros (like the identity B), most of the
+    // dense work is wasted. Thus the density is measured and a sparse kernel is
+    // used if it pays off -- the conversion is part of the measured time.
+    double densityA = matrixDensity(A,N,N);
+    double densityB = matrixDensity(B,N,N);
+    printf("Density: A=%.4f, B=%.4f\n", densityA, densityB);
+
+    bool sparseB = densityB <= SPARSE_DENSITY_THRESHOLD && densityB <= densityA;
+    bool sparseA = !sparseB && densityA <= SPARSE_DENSITY_THRESHOLD;
+    printf("Using %s product\n", sparseB ? "dense x sparse" : sparseA ? "sparse x dense" : "dense");
+
+    // the number of bytes actually transferred for A and B
+    double input_a_bytes = (double)sizeof(value_t)*N*N;
+    double input_b_bytes = (double)sizeof(value_t)*N*N;
+
     cl_event event_run_kernel;
-    cl_event event_write_a;
-    cl_event event_write_b;
+    unsigned long long time_write_a;
+    unsigned long long time_write_b;
+    cl_event event_transpose_b;
     cl_event event_read_res;
+    bool transposeB = false;
     {
         // -- solution with CL utils --
 
@@ -63,41 +101,110 @@ int main(int argc, char** argv) {
         cl_command_queue command_queue;
         cl_device_id device_id = cluInitDevice(0, &context, &command_queue);
 
-        // Part 2: create memory buffers
+        // Part 2: create memory buffers and fill them
         cl_int err;
-        cl_mem devMatA = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * N * sizeof(value_t), NULL, &err);
-        CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
-        cl_mem devMatB = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * N * sizeof(value_t), NULL, &err);
-        CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+        cl_mem devMatA = NULL;
+        cl_mem devMatB = NULL;
+        cl_csr_matrix devSparse = { NULL, NULL, NULL };
         cl_mem devMatC = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, N * N * sizeof(value_t), NULL, &err);
         CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
 
-        // Part 3: fill memory buffers
-        err = clEnqueueWriteBuffer(command_queue, devMatA, CL_FALSE, 0, N * N * sizeof(value_t), A, 0, NULL, &event_write_a);
-        CLU_ERRCHECK(err, "Failed to write matrix A to device");
-        err = clEnqueueWriteBuffer(command_queue, devMatB, CL_TRUE, 0,  N * N * sizeof(value_t), B, 0, NULL, &event_write_b);
-        CLU_ERRCHECK(err, "Failed to write matrix B to device");
+        if (sparseA) {
+            csr_matrix csrA = csrFromMatrix(A,N,N);
+            input_a_bytes = (double)sizeof(int)*(N+1) + (double)(sizeof(int)+sizeof(value_t))*csrA.nnz;
+            devSparse = uploadCSR(context, command_queue, &csrA, &time_write_a);
+            releaseCSR(&csrA);
+        } else {
+            devMatA = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * N * sizeof(value_t), NULL, &err);
+            CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+            cl_event event_write_a;
+            err = clEnqueueWriteBuffer(command_queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, &event_write_a);
+            CLU_ERRCHECK(err, "Failed to write matrix A to device");
+            time_write_a = getElapsed(event_write_a);
+            CLU_ERRCHECK(clReleaseEvent(event_write_a), "Failed to release event");
+        }
+
+        if (sparseB) {
+            // the kernel gathers columns of B, thus B is stored as CSR of its transposed
+            csr_matrix csrBt = csrFromMatrixTransposed(B,N,N);
+            input_b_bytes = (double)sizeof(int)*(N+1) + (double)(sizeof(int)+sizeof(value_t))*csrBt.nnz;
+            devSparse = uploadCSR(context, command_queue, &csrBt, &time_write_b);
+            releaseCSR(&csrBt);
+        } else {
+            devMatB = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_WRITE_ONLY, N * N * sizeof(value_t), NULL, &err);
+            CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+            cl_event event_write_b;
+            err = clEnqueueWriteBuffer(command_queue, devMatB, CL_TRUE, 0, N * N * sizeof(value_t), B, 0, NULL, &event_write_b);
+            CLU_ERRCHECK(err, "Failed to write matrix B to device");
+            time_write_b = getElapsed(event_write_b);
+            CLU_ERRCHECK(clReleaseEvent(event_write_b), "Failed to release event");
 
-        // Part 4: create kernel from source
-        cl_program program = cluBuildProgramFromFile(context, device_id, "mat_mul.cl", NULL);
-        cl_kernel kernel = clCreateKernel(program, "mat_mul", &err);
-        CLU_ERRCHECK(err, "Failed to create mat_mul kernel from program");
+            // CPU devices execute the work items of a group one after the other, thus
+            // walking B along its columns thrashes the cache -- on those B is
+            // transposed in place, such that the kernel reads it row by row
+            cl_device_type device_type;
+            CLU_ERRCHECK(clGetDeviceInfo(device_id, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL), "Failed to get device type");
+            transposeB = !sparseA && (device_type & CL_DEVICE_TYPE_CPU);
+        }
 
-        // Part 5: set arguments and execute kernel
+        if (transposeB) {
+            cl_program transpose_program = cluBuildProgramFromFile(context, device_id, "transpose.cl", NULL);
+            cl_kernel transpose_kernel = clCreateKernel(transpose_program, "transpose_in_place", &err);
+            CLU_ERRCHECK(err, "Failed to create transpose kernel from program");
+            cluSetKernelArguments(transpose_kernel, 2,
+                sizeof(cl_mem), (void *)&devMatB,
+                sizeof(int), &N
+            );
+            size_t tile_size[2] = {TRANSPOSE_TILE, TRANSPOSE_TILE};
+            size_t tiled_size[2] = {roundUpToTile(N), roundUpToTile(N)};
+            CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, transpose_kernel, 2, NULL, tiled_size, tile_size, 0, NULL, &event_transpose_b), "Failed to enqueue transpose kernel");
+            CLU_ERRCHECK(clReleaseKernel(transpose_kernel),   "Failed to release transpose kernel");
+            CLU_ERRCHECK(clReleaseProgram(transpose_program), "Failed to release transpose program");
+        }
+
+        // Part 3: create kernel from source
+        cl_program program = cluBuildProgramFromFile(context, device_id, (sparseA || sparseB) ? "sparse.cl" : "mat_mul.cl", NULL);
+        cl_kernel kernel = clCreateKernel(program, sparseB ? "gemm_dense_csr" : sparseA ? "spmm_csr" : transposeB ? "mat_mul_bt" : "mat_mul", &err);
+        CLU_ERRCHECK(err, "Failed to create matrix multiplication kernel from program");
+
+        // Part 4: set arguments and execute kernel
         size_t size[2] = {N, N}; // two dimensional range
-        cluSetKernelArguments(kernel, 4,
-            sizeof(cl_mem), (void *)&devMatC,
-            sizeof(cl_mem), (void *)&devMatA,
-            sizeof(cl_mem), (void *)&devMatB,
-            sizeof(int), &N
-        );
+        if (sparseB) {
+            cluSetKernelArguments(kernel, 8,
+                sizeof(cl_mem), (void *)&devMatC,
+                sizeof(cl_mem), (void *)&devMatA,
+                sizeof(cl_mem), (void *)&devSparse.row_ptr,
+                sizeof(cl_mem), (void *)&devSparse.col_idx,
+                sizeof(cl_mem), (void *)&devSparse.values,
+                sizeof(int), &N,
+                sizeof(int), &N,
+                sizeof(int), &N
+            );
+        } else if (sparseA) {
+            cluSetKernelArguments(kernel, 7,
+                sizeof(cl_mem), (void *)&devMatC,
+                sizeof(cl_mem), (void *)&devSparse.row_ptr,
+                sizeof(cl_mem), (void *)&devSparse.col_idx,
+                sizeof(cl_mem), (void *)&devSparse.values,
+                sizeof(cl_mem), (void *)&devMatB,
+                sizeof(int), &N,
+                sizeof(int), &N
+            );
+        } else {
+            cluSetKernelArguments(kernel, 4,
+                sizeof(cl_mem), (void *)&devMatC,
+                sizeof(cl_mem), (void *)&devMatA,
+                sizeof(cl_mem), (void *)&devMatB,
+                sizeof(int), &N
+            );
+        }
         CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, kernel, 2, NULL, size, NULL, 0, NULL, &event_run_kernel), "Failed to enqueue 2D kernel");
 
-        // Part 6: copy results back to host
+        // Part 5: copy results back to host
         err = clEnqueueReadBuffer(command_queue, devMatC, CL_TRUE, 0, N * N * sizeof(value_t), C, 0, NULL, &event_read_res);
         CLU_ERRCHECK(err, "Failed reading back result");
 
-        // Part 7: cleanup
+        // Part 6: cleanup
         // wait for completed operations (there should be none)
         CLU_ERRCHECK(clFlush(command_queue),    "Failed to flush command queue");
         CLU_ERRCHECK(clFinish(command_queue),   "Failed to wait for command queue completion");
@@ -105,25 +212,28 @@ int main(int argc, char** argv) {
         CLU_ERRCHECK(clReleaseProgram(program), "Failed to release program");
 
         // free device memory
-        CLU_ERRCHECK(clReleaseMemObject(devMatA), "Failed to release Matrix A");
-        CLU_ERRCHECK(clReleaseMemObject(devMatB), "Failed to release Matrix B");
+        if (devMatA) CLU_ERRCHECK(clReleaseMemObject(devMatA), "Failed to release Matrix A");
+        if (devMatB) CLU_ERRCHECK(clReleaseMemObject(devMatB), "Failed to release Matrix B");
+        if (sparseA || sparseB) releaseDeviceCSR(devSparse);
         CLU_ERRCHECK(clReleaseMemObject(devMatC), "Failed to release Matrix C");
 
         // free management resources
         CLU_ERRCHECK(clReleaseCommandQueue(command_queue), "Failed to release command queue");
         CLU_ERRCHECK(clReleaseContext(context),            "Failed to release OpenCL context");
     }
-    
+
     timestamp end = now();
     printf("Total time: %.3f ms\n", (end-begin)*1000);
 
     // compute performance of individual steps
-    printf("Individual times: write a: %f ms, write b: %f ms, run kernel: %f ms, read c: %f ms\n", getElapsed(event_write_a)/1e6, getElapsed(event_write_b)/1e6, getElapsed(event_run_kernel)/1e6, getElapsed(event_read_res)/1e6);
+    printf("Individual times: write a: %f ms, write b: %f ms, run kernel: %f ms, read c: %f ms\n", time_write_a/1e6, time_write_b/1e6, getElapsed(event_run_kernel)/1e6, getElapsed(event_read_res)/1e6);
+    if (transposeB) {
+        printf("Transposing b: %f ms\n", getElapsed(event_transpose_b)/1e6);
+    }
     double num_mflop = (((double)2*N-1)*N*N)/1e6;
-    double input_data_mbytes = ((double)sizeof(value_t)*N*N)/1024/1024;
     double output_data_mbytes = ((double)sizeof(value_t)*N*N)/1024/1024;
-    printf("Throughput write a: %f MB/s\n", input_data_mbytes/(getElapsed(event_write_a)/1e9));
-    printf("Throughput write b: %f MB/s\n", input_data_mbytes/(getElapsed(event_write_b)/1e9));
+    printf("Throughput write a: %f MB/s\n", input_a_bytes/1024/1024/(time_write_a/1e9));
+    printf("Throughput write b: %f MB/s\n", input_b_bytes/1024/1024/(time_write_b/1e9));
     printf("Performance kernel: %f MFLOP/s\n", num_mflop/(getElapsed(event_run_kernel)/1e9));
     printf("Throughput read res: %f MB/s\n", output_data_mbytes/(getElapsed(event_read_res)/1e9));
 
@@ -167,3 +277,45 @@ unsigned long long getElapsed(cl_event event) {
 	return (endtime-(unsigned long long)starttime);
 }
 
+
+size_t roundUpToTile(size_t value) {
+    return (value + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE * TRANSPOSE_TILE;
+}
+
+cl_csr_matrix uploadCSR(cl_context context, cl_command_queue queue, const csr_matrix* m, unsigned long long* elapsed) {
+    cl_int err;
+    cl_csr_matrix res;
+    // OpenCL does not allow empty buffers, thus at least one element is allocated
+    size_t nnz = (m->nnz > 0) ? m->nnz : 1;
+    res.row_ptr = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, (m->rows + 1) * sizeof(int), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for sparse row pointers");
+    res.col_idx = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, nnz * sizeof(int), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for sparse column indices");
+    res.values = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, nnz * sizeof(float), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for sparse values");
+
+    // every transfer is profiled, the upload takes the sum of their times
+    cl_event events[3];
+    int count = 0;
+    err = clEnqueueWriteBuffer(queue, res.row_ptr, CL_FALSE, 0, (m->rows + 1) * sizeof(int), m->row_ptr, 0, NULL, &events[count++]);
+    CLU_ERRCHECK(err, "Failed to write sparse row pointers to device");
+    if (m->nnz > 0) {
+        err = clEnqueueWriteBuffer(queue, res.col_idx, CL_FALSE, 0, m->nnz * sizeof(int), m->col_idx, 0, NULL, &events[count++]);
+        CLU_ERRCHECK(err, "Failed to write sparse column indices to device");
+        err = clEnqueueWriteBuffer(queue, res.values, CL_FALSE, 0, m->nnz * sizeof(float), m->values, 0, NULL, &events[count++]);
+        CLU_ERRCHECK(err, "Failed to write sparse values to device");
+    }
+    CLU_ERRCHECK(clWaitForEvents(count, events), "Failed to wait for sparse transfers");
+    *elapsed = 0;
+    for(int k = 0; k<count; k++) {
+        *elapsed += getElapsed(events[k]);
+        CLU_ERRCHECK(clReleaseEvent(events[k]), "Failed to release event");
+    }
+    return res;
+}
+
+void releaseDeviceCSR(cl_csr_matrix m) {
+    CLU_ERRCHECK(clReleaseMemObject(m.row_ptr), "Failed to release sparse row pointers");
+    CLU_ERRCHECK(clReleaseMemObject(m.col_idx), "Failed to release sparse column indices");
+    CLU_ERRCHECK(clReleaseMemObject(m.values),  "Failed to release sparse values");
+}
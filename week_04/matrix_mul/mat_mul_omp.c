@@ -1,7 +1,13 @@
+// for thread pinning (see placement.h)
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "utils.h"
+#include "placement.h"
+#include "sparse.h"
 
 typedef float value_t;
 
@@ -10,7 +16,7 @@ typedef float value_t;
 
 typedef value_t* Matrix;
 
-Matrix createMatrix(int N, int M);
+Matrix createMatrix(int N, int M, placement_policy policy);
 
 void releaseMatrix(Matrix m);
 
@@ -19,21 +25,43 @@ void releaseMatrix(Matrix m);
 
 int main(int argc, char** argv) {
 
-    // 'parsing' optional input parameter = problem size
+    // 'parsing' optional input parameters
+    //  - N            ... the problem size
+    //  - pin=<p>      ... thread pinning: none, compact (default) or scatter
+    //  - place=<p>    ... memory placement: serial, first-touch (default) or interleave
     int N = 1000;
-    if (argc > 1) {
-        N = atoi(argv[1]);
+    pin_policy pin = PIN_COMPACT;
+    placement_policy place = PLACE_FIRST_TOUCH;
+    for(int a=1; a<argc; a++) {
+        bool valid = true;
+        if (!strncmp(argv[a], "pin=", 4)) {
+            valid = parsePinPolicy(argv[a] + 4, &pin);
+        } else if (!strncmp(argv[a], "place=", 6)) {
+            valid = parsePlacementPolicy(argv[a] + 6, &place);
+        } else {
+            N = atoi(argv[a]);
+        }
+        if (!valid) {
+            printf("Usage: %s [N] [pin=none|compact|scatter] [place=serial|first-touch|interleave]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
     }
     printf("Computing matrix-matrix product with N=%d\n", N);
 
+    // pinned threads keep their rows -- and with first-touch placement, their memory -- local
+    pinThreads(pin);
+    printf("Threads: %d, NUMA nodes: %d, pinning: %s, placement: %s\n",
+        omp_get_max_threads(), numNumaNodes(), pinPolicyName(pin), placementPolicyName(place));
+
     
     // ---------- setup ----------
 
     // create two input matrices (on heap!)
-    Matrix A = createMatrix(N,N);
-    Matrix B = createMatrix(N,N);
+    Matrix A = createMatrix(N,N,place);
+    Matrix B = createMatrix(N,N,place);
     
-    // fill matrices
+    // fill matrices (for serial placement, this is where the pages are placed)
+    #pragma omp parallel for schedule(static) if(place != PLACE_SERIAL)
     for(int i = 0; i<N; i++) {
         for(int j = 0; j<N; j++) {
             A[i*N+j] = i*j;             // some arbitrary matrix - note: flattend indexing!
@@ -41,29 +69,60 @@ int main(int argc, char** argv) {
         }
     }
     
+    // the bandwidth each node achieves on its part of A
+    reportNodeBandwidth(A,N,N);
+
     // ---------- compute ----------
     
-    Matrix C = createMatrix(N,N);
+    Matrix C = createMatrix(N,N,place);
 
     timestamp begin = now();
 
-    // The i and j loop do not carry any dependencies, the k loop does.
-    // Thus, i and j can be parallelized.
-    // For thread-level parallelism (OpenMP) outer-most parallelism is more
-    // beneficial to avoid synchronization overhead.
-    
-    #pragma omp parallel for
-    for(long long i = 0; i<N; i++) {
-        for(long long j = 0; j<N; j++) {
-            value_t sum = 0;
-            for(long long k = 0; k<N; k++) {
-                sum += A[i*N+k] * B[k*N+j];
+    // If one of the operands is mostly zeros (like the identity B), most of the
+    // dense work is wasted. Thus the density is measured and a sparse kernel is
+    // used if it pays off -- the conversion is part of the measured time.
+    double densityA = matrixDensity(A,N,N);
+    double densityB = matrixDensity(B,N,N);
+    printf("Density: A=%.4f, B=%.4f\n", densityA, densityB);
+
+    if (densityB <= SPARSE_DENSITY_THRESHOLD && densityB <= densityA) {
+
+        printf("Using dense x sparse product\n");
+        csr_matrix sparseB = csrFromMatrix(B,N,N);
+        gemmDenseCSR(A, &sparseB, C, N);
+        releaseCSR(&sparseB);
+
+    } else if (densityA <= SPARSE_DENSITY_THRESHOLD) {
+
+        printf("Using sparse x dense product\n");
+        csr_matrix sparseA = csrFromMatrix(A,N,N);
+        spmmCSR(&sparseA, B, C, N);
+        releaseCSR(&sparseA);
+
+    } else {
+
+        printf("Using dense product\n");
+
+        // The i and j loop do not carry any dependencies, the k loop does.
+        // Thus, i and j can be parallelized.
+        // For thread-level parallelism (OpenMP) outer-most parallelism is more
+        // beneficial to avoid synchronization overhead.
+
+        // The static schedule assigns the same rows to the same threads as the
+        // placement of the matrices.
+
+        #pragma omp parallel for schedule(static)
+        for(long long i = 0; i<N; i++) {
+            for(long long j = 0; j<N; j++) {
+                value_t sum = 0;
+                for(long long k = 0; k<N; k++) {
+                    sum += A[i*N+k] * B[k*N+j];
+                }
+                C[i*N+j] = sum;
             }
-            C[i*N+j] = sum;
         }
     }
-    
-    
+
     timestamp end = now();
     printf("Total time: %.3f ms\n", (end-begin)*1000);
 
@@ -96,9 +155,9 @@ int main(int argc, char** argv) {
 }
 
 
-Matrix createMatrix(int N, int M) {
+Matrix createMatrix(int N, int M, placement_policy policy) {
     // create data and index vector
-    return malloc(sizeof(value_t)*N*M);
+    return allocMatrixPlaced(N,M,policy);
 }
 
 void releaseMatrix(Matrix m) {
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "utils.h"
+#include "transpose.h"
 
 typedef float value_t;
 
@@ -14,17 +16,34 @@ Matrix createMatrix(int N, int M);
 
 void releaseMatrix(Matrix m);
 
+// -- layouts --
+
+// the edge of the tiles of the tile-major layout, three tiles should fit into the L1 cache
+#ifndef TILE
+#define TILE 32
+#endif
+
+// C = A * B for N x N matrices in tile-major layout with TILE x TILE tiles (see transpose.h)
+void gemmTileMajor(const Matrix A, const Matrix B, Matrix C, int N);
+
 // ----------------------
 
 
 int main(int argc, char** argv) {
 
-    // 'parsing' optional input parameter = problem size
+    // 'parsing' optional input parameters
+    //  - N     ... the problem size
+    //  - tiled ... multiply in tile-major layout instead of with a transposed B
     int N = 1000;
-    if (argc > 1) {
-        N = atoi(argv[1]);
+    bool tiled = false;
+    for(int a=1; a<argc; a++) {
+        if (!strcmp(argv[a], "tiled")) {
+            tiled = true;
+        } else {
+            N = atoi(argv[a]);
+        }
     }
-    printf("Computing matrix-matrix product with N=%d\n", N);
+    printf("Computing matrix-matrix product with N=%d (%s)\n", N, (tiled) ? "tile-major" : "transposed B");
 
     
     // ---------- setup ----------
@@ -45,14 +64,39 @@ int main(int argc, char** argv) {
     
     Matrix C = createMatrix(N,N);
 
+    // the tile-major version of A, kept for checking the conversion
+    Matrix tA = NULL;
+
     timestamp begin = now();
-    for(long long i = 0; i<N; i++) {
-        for(long long j = 0; j<N; j++) {
-            value_t sum = 0;
-            for(long long k = 0; k<N; k++) {
-                sum += A[i*N+k] * B[k*N+j];
+
+    if (tiled) {
+
+        // in tile-major layout every tile is a contiguous block, thus the tiles of A, B and C
+        // involved in a tile product stay in cache -- the conversions are part of the measured time
+        long long size = tileMajorSize(N,N,TILE);
+        tA = malloc(sizeof(value_t)*size);
+        Matrix tB = malloc(sizeof(value_t)*size);
+        Matrix tC = malloc(sizeof(value_t)*size);
+        toTileMajor(A, tA, N, N, TILE);
+        toTileMajor(B, tB, N, N, TILE);
+        gemmTileMajor(tA, tB, tC, N);
+        fromTileMajor(tC, C, N, N, TILE);
+        free(tB);
+        free(tC);
+
+    } else {
+
+        // walking B along its columns (B[k*N+j]) misses the cache on every access,
+        // thus B is transposed first such that both operands are read row by row
+        transposeSquareInPlace(B,N);
+        for(long long i = 0; i<N; i++) {
+            for(long long j = 0; j<N; j++) {
+                value_t sum = 0;
+                for(long long k = 0; k<N; k++) {
+                    sum += A[i*N+k] * B[j*N+k];
+                }
+                C[i*N+j] = sum;
             }
-            C[i*N+j] = sum;
         }
     }
     timestamp end = now();
@@ -73,7 +117,18 @@ int main(int argc, char** argv) {
             break;
         }
     }
-    
+
+    // converting A to tile-major layout and back has to restore it
+    if (tA) {
+        Matrix rA = createMatrix(N,N);
+        fromTileMajor(tA, rA, N, N, TILE);
+        bool restored = !memcmp(rA, A, sizeof(value_t)*N*N);
+        printf("Tile-major round trip: %s\n", (restored) ? "OK" : "FAILED");
+        success = success && restored;
+        releaseMatrix(rA);
+        free(tA);
+    }
+
     printf("Verification: %s\n", (success)?"OK":"FAILED");
     
     // ---------- cleanup ----------
@@ -96,3 +151,27 @@ void releaseMatrix(Matrix m) {
     free(m);
 }
 
+void gemmTileMajor(const Matrix A, const Matrix B, Matrix C, int N) {
+    long long tiles = (N + TILE - 1) / TILE;
+    memset(C, 0, sizeof(value_t)*tileMajorSize(N,N,TILE));
+    for(long long bi = 0; bi<tiles; bi++) {
+        for(long long bj = 0; bj<tiles; bj++) {
+            value_t* c = &C[(bi*tiles + bj)*TILE*TILE];
+            for(long long bk = 0; bk<tiles; bk++) {
+                const value_t* a = &A[(bi*tiles + bk)*TILE*TILE];
+                const value_t* b = &B[(bk*tiles + bj)*TILE*TILE];
+
+                // i-k-j order within the tiles, the padding is zero and does not contribute
+                for(int i = 0; i<TILE; i++) {
+                    for(int k = 0; k<TILE; k++) {
+                        value_t aik = a[i*TILE+k];
+                        for(int j = 0; j<TILE; j++) {
+                            c[i*TILE+j] += aik * b[k*TILE+j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
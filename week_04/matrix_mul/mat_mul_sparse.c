@@ -0,0 +1,251 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "cl_utils.h"
+#include "sparse.h"
+
+typedef float value_t;
+
+// Sparse matrix-vector products y = A * x in the CSR and ELL formats of sparse.h, on the CPU
+// (OpenMP) and on the device (OpenCL), each checked against the dense product.
+//
+// ELL pads every row to the longest one, thus it only pays off if most of its entries are
+// useful (see ellEfficiency): the banded matrix, all rows of about the same length, favors ELL,
+// the skewed one -- the same band plus a few dense rows -- favors CSR.
+
+
+// -- matrix utilities --
+
+typedef value_t* Matrix;
+
+Matrix createMatrix(int N, int M);
+
+void releaseMatrix(Matrix m);
+
+// -- profile utilities --
+
+unsigned long long getElapsed(cl_event event);
+
+// -- verification --
+
+// checks y against the dense product A * x computed in double precision, rows being accepted
+// within a tolerance relative to the magnitude of their terms
+bool checkProduct(const Matrix A, const value_t* x, const value_t* y, int N);
+
+// the number of runs of every product, the fastest one is reported
+#define REPETITIONS 10
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    // 'parsing' optional input parameters
+    //  - N      ... the problem size
+    //  - skewed ... add a few dense rows to the band
+    int N = 4000;
+    bool skewed = false;
+    for(int a=1; a<argc; a++) {
+        if (!strcmp(argv[a], "skewed")) {
+            skewed = true;
+        } else {
+            N = atoi(argv[a]);
+        }
+    }
+    printf("Computing %s sparse matrix-vector product with N=%d\n", (skewed) ? "skewed" : "banded", N);
+
+
+    // ---------- setup ----------
+
+    // a band of 5 diagonals, in the skewed case every 100th row is dense
+    Matrix A = createMatrix(N,N);
+    for(int i = 0; i<N; i++) {
+        for(int j = 0; j<N; j++) {
+            bool band = (i-j <= 2 && j-i <= 2);
+            bool dense = skewed && i % 100 == 0;
+            A[(long long)i*N+j] = (band || dense) ? 1 + (i+j)%5 : 0;
+        }
+    }
+    value_t* x = malloc(sizeof(value_t)*N);
+    value_t* y = malloc(sizeof(value_t)*N);
+    for(int j = 0; j<N; j++) {
+        x[j] = j%7 - 3;
+    }
+
+    // convert, then dispatch by the efficiency of the ELL representation
+    timestamp begin = now();
+    csr_matrix csr = csrFromMatrix(A,N,N);
+    ell_matrix ell = ellFromCSR(&csr);
+    timestamp end = now();
+    double efficiency = ellEfficiency(&csr);
+    printf("Density: %.4f, %d non-zeros, ELL width %d, ELL efficiency %.3f\n", matrixDensity(A,N,N), csr.nnz, ell.width, efficiency);
+    printf("Conversion time: %.3f ms\n", (end-begin)*1000);
+    printf("Preferred format: %s\n", (efficiency > ELL_EFFICIENCY_THRESHOLD) ? "ELL" : "CSR");
+
+    bool success = true;
+
+    // ---------- compute (OpenMP) ----------
+
+    for(int f = 0; f<2; f++) {
+        double best = 1e30;
+        for(int r = 0; r<REPETITIONS; r++) {
+            memset(y, 0, sizeof(value_t)*N);
+            begin = now();
+            if (f == 0) spmvCSR(&csr, x, y);
+            else        spmvELL(&ell, x, y);
+            end = now();
+            if (end - begin < best) best = end - begin;
+        }
+        bool ok = checkProduct(A, x, y, N);
+        printf("OpenMP %s: %.3f ms, %.3f GFLOPS, Verification: %s\n", (f == 0) ? "CSR" : "ELL", best*1000, 2.0*csr.nnz / best / 1e9, (ok)?"OK":"FAILED");
+        success = success && ok;
+    }
+
+    // ---------- compute (OpenCL) ----------
+
+    {
+        // Part 1: ocl initialization
+        cl_context context;
+        cl_command_queue command_queue;
+        cl_device_id device_id = cluInitDevice(0, &context, &command_queue);
+
+        // Part 2: create memory buffers and fill them -- OpenCL does not allow empty buffers,
+        // thus at least one element is allocated
+        cl_int err;
+        size_t nnz = (csr.nnz > 0) ? csr.nnz : 1;
+        size_t ellSize = ((long long)ell.width * N > 0) ? (size_t)ell.width * N : 1;
+        cl_mem devRowPtr = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, (N+1) * sizeof(int), csr.row_ptr, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for CSR row pointers");
+        cl_mem devColIdx = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nnz * sizeof(int), csr.col_idx, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for CSR column indices");
+        cl_mem devValues = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nnz * sizeof(value_t), csr.values, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for CSR values");
+        cl_mem devEllColIdx = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ellSize * sizeof(int), ell.col_idx, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for ELL column indices");
+        cl_mem devEllValues = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ellSize * sizeof(value_t), ell.values, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for ELL values");
+        cl_mem devX = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * sizeof(value_t), x, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for vector x");
+        cl_mem devY = clCreateBuffer(context, CL_MEM_WRITE_ONLY, N * sizeof(value_t), NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for vector y");
+
+        // Part 3: create kernels from source
+        cl_program program = cluBuildProgramFromFile(context, device_id, "sparse.cl", NULL);
+        cl_kernel kernelCSR = clCreateKernel(program, "spmv_csr", &err);
+        CLU_ERRCHECK(err, "Failed to create CSR kernel from program");
+        cl_kernel kernelELL = clCreateKernel(program, "spmv_ell", &err);
+        CLU_ERRCHECK(err, "Failed to create ELL kernel from program");
+
+        // Part 4: set arguments and execute kernels
+        cluSetKernelArguments(kernelCSR, 6,
+            sizeof(cl_mem), (void *)&devY,
+            sizeof(cl_mem), (void *)&devRowPtr,
+            sizeof(cl_mem), (void *)&devColIdx,
+            sizeof(cl_mem), (void *)&devValues,
+            sizeof(cl_mem), (void *)&devX,
+            sizeof(int), &N
+        );
+        cluSetKernelArguments(kernelELL, 6,
+            sizeof(cl_mem), (void *)&devY,
+            sizeof(cl_mem), (void *)&devEllColIdx,
+            sizeof(cl_mem), (void *)&devEllValues,
+            sizeof(cl_mem), (void *)&devX,
+            sizeof(int), &N,
+            sizeof(int), &ell.width
+        );
+
+        size_t size = N;
+        for(int f = 0; f<2; f++) {
+            cl_kernel kernel = (f == 0) ? kernelCSR : kernelELL;
+
+            // a stale result of the previous format must not pass the check
+            const value_t nan = NAN;
+            CLU_ERRCHECK(clEnqueueFillBuffer(command_queue, devY, &nan, sizeof(value_t), 0, N * sizeof(value_t), 0, NULL, NULL), "Failed to fill vector y");
+
+            double best = 1e30;
+            for(int r = 0; r<REPETITIONS; r++) {
+                cl_event event;
+                CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &size, NULL, 0, NULL, &event), "Failed to enqueue SpMV kernel");
+                CLU_ERRCHECK(clWaitForEvents(1, &event), "Failed to wait for SpMV kernel");
+                double elapsed = getElapsed(event) / 1e9;
+                if (elapsed < best) best = elapsed;
+                CLU_ERRCHECK(clReleaseEvent(event), "Failed to release event");
+            }
+
+            // Part 5: copy results back to host
+            err = clEnqueueReadBuffer(command_queue, devY, CL_TRUE, 0, N * sizeof(value_t), y, 0, NULL, NULL);
+            CLU_ERRCHECK(err, "Failed reading back result");
+
+            bool ok = checkProduct(A, x, y, N);
+            printf("OpenCL %s: %.3f ms, %.3f GFLOPS, Verification: %s\n", (f == 0) ? "CSR" : "ELL", best*1000, 2.0*csr.nnz / best / 1e9, (ok)?"OK":"FAILED");
+            success = success && ok;
+        }
+
+        // Part 6: cleanup
+        CLU_ERRCHECK(clFlush(command_queue),      "Failed to flush command queue");
+        CLU_ERRCHECK(clFinish(command_queue),     "Failed to wait for command queue completion");
+        CLU_ERRCHECK(clReleaseKernel(kernelCSR),  "Failed to release kernel");
+        CLU_ERRCHECK(clReleaseKernel(kernelELL),  "Failed to release kernel");
+        CLU_ERRCHECK(clReleaseProgram(program),   "Failed to release program");
+        CLU_ERRCHECK(clReleaseMemObject(devRowPtr),    "Failed to release CSR row pointers");
+        CLU_ERRCHECK(clReleaseMemObject(devColIdx),    "Failed to release CSR column indices");
+        CLU_ERRCHECK(clReleaseMemObject(devValues),    "Failed to release CSR values");
+        CLU_ERRCHECK(clReleaseMemObject(devEllColIdx), "Failed to release ELL column indices");
+        CLU_ERRCHECK(clReleaseMemObject(devEllValues), "Failed to release ELL values");
+        CLU_ERRCHECK(clReleaseMemObject(devX), "Failed to release vector x");
+        CLU_ERRCHECK(clReleaseMemObject(devY), "Failed to release vector y");
+        CLU_ERRCHECK(clReleaseCommandQueue(command_queue), "Failed to release command queue");
+        CLU_ERRCHECK(clReleaseContext(context),            "Failed to release OpenCL context");
+    }
+
+    // ---------- check ----------
+
+    printf("Verification: %s\n", (success)?"OK":"FAILED");
+
+    // ---------- cleanup ----------
+
+    releaseCSR(&csr);
+    releaseELL(&ell);
+    releaseMatrix(A);
+    free(x);
+    free(y);
+
+    // done
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+bool checkProduct(const Matrix A, const value_t* x, const value_t* y, int N) {
+    bool success = true;
+    #pragma omp parallel for reduction(&&:success)
+    for(long long i = 0; i<N; i++) {
+        double sum = 0;
+        double magnitude = 0;
+        for(long long j = 0; j<N; j++) {
+            sum += (double)A[i*N+j] * x[j];
+            magnitude += fabs((double)A[i*N+j] * x[j]);
+        }
+        // NaN must never pass
+        success = success && fabs(y[i] - sum) <= 1e-5 * magnitude + 1e-6;
+    }
+    return success;
+}
+
+Matrix createMatrix(int N, int M) {
+    // create data and index vector
+    return malloc(sizeof(value_t)*N*M);
+}
+
+void releaseMatrix(Matrix m) {
+    free(m);
+}
+
+unsigned long long getElapsed(cl_event event) {
+    cl_ulong starttime = 0, endtime = 0;
+    CLU_ERRCHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &starttime, NULL), "Failed to get profiling information");
+    CLU_ERRCHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &endtime, NULL), "Failed to get profiling information");
+	return (endtime-(unsigned long long)starttime);
+}
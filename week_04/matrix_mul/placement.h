@@ -0,0 +1,296 @@
+#pragma once
+
+// sched_setaffinity, sched_getcpu and syscall are GNU extensions, thus
+// _GNU_SOURCE has to be defined before the first include of the program
+
+#include <omp.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+// Thread and memory placement on NUMA machines (Linux only).
+//
+// Memory pages are placed on the NUMA node of the thread touching them first.
+// Thus, if a matrix is initialized by a single thread, all of it ends up on the
+// node of that thread and all other sockets have to access it remotely. The
+// placement policies are:
+//
+//  - serial      ... pages are placed by whoever touches them first (the default of malloc)
+//  - first-touch ... the rows are touched by the threads which process them later on,
+//                    which requires a static schedule and pinned threads
+//  - interleave  ... pages are distributed round-robin over all nodes (via mbind), useful
+//                    for data read by all threads
+//
+// The topology is taken from /sys/devices/system/node, no libnuma is required.
+
+
+#define MAX_NUMA_NODES 64
+#define MAX_CPUS 4096
+
+// the page size assumed for interleaving
+#define PLACEMENT_PAGE_SIZE 4096
+
+// the memory policy of the mbind system call (see numaif.h)
+#define PLACEMENT_MPOL_INTERLEAVE 3
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef enum _pin_policy {
+    PIN_NONE,       // < threads may migrate freely
+    PIN_COMPACT,    // < thread t on the t-th CPU, filling up one node after the other
+    PIN_SCATTER     // < threads distributed round-robin over the nodes
+} pin_policy;
+
+typedef enum _placement_policy {
+    PLACE_SERIAL,
+    PLACE_FIRST_TOUCH,
+    PLACE_INTERLEAVE
+} placement_policy;
+
+// parses "none", "compact" or "scatter", returns false for unknown names
+bool parsePinPolicy(const char* name, pin_policy* policy);
+
+// parses "serial", "first-touch" or "interleave", returns false for unknown names
+bool parsePlacementPolicy(const char* name, placement_policy* policy);
+
+const char* pinPolicyName(pin_policy policy);
+const char* placementPolicyName(placement_policy policy);
+
+// the number of NUMA nodes of this machine (1 if unknown)
+int numNumaNodes();
+
+// the NUMA node of the given CPU (0 if unknown)
+int nodeOfCPU(int cpu);
+
+// pins the threads of subsequent parallel regions according to the given policy
+void pinThreads(pin_policy policy);
+
+// allocates an N x M float matrix placed according to the given policy, rows are
+// assigned to threads like by a static schedule; release with free
+float* allocMatrixPlaced(int N, int M, placement_policy policy);
+
+// measures the read bandwidth of every node's threads streaming through their rows of
+// the N x M matrix m (static schedule) and prints it per node
+void reportNodeBandwidth(const float* m, int N, int M);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+// the node of every CPU and the number of nodes, -1 if not yet read from sysfs
+static int CPU_NODE[MAX_CPUS];
+static int NUM_NODES = -1;
+
+// the target of the reads of the bandwidth measurement
+static volatile float BANDWIDTH_SINK;
+
+static void readTopology() {
+    if (NUM_NODES >= 0) return;
+    for(int c=0; c<MAX_CPUS; c++) CPU_NODE[c] = 0;
+    NUM_NODES = 0;
+    for(int n=0; n<MAX_NUMA_NODES; n++) {
+        char fn[128];
+        snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%d/cpulist", n);
+        FILE* fp = fopen(fn, "r");
+        if (!fp) continue;
+        NUM_NODES = n + 1;
+
+        // a list of ranges, e.g. "0-7,16-23"
+        int lo, hi;
+        while (fscanf(fp, "%d", &lo) == 1) {
+            hi = lo;
+            int c = fgetc(fp);
+            if (c == '-') {
+                if (fscanf(fp, "%d", &hi) != 1) break;
+                c = fgetc(fp);
+            }
+            for(int cpu=lo; cpu<=hi && cpu<MAX_CPUS; cpu++) CPU_NODE[cpu] = n;
+            if (c != ',') break;
+        }
+        fclose(fp);
+    }
+    if (NUM_NODES == 0) NUM_NODES = 1;
+}
+
+bool parsePinPolicy(const char* name, pin_policy* policy) {
+    for(int p=PIN_NONE; p<=PIN_SCATTER; p++) {
+        if (strcmp(name, pinPolicyName(p))) continue;
+        *policy = p;
+        return true;
+    }
+    return false;
+}
+
+bool parsePlacementPolicy(const char* name, placement_policy* policy) {
+    for(int p=PLACE_SERIAL; p<=PLACE_INTERLEAVE; p++) {
+        if (strcmp(name, placementPolicyName(p))) continue;
+        *policy = p;
+        return true;
+    }
+    return false;
+}
+
+const char* pinPolicyName(pin_policy policy) {
+    switch(policy) {
+    case PIN_NONE:    return "none";
+    case PIN_COMPACT: return "compact";
+    case PIN_SCATTER: return "scatter";
+    }
+    return "unknown";
+}
+
+const char* placementPolicyName(placement_policy policy) {
+    switch(policy) {
+    case PLACE_SERIAL:      return "serial";
+    case PLACE_FIRST_TOUCH: return "first-touch";
+    case PLACE_INTERLEAVE:  return "interleave";
+    }
+    return "unknown";
+}
+
+int numNumaNodes() {
+    readTopology();
+    return NUM_NODES;
+}
+
+int nodeOfCPU(int cpu) {
+    readTopology();
+    return (cpu >= 0 && cpu < MAX_CPUS) ? CPU_NODE[cpu] : 0;
+}
+
+void pinThreads(pin_policy policy) {
+    if (policy == PIN_NONE) return;
+    readTopology();
+
+    // the CPUs available to this process, in the order threads are placed on them
+    cpu_set_t available;
+    CPU_ZERO(&available);
+    if (sched_getaffinity(0, sizeof(available), &available) != 0) {
+        fprintf(stderr, "Unable to obtain CPU affinity, threads are not pinned\n");
+        return;
+    }
+
+    // the compact order: all CPUs of node 0, then those of node 1, ...
+    int compact[MAX_CPUS];
+    int first[MAX_NUMA_NODES+1];
+    int count = 0;
+    for(int n=0; n<NUM_NODES; n++) {
+        first[n] = count;
+        for(int c=0; c<MAX_CPUS && c<CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &available) && CPU_NODE[c] == n) compact[count++] = c;
+        }
+    }
+    first[NUM_NODES] = count;
+    if (count == 0) return;
+
+    // the scatter order: the first CPU of every node, then the second of every node, ...
+    int scatter[MAX_CPUS];
+    int num = 0;
+    for(int k=0; num<count; k++) {
+        for(int n=0; n<NUM_NODES; n++) {
+            if (first[n] + k < first[n+1]) scatter[num++] = compact[first[n] + k];
+        }
+    }
+    int* order = (policy == PIN_COMPACT) ? compact : scatter;
+
+    // every thread pins itself, the OpenMP runtime keeps the threads for later regions
+    #pragma omp parallel
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(order[omp_get_thread_num() % count], &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "Unable to pin thread %d\n", omp_get_thread_num());
+        }
+    }
+}
+
+float* allocMatrixPlaced(int N, int M, placement_policy policy) {
+    size_t bytes = sizeof(float) * N * M;
+
+    if (policy == PLACE_INTERLEAVE) {
+        // mbind works on whole pages
+        size_t len = (bytes + PLACEMENT_PAGE_SIZE - 1) / PLACEMENT_PAGE_SIZE * PLACEMENT_PAGE_SIZE;
+        float* m = aligned_alloc(PLACEMENT_PAGE_SIZE, len);
+        unsigned long mask = 0;
+        for(int n=0; n<numNumaNodes() && n<(int)(8*sizeof(mask)); n++) mask |= 1ul << n;
+        if (syscall(SYS_mbind, m, len, PLACEMENT_MPOL_INTERLEAVE, &mask, 8*sizeof(mask), 0) != 0) {
+            fprintf(stderr, "Unable to interleave memory, using default placement\n");
+        }
+        return m;
+    }
+
+    float* m = malloc(bytes);
+    if (policy == PLACE_FIRST_TOUCH) {
+        // the same static schedule as the computation, such that every thread's rows are local
+        #pragma omp parallel for schedule(static)
+        for(long long i = 0; i<N; i++) {
+            memset(m + i*M, 0, sizeof(float) * M);
+        }
+    }
+    return m;
+}
+
+void reportNodeBandwidth(const float* m, int N, int M) {
+    readTopology();
+    int threads = omp_get_max_threads();
+    double seconds[threads];
+    double bytes[threads];
+    int node[threads];
+    float sink = 0;
+
+    // best of a few repetitions, the first one may still fault in pages -- the region may get
+    // fewer threads than requested, the others keep node -1 and are not reported
+    for(int t=0; t<threads; t++) {
+        seconds[t] = 1e30;
+        node[t] = -1;
+    }
+    for(int r=0; r<3; r++) {
+        #pragma omp parallel reduction(+:sink)
+        {
+            int t = omp_get_thread_num();
+            int num = omp_get_num_threads();
+            long long lo = (long long)N * t / num;
+            long long hi = (long long)N * (t+1) / num;
+            node[t] = nodeOfCPU(sched_getcpu());
+            #pragma omp barrier
+            timestamp begin = now();
+            // independent partial sums, such that the loop is bound by the loads rather than
+            // by the latency of a single chain of additions
+            float part[16] = { 0 };
+            long long i = lo*M;
+            for(; i+16<=hi*M; i += 16) {
+                for(int k=0; k<16; k++) part[k] += m[i+k];
+            }
+            for(; i<hi*M; i++) {
+                part[0] += m[i];
+            }
+            float sum = 0;
+            for(int k=0; k<16; k++) sum += part[k];
+            timestamp end = now();
+            sink += sum;
+            bytes[t] = sizeof(float) * (hi - lo) * M;
+            if (end - begin < seconds[t]) seconds[t] = end - begin;
+        }
+    }
+
+    // the threads of a node run in parallel, the slowest determines the bandwidth
+    for(int n=0; n<NUM_NODES; n++) {
+        int count = 0;
+        double total = 0, slowest = 0;
+        for(int t=0; t<threads; t++) {
+            if (node[t] != n) continue;
+            count++;
+            total += bytes[t];
+            if (seconds[t] > slowest) slowest = seconds[t];
+        }
+        if (count == 0) continue;
+        printf("Node %d: %d threads, read bandwidth %.2f GB/s\n", n, count, total / slowest / 1e9);
+    }
+    BANDWIDTH_SINK = sink;
+}
@@ -0,0 +1,85 @@
+
+// y := A * x for a CSR matrix A, one work item per row
+__kernel void spmv_csr(
+    __global float* y,
+    __global const int* row_ptr,
+    __global const int* col_idx,
+    __global const float* values,
+    __global const float* x,
+    int rows
+) {
+    size_t i = get_global_id(0);
+    if (i >= rows) return;
+
+    float sum = 0;
+    for(int p = row_ptr[i]; p < row_ptr[i+1]; p++) {
+        sum += values[p] * x[col_idx[p]];
+    }
+    y[i] = sum;
+}
+
+// y := A * x for an ELL matrix A, one work item per row
+// the column-major layout makes neighboring work items read neighboring entries
+__kernel void spmv_ell(
+    __global float* y,
+    __global const int* col_idx,
+    __global const float* values,
+    __global const float* x,
+    int rows,
+    int width
+) {
+    size_t i = get_global_id(0);
+    if (i >= rows) return;
+
+    float sum = 0;
+    for(int k = 0; k < width; k++) {
+        sum += values[k*rows+i] * x[col_idx[k*rows+i]];
+    }
+    y[i] = sum;
+}
+
+// C := A * B for a CSR matrix A (rows x K) and a dense B (K x M)
+// dimension 0 walks along the rows of B and C to get contiguous accesses
+__kernel void spmm_csr(
+    __global float* c,
+    __global const int* row_ptr,
+    __global const int* col_idx,
+    __global const float* values,
+    __global const float* b,
+    int rows,
+    int M
+) {
+    size_t j = get_global_id(0);
+    size_t i = get_global_id(1);
+    if (i >= rows || j >= M) return;
+
+    float sum = 0;
+    for(int p = row_ptr[i]; p < row_ptr[i+1]; p++) {
+        sum += values[p] * b[col_idx[p]*M+j];
+    }
+    c[i*M+j] = sum;
+}
+
+// C := A * B for a dense A (N x K) and a sparse B (K x M), given as CSR of its
+// transposed -- thus each work item gathers the non-zeros of one column of B
+// and no two work items write the same element of C
+__kernel void gemm_dense_csr(
+    __global float* c,
+    __global const float* a,
+    __global const int* bt_row_ptr,
+    __global const int* bt_col_idx,
+    __global const float* bt_values,
+    int N,
+    int M,
+    int K
+) {
+    size_t j = get_global_id(0);
+    size_t i = get_global_id(1);
+    if (i >= N || j >= M) return;
+
+    float sum = 0;
+    for(int p = bt_row_ptr[j]; p < bt_row_ptr[j+1]; p++) {
+        sum += a[i*K+bt_col_idx[p]] * bt_values[p];
+    }
+    c[i*M+j] = sum;
+}
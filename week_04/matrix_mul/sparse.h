@@ -0,0 +1,262 @@
+#pragma once
+
+#include <stdlib.h>
+
+// Sparse matrix formats and kernels for the matrix multiplication programs.
+//
+// Two formats are supported:
+//  - CSR (compressed sparse row): the non-zeros of row i are stored in
+//    values/col_idx[row_ptr[i] .. row_ptr[i+1]), suitable for any sparsity pattern
+//  - ELL (ELLPACK): every row is padded to the same width, entries are stored
+//    column-major (entry k of row i at k*rows+i) such that consecutive rows are
+//    adjacent in memory -- this gives coalesced accesses on GPUs but wastes work
+//    if row lengths vary a lot
+//
+// Padding entries of ELL matrices have value 0 and column 0, thus kernels do not
+// need to branch on them.
+
+
+// the density below which the sparse kernels are used instead of the dense ones,
+// a sparse product costs roughly 2-4x more per useful operation (index loads,
+// irregular accesses), as a rule of thumb the break-even is around 10%
+#define SPARSE_DENSITY_THRESHOLD 0.1
+
+// the fraction of useful (non-padding) entries of the ELL representation above which ELL is
+// preferred over CSR (see ellEfficiency)
+#define ELL_EFFICIENCY_THRESHOLD 0.5
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _csr_matrix {
+    int rows;
+    int cols;
+    int nnz;
+    int* row_ptr;       // rows+1 entries
+    int* col_idx;       // nnz entries
+    float* values;      // nnz entries
+} csr_matrix;
+
+typedef struct _ell_matrix {
+    int rows;
+    int cols;
+    int width;          // the maximum number of non-zeros per row
+    int* col_idx;       // width*rows entries, column-major
+    float* values;      // width*rows entries, column-major
+} ell_matrix;
+
+// computes the fraction of non-zero entries of the dense N x M matrix m
+double matrixDensity(const float* m, int N, int M);
+
+// converts the dense N x M matrix m to CSR
+csr_matrix csrFromMatrix(const float* m, int N, int M);
+
+// converts the transposed of the dense N x M matrix m to CSR (equivalent to CSC of m)
+csr_matrix csrFromMatrixTransposed(const float* m, int N, int M);
+
+// converts a CSR matrix to ELL
+ell_matrix ellFromCSR(const csr_matrix* m);
+
+// the fraction of useful (non-padding) entries in the ELL representation of m,
+// ELL is only worth it if most entries are useful (see ELL_EFFICIENCY_THRESHOLD)
+double ellEfficiency(const csr_matrix* m);
+
+void releaseCSR(csr_matrix* m);
+void releaseELL(ell_matrix* m);
+
+// y = A * x
+void spmvCSR(const csr_matrix* A, const float* x, float* y);
+void spmvELL(const ell_matrix* A, const float* x, float* y);
+
+// C (A.rows x M) = A * B for a sparse A and a dense B (A.cols x M)
+void spmmCSR(const csr_matrix* A, const float* B, float* C, int M);
+
+// C (N x B.cols) = A * B for a dense A (N x B.rows) and a sparse B
+void gemmDenseCSR(const float* A, const csr_matrix* B, float* C, int N);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+double matrixDensity(const float* m, int N, int M) {
+    long long nnz = 0;
+    #pragma omp parallel for reduction(+:nnz)
+    for(long long i = 0; i<(long long)N*M; i++) {
+        nnz += (m[i] != 0);
+    }
+    return (double)nnz / ((double)N*M);
+}
+
+csr_matrix csrFromMatrix(const float* m, int N, int M) {
+    csr_matrix res;
+    res.rows = N;
+    res.cols = M;
+    res.row_ptr = malloc(sizeof(int)*(N+1));
+
+    // count non-zeros per row, then compute the row offsets by a prefix sum
+    res.row_ptr[0] = 0;
+    #pragma omp parallel for
+    for(long long i = 0; i<N; i++) {
+        int count = 0;
+        for(long long j = 0; j<M; j++) {
+            count += (m[i*M+j] != 0);
+        }
+        res.row_ptr[i+1] = count;
+    }
+    for(int i = 0; i<N; i++) {
+        res.row_ptr[i+1] += res.row_ptr[i];
+    }
+    res.nnz = res.row_ptr[N];
+
+    res.col_idx = malloc(sizeof(int)*res.nnz);
+    res.values = malloc(sizeof(float)*res.nnz);
+    #pragma omp parallel for
+    for(long long i = 0; i<N; i++) {
+        int pos = res.row_ptr[i];
+        for(long long j = 0; j<M; j++) {
+            if (m[i*M+j] == 0) continue;
+            res.col_idx[pos] = j;
+            res.values[pos] = m[i*M+j];
+            pos++;
+        }
+    }
+    return res;
+}
+
+csr_matrix csrFromMatrixTransposed(const float* m, int N, int M) {
+    csr_matrix res;
+    res.rows = M;
+    res.cols = N;
+    res.row_ptr = malloc(sizeof(int)*(M+1));
+
+    // same as above, walking along the columns of m
+    res.row_ptr[0] = 0;
+    #pragma omp parallel for
+    for(long long j = 0; j<M; j++) {
+        int count = 0;
+        for(long long i = 0; i<N; i++) {
+            count += (m[i*M+j] != 0);
+        }
+        res.row_ptr[j+1] = count;
+    }
+    for(int j = 0; j<M; j++) {
+        res.row_ptr[j+1] += res.row_ptr[j];
+    }
+    res.nnz = res.row_ptr[M];
+
+    res.col_idx = malloc(sizeof(int)*res.nnz);
+    res.values = malloc(sizeof(float)*res.nnz);
+    #pragma omp parallel for
+    for(long long j = 0; j<M; j++) {
+        int pos = res.row_ptr[j];
+        for(long long i = 0; i<N; i++) {
+            if (m[i*M+j] == 0) continue;
+            res.col_idx[pos] = i;
+            res.values[pos] = m[i*M+j];
+            pos++;
+        }
+    }
+    return res;
+}
+
+ell_matrix ellFromCSR(const csr_matrix* m) {
+    ell_matrix res;
+    res.rows = m->rows;
+    res.cols = m->cols;
+    res.width = 0;
+    for(int i = 0; i<m->rows; i++) {
+        int len = m->row_ptr[i+1] - m->row_ptr[i];
+        if (len > res.width) res.width = len;
+    }
+
+    long long size = (long long)res.width * res.rows;
+    res.col_idx = malloc(sizeof(int)*size);
+    res.values = malloc(sizeof(float)*size);
+    #pragma omp parallel for
+    for(long long i = 0; i<res.rows; i++) {
+        int begin = m->row_ptr[i];
+        int len = m->row_ptr[i+1] - begin;
+        for(long long k = 0; k<res.width; k++) {
+            res.col_idx[k*res.rows+i] = (k < len) ? m->col_idx[begin+k] : 0;
+            res.values[k*res.rows+i] = (k < len) ? m->values[begin+k] : 0;
+        }
+    }
+    return res;
+}
+
+double ellEfficiency(const csr_matrix* m) {
+    int width = 0;
+    for(int i = 0; i<m->rows; i++) {
+        int len = m->row_ptr[i+1] - m->row_ptr[i];
+        if (len > width) width = len;
+    }
+    if (width == 0) return 1;
+    return (double)m->nnz / ((double)width * m->rows);
+}
+
+void releaseCSR(csr_matrix* m) {
+    free(m->row_ptr);
+    free(m->col_idx);
+    free(m->values);
+}
+
+void releaseELL(ell_matrix* m) {
+    free(m->col_idx);
+    free(m->values);
+}
+
+void spmvCSR(const csr_matrix* A, const float* x, float* y) {
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(long long i = 0; i<A->rows; i++) {
+        float sum = 0;
+        for(int p = A->row_ptr[i]; p < A->row_ptr[i+1]; p++) {
+            sum += A->values[p] * x[A->col_idx[p]];
+        }
+        y[i] = sum;
+    }
+}
+
+void spmvELL(const ell_matrix* A, const float* x, float* y) {
+    #pragma omp parallel for
+    for(long long i = 0; i<A->rows; i++) {
+        float sum = 0;
+        for(long long k = 0; k<A->width; k++) {
+            sum += A->values[k*A->rows+i] * x[A->col_idx[k*A->rows+i]];
+        }
+        y[i] = sum;
+    }
+}
+
+void spmmCSR(const csr_matrix* A, const float* B, float* C, int M) {
+    // row i of C is a linear combination of the rows of B selected by row i of A
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(long long i = 0; i<A->rows; i++) {
+        for(long long j = 0; j<M; j++) {
+            C[i*M+j] = 0;
+        }
+        for(int p = A->row_ptr[i]; p < A->row_ptr[i+1]; p++) {
+            float a = A->values[p];
+            const float* b = B + (long long)A->col_idx[p]*M;
+            for(long long j = 0; j<M; j++) {
+                C[i*M+j] += a * b[j];
+            }
+        }
+    }
+}
+
+void gemmDenseCSR(const float* A, const csr_matrix* B, float* C, int N) {
+    // i-k-j order: row i of C accumulates A[i][k] times the sparse row k of B
+    long long K = B->rows;
+    long long M = B->cols;
+    #pragma omp parallel for
+    for(long long i = 0; i<N; i++) {
+        for(long long j = 0; j<M; j++) {
+            C[i*M+j] = 0;
+        }
+        for(long long k = 0; k<K; k++) {
+            float a = A[i*K+k];
+            for(int p = B->row_ptr[k]; p < B->row_ptr[k+1]; p++) {
+                C[i*M+B->col_idx[p]] += a * B->values[p];
+            }
+        }
+    }
+}
@@ -0,0 +1,34 @@
+
+// the tile size, the kernels have to be launched with TILE x TILE work groups
+#ifndef TILE
+#define TILE 16
+#endif
+
+// m := m^T for an N x N matrix m
+// the work group of tile (bx,by) with bx < by swaps it with tile (by,bx), groups
+// below the diagonal have nothing to do -- diagonal tiles are transposed in place
+__kernel void transpose_in_place(
+    __global float* m,
+    int N
+) {
+    __local float upper[TILE][TILE+1];
+    __local float lower[TILE][TILE+1];
+
+    int gx = get_group_id(0);
+    int gy = get_group_id(1);
+    if (gx < gy) return;            // uniform for the whole group
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int bx = gx * TILE;
+    int by = gy * TILE;
+
+    // load tile (by,bx) and its mirror (bx,by)
+    if (by+ly < N && bx+lx < N) upper[ly][lx] = m[(by+ly)*N + bx+lx];
+    if (bx+ly < N && by+lx < N) lower[ly][lx] = m[(bx+ly)*N + by+lx];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // write both back transposed (for diagonal tiles both are the same)
+    if (by+ly < N && bx+lx < N) m[(by+ly)*N + bx+lx] = lower[lx][ly];
+    if (bx+ly < N && by+lx < N) m[(bx+ly)*N + by+lx] = upper[lx][ly];
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+// Matrix transposition and layout conversion.
+//
+// The in-place transpose is cache-oblivious: the matrix is recursively split
+// along its larger dimension until blocks are small enough to fit into any cache
+// level, thus both the reads and the writes stay cache friendly without tuning
+// for a particular cache size.
+//
+// Besides row-major, matrices may be stored tile-major (blocked): the matrix is
+// divided into T x T tiles stored one after the other (tiles in row-major order),
+// each tile itself row-major. Every tile thus is a contiguous chunk of memory.
+// Partial tiles at the borders are padded with zeros.
+
+
+// blocks with at most this many elements are transposed directly
+#define TRANSPOSE_LEAF_SIZE 256
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+// transposes the N x N matrix m in place
+void transposeSquareInPlace(float* m, int N);
+
+// the number of elements of the tile-major representation of an N x M matrix
+long long tileMajorSize(int N, int M, int T);
+
+// converts the row-major N x M matrix in into tile-major layout with T x T tiles
+void toTileMajor(const float* in, float* out, int N, int M, int T);
+
+// converts the tile-major N x M matrix in (T x T tiles) back into row-major layout
+void fromTileMajor(const float* in, float* out, int N, int M, int T);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+// swaps the block [r0,r1) x [c0,c1) of m with the transposed of block [c0,c1) x [r0,r1)
+void transposeSwapBlock(float* m, int N, int r0, int r1, int c0, int c1) {
+    int rows = r1 - r0;
+    int cols = c1 - c0;
+    if ((long long)rows * cols <= TRANSPOSE_LEAF_SIZE) {
+        for(long long i = r0; i<r1; i++) {
+            for(long long j = c0; j<c1; j++) {
+                float tmp = m[i*N+j];
+                m[i*N+j] = m[j*N+i];
+                m[j*N+i] = tmp;
+            }
+        }
+        return;
+    }
+    if (rows >= cols) {
+        int mid = r0 + rows/2;
+        transposeSwapBlock(m, N, r0, mid, c0, c1);
+        transposeSwapBlock(m, N, mid, r1, c0, c1);
+    } else {
+        int mid = c0 + cols/2;
+        transposeSwapBlock(m, N, r0, r1, c0, mid);
+        transposeSwapBlock(m, N, r0, r1, mid, c1);
+    }
+}
+
+// transposes the diagonal block [b0,b1) x [b0,b1) of m in place
+void transposeDiagonalBlock(float* m, int N, int b0, int b1) {
+    int size = b1 - b0;
+    if ((long long)size * size <= TRANSPOSE_LEAF_SIZE) {
+        for(long long i = b0; i<b1; i++) {
+            for(long long j = i+1; j<b1; j++) {
+                float tmp = m[i*N+j];
+                m[i*N+j] = m[j*N+i];
+                m[j*N+i] = tmp;
+            }
+        }
+        return;
+    }
+    // [ X Y ]    [ X^T Z^T ]
+    // [ Z W ] => [ Y^T W^T ]
+    int mid = b0 + size/2;
+    transposeDiagonalBlock(m, N, b0, mid);
+    transposeDiagonalBlock(m, N, mid, b1);
+    transposeSwapBlock(m, N, b0, mid, mid, b1);
+}
+
+void transposeSquareInPlace(float* m, int N) {
+    transposeDiagonalBlock(m, N, 0, N);
+}
+
+long long tileMajorSize(int N, int M, int T) {
+    long long tilesN = (N + T - 1) / T;
+    long long tilesM = (M + T - 1) / T;
+    return tilesN * tilesM * T * T;
+}
+
+void toTileMajor(const float* in, float* out, int N, int M, int T) {
+    int tilesN = (N + T - 1) / T;
+    int tilesM = (M + T - 1) / T;
+    for(long long bi = 0; bi<tilesN; bi++) {
+        for(long long bj = 0; bj<tilesM; bj++) {
+            float* tile = out + (bi*tilesM + bj)*T*T;
+            for(long long i = 0; i<T; i++) {
+                long long row = bi*T + i;
+                long long col = bj*T;
+                // the number of valid elements in this row of the tile
+                long long len = (row < N) ? ((col + T <= M) ? T : M - col) : 0;
+                if (len > 0) memcpy(tile + i*T, in + row*M + col, sizeof(float)*len);
+                memset(tile + i*T + len, 0, sizeof(float)*(T - len));
+            }
+        }
+    }
+}
+
+void fromTileMajor(const float* in, float* out, int N, int M, int T) {
+    int tilesN = (N + T - 1) / T;
+    int tilesM = (M + T - 1) / T;
+    for(long long bi = 0; bi<tilesN; bi++) {
+        for(long long bj = 0; bj<tilesM; bj++) {
+            const float* tile = in + (bi*tilesM + bj)*T*T;
+            for(long long i = 0; i<T; i++) {
+                long long row = bi*T + i;
+                long long col = bj*T;
+                if (row >= N) break;
+                long long len = (col + T <= M) ? T : M - col;
+                memcpy(out + row*M + col, tile + i*T, sizeof(float)*len);
+            }
+        }
+    }
+}
@@ -1,13 +1,28 @@
 
 typedef float value_t;
 
-__kernel void stencil(
+// The room is stored framed by a layer of ghost cells, as (N+2) x (N+2) matrix holding the
+// cell (i,j) at (i+1)*(N+2) + (j+1). The ghost cells mirror the outermost cells of the room
+// and are refreshed by the boundary kernel after every launch, such that the stencil kernels
+// need no boundary checks.
+//
+// The fixed cells of the room (heat sources, walls, ...) keep their temperature. They are
+// given by a bitmask M of ceil(N/32) words per row (see room.h) -- all cells are updated
+// alike, the fixed ones then select their old value.
+
+// whether the cell (i,j) of the room is fixed
+bool isFixed(__global const uint* M, int N, int i, int j) {
+    return (M[i * ((N+31)/32) + j/32] >> (j%32)) & 1;
+}
+
+// loads the cells of the work group and their neighbors into local memory and computes the
+// new temperature of the work item's cell, its current one is stored in *old -- the result
+// is 0 for excessive work items outside the room; all work items have to call this function
+value_t updateCell(
     __global const value_t* A, 
-    __global value_t* B,
-    int source_x,
-    int source_y,
     int N,
-    __local value_t* L		// local memory to speed up computation
+    __local value_t* L,
+    value_t* old
 ) {
     // obtain position of this 'thread'
     size_t i = get_global_id(1);
@@ -22,7 +37,7 @@ __kernel void stencil(
     // the width of the local buffer
     const size_t LN = mj + 2;
     
-    #define G(X,Y) A[   (X) * N +   (Y)  ]
+    #define G(X,Y) A[((X)+1)*(N+2) + ((Y)+1)]
     #define L(X,Y) L[((X)+1)*LN + ((Y)+1)]
     
     // load part of input buffer B into local memory
@@ -30,38 +45,293 @@ __kernel void stencil(
         // load central box
         L(li,lj) = G(i,j);
 
-        // load boundaries
-        if (li ==   0  && i !=  0)  L(li-1,lj) = G(i-1,j);
-        if (li == mi-1 && i != N-1) L(li+1,lj) = G(i+1,j);
+        // load boundaries -- ghost cells at the walls
+        if (li ==   0)               L(li-1,lj) = G(i-1,j);
+        if (li == mi-1 || i == N-1)  L(li+1,lj) = G(i+1,j);
     
-        if (lj ==   0  && j !=  0)  L(li,lj-1) = G(i,j-1);
-        if (lj == mj-1 && j != N-1) L(li,lj+1) = G(i,j+1);
+        if (lj ==   0)               L(li,lj-1) = G(i,j-1);
+        if (lj == mj-1 || j == N-1)  L(li,lj+1) = G(i,j+1);
     }
     
     // finally: memory fence
     barrier(CLK_LOCAL_MEM_FENCE); // WARNING: same barrier must be reached by all work items
     
     // now we are allowed to kill the excessive work items
-    if ( i >= N || j >=N ) return;
+    *old = 0;
+    if ( i >= N || j >=N ) return 0;
     
     // finally update elements using data from local memory
 
-    // center stays constant (the heat is still on)
-    if (i == source_x && j == source_y) {
-        B[i*N+j] = L(li,lj);
-        return;
-    }
-
     // get current temperature at (i,j)
     value_t tc = L(li,lj);
+    *old = tc;
 
     // get temperatures left/right and up/down
-    value_t tl = ( j !=  0  ) ? L(li,lj-1) : tc;
-    value_t tr = ( j != N-1 ) ? L(li,lj+1) : tc;
-    value_t tu = ( i !=  0  ) ? L(li-1,lj) : tc;
-    value_t td = ( i != N-1 ) ? L(li+1,lj) : tc;
+    value_t tl = L(li,lj-1);
+    value_t tr = L(li,lj+1);
+    value_t tu = L(li-1,lj);
+    value_t td = L(li+1,lj);
 
     // update temperature at current point
-    B[i*N+j] = tc + 0.2f * (tl + tr + tu + td + (-4.0f*tc));
+    return tc + 0.2f * (tl + tr + tu + td + (-4.0f*tc));
+
+    #undef G
+    #undef L
+}
+
+__kernel void stencil(
+    __global const value_t* A, 
+    __global value_t* B,
+    __global const uint* M,
+    int N,
+    __local value_t* L		// local memory to speed up computation
+) {
+    size_t i = get_global_id(1);
+    size_t j = get_global_id(0);
+
+    value_t tc;
+    value_t res = updateCell(A, N, L, &tc);
+    if (i < N && j < N) B[(i+1)*(N+2)+(j+1)] = isFixed(M, N, i, j) ? tc : res;
+}
+
+// like stencil, but also reduces the changes of the cells for checking the convergence: every
+// work group stores the largest change and the sum of the squared changes of its cells in
+// changes[2*g] and changes[2*g+1], g being the linear index of the group. The number of work
+// items of a group has to be a power of 2.
+__kernel void stencil_change(
+    __global const value_t* A, 
+    __global value_t* B,
+    __global const uint* M,
+    int N,
+    __local value_t* L,		// local memory to speed up computation
+    __global value_t* changes,
+    __local value_t* R		// two values per work item for the reduction
+) {
+    size_t i = get_global_id(1);
+    size_t j = get_global_id(0);
+
+    value_t tc;
+    value_t res = updateCell(A, N, L, &tc);
+    if (i < N && j < N) {
+        res = isFixed(M, N, i, j) ? tc : res;
+        B[(i+1)*(N+2)+(j+1)] = res;
+    }
+
+    // the change of this cell, 0 for excessive work items and fixed cells
+    value_t change = fabs(res - tc);
+
+    // reduce within the work group, a tree of pairwise maxima / sums
+    size_t lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+    size_t num = get_local_size(0) * get_local_size(1);
+    R[lid] = change;
+    R[num + lid] = change * change;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(size_t s = num/2; s > 0; s /= 2) {
+        if (lid < s) {
+            R[lid] = fmax(R[lid], R[lid + s]);
+            R[num + lid] += R[num + lid + s];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // the partial results are completed by the host
+    if (lid == 0) {
+        size_t g = get_group_id(1) * get_num_groups(0) + get_group_id(0);
+        changes[2*g]   = R[0];
+        changes[2*g+1] = R[num];
+    }
+}
+
+// completes a launch: copies the outermost cells of the room to the ghost cells -- one work
+// item per row and column of the room
+__kernel void boundary(
+    __global value_t* B,
+    int N
+) {
+    size_t k = get_global_id(0);
+    if (k >= N) return;
+
+    size_t W = N+2;
+
+    B[        k+1    ] = B[     W  + k+1];     // upper wall
+    B[(N+1)*W + k+1  ] = B[   N*W  + k+1];     // lower wall
+    B[(k+1)*W        ] = B[(k+1)*W +  1 ];     // left wall
+    B[(k+1)*W + N+1  ] = B[(k+1)*W +  N ];     // right wall
+}
+
+
+// -- multiple time steps per launch --
+
+// the number of time steps performed by one launch of stencil_multi, set at build time (-D STEPS=k)
+#ifndef STEPS
+#define STEPS 4
+#endif
+
+// performs STEPS time steps at once: every work group loads its tile together with a
+// halo of STEPS cells into local memory and updates it STEPS times -- after s steps the
+// cells within s cells of the halo border are stale, after STEPS steps only the tile
+// itself is valid and written back to B. Between the steps, the ghost cells within the
+// local buffers are refreshed by a separate pass, the update itself covers the whole valid
+// region without any boundary checks -- the fixed cells of the region are loaded into a
+// third local buffer and select their old value.
+__kernel void stencil_multi(
+    __global const value_t* A, 
+    __global value_t* B,
+    __global const uint* M,
+    int N,
+    __local value_t* L,		// two buffers of (mi+2*STEPS) x (mj+2*STEPS) elements
+    __local uchar* F		// (mi+2*STEPS) x (mj+2*STEPS) elements
+) {
+    int li = get_local_id(1);
+    int lj = get_local_id(0);
+
+    int mi = get_local_size(1);
+    int mj = get_local_size(0);
+
+    // the first cell of the tile and the size of the local buffers
+    int ti = get_group_id(1) * mi;
+    int tj = get_group_id(0) * mj;
+    const int LH = mi + 2*STEPS;
+    const int LW = mj + 2*STEPS;
+
+    __local value_t* P = L;
+    __local value_t* Q = L + LH*LW;
+
+    // the local cell (x,y) is the cell (ti - STEPS + x, tj - STEPS + y) of the room,
+    // load the tile and its halo, as far as it is inside the padded grid
+    for(int x = li; x < LH; x += mi) {
+        for(int y = lj; y < LW; y += mj) {
+            int i = ti - STEPS + x;
+            int j = tj - STEPS + y;
+            if (-1 <= i && i <= N && -1 <= j && j <= N) P[x*LW+y] = A[(i+1)*(N+2)+(j+1)];
+            F[x*LW+y] = (0 <= i && i < N && 0 <= j && j < N) ? isFixed(M, N, i, j) : 0;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // the local rows / columns of the ghost cells
+    const int gu = -1 - (ti - STEPS);
+    const int gd =  N - (ti - STEPS);
+    const int gl = -1 - (tj - STEPS);
+    const int gr =  N - (tj - STEPS);
+
+    // whether the local buffers cover any ghost cells -- the same for the whole group
+    const bool walls = gu >= 0 || gd < LH || gl >= 0 || gr < LW;
+
+    // the work items, linearized for the passes over the walls
+    const int lid = li*mj + lj;
+    const int num = mi*mj;
+
+    for(int s = 1; s <= STEPS; s++) {
+
+        // update the cells which are still valid after this step -- cells outside the padded
+        // grid hold garbage, which only reaches ghost cells overwritten below
+        for(int x = s + li; x < LH - s; x += mi) {
+            for(int y = s + lj; y < LW - s; y += mj) {
+
+                // get current temperature at (x,y)
+                value_t tc = P[x*LW+y];
+
+                // get temperatures left/right and up/down
+                value_t tl = P[x*LW+(y-1)];
+                value_t tr = P[x*LW+(y+1)];
+                value_t tu = P[(x-1)*LW+y];
+                value_t td = P[(x+1)*LW+y];
+
+                // update temperature at current point, the fixed cells stay constant
+                value_t res = tc + 0.2f * (tl + tr + tu + td + (-4.0f*tc));
+                Q[x*LW+y] = F[x*LW+y] ? tc : res;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // copy the outermost cells of the room to the ghost cells, the corners are never read
+        if (walls) {
+            for(int y = s + lid; y < LW - s; y += num) {
+                if (s <= gu && gu < LH - s) Q[gu*LW+y] = Q[(gu+1)*LW+y];
+                if (s <= gd && gd < LH - s) Q[gd*LW+y] = Q[(gd-1)*LW+y];
+            }
+            for(int x = s + lid; x < LH - s; x += num) {
+                if (s <= gl && gl < LW - s) Q[x*LW+gl] = Q[x*LW+(gl+1)];
+                if (s <= gr && gr < LW - s) Q[x*LW+gr] = Q[x*LW+(gr-1)];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        __local value_t* H = P;
+        P = Q;
+        Q = H;
+    }
+
+    // write back the tile
+    int i = ti + li;
+    int j = tj + lj;
+    if (i < N && j < N) B[(i+1)*(N+2)+(j+1)] = P[(li+STEPS)*LW + (lj+STEPS)];
+}
+
+
+// -- snapshots --
+
+// averages blocks of F x F cells of the room (fewer at its far walls) into the D x D frame,
+// D = ceil(N/F) -- one work item per cell of the frame
+__kernel void downsample(
+    __global const value_t* A,
+    int N,
+    int F,
+    __global value_t* frame
+) {
+    int x = get_global_id(1);
+    int y = get_global_id(0);
+    int D = (N + F - 1) / F;
+    if (x >= D || y >= D) return;
+
+    int ei = (x*F + F < N) ? x*F + F : N;
+    int ej = (y*F + F < N) ? y*F + F : N;
+    value_t sum = 0;
+    for(int i = x*F; i < ei; i++) {
+        for(int j = y*F; j < ej; j++) {
+            sum += A[(i+1)*(N+2)+(j+1)];
+        }
+    }
+    frame[x*D+y] = sum / ((ei - x*F) * (ej - y*F));
+}
+
+
+// -- visualization --
+
+// computes the maximum temperatures of the H x W tiles shown by printTemperature, tiles of
+// N/H x N/W cells (the remaining rows and columns are not shown, empty tiles are 0) -- one
+// work group per tile, the number of work items of a group has to be a power of 2
+__kernel void tile_max(
+    __global const value_t* A,
+    int N,
+    int H,
+    int W,
+    __global value_t* tiles,
+    __local value_t* R		// one value per work item for the reduction
+) {
+    int ti = get_group_id(1);
+    int tj = get_group_id(0);
+    size_t lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+    size_t num = get_local_size(0) * get_local_size(1);
+
+    // the work items stride over the cells of the tile
+    int sH = N/H;
+    int sW = N/W;
+    value_t max_t = 0;
+    for(int k = lid; k < sH*sW; k += num) {
+        int x = ti*sH + k / sW;
+        int y = tj*sW + k % sW;
+        max_t = fmax(max_t, A[(x+1)*(N+2)+(y+1)]);
+    }
+
+    // reduce within the work group
+    R[lid] = max_t;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(size_t s = num/2; s > 0; s /= 2) {
+        if (lid < s) R[lid] = fmax(R[lid], R[lid + s]);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
 
+    if (lid == 0) tiles[ti*W+tj] = R[0];
 }
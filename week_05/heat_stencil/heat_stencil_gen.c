@@ -0,0 +1,273 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "cl_utils.h"
+#include "stencil.h"
+
+// The heat simulation on top of the generic stencil engine (see stencil.h): the room is a 2D or
+// 3D grid, advanced by a 5-point or 9-point (2D) or 7-point or 27-point (3D) stencil. It is
+// simulated with OpenMP and OpenCL, the results have to agree.
+
+// -- room utilities --
+
+// prints the N x N layer of a room starting at m, rows being stride cells apart
+void printTemperature(const value_t* m, int N, int stride);
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    // 'parsing' optional input parameters = number of points of the stencil, problem size and number of time steps
+    int points = 7;
+    if (argc > 1) {
+        points = atoi(argv[1]);
+    }
+    stencil_desc s = createHeatStencil(points, (points == 5 || points == 9) ? 0.2 : 0.1);
+    int N = (s.dim == 2) ? 500 : 100;
+    if (argc > 2) {
+        N = atoi(argv[2]);
+    }
+    int T = 1000;
+    if (argc > 3) {
+        T = atoi(argv[3]);
+    }
+    long long cells = (s.dim == 3) ? (long long)N*N*N : (long long)N*N;
+    printf("Computing %dD heat-distribution with a %d-point stencil for room size N=%d for T=%d timesteps\n", s.dim, points, N, T);
+
+
+    // ---------- setup ----------
+
+    // create a buffer for storing temperature fields, including the ghost cells
+    long long size = gridSize(s, N);
+    value_t* A = malloc(sizeof(value_t) * size);
+
+    // set up initial conditions in A
+    int NZ = (s.dim == 3) ? N : 1;
+    for(int z = 0; z<NZ; z++) {
+        for(int y = 0; y<N; y++) {
+            for(int x = 0; x<N; x++) {
+                A[gridIndex(s,N,x,y,z)] = 273;      // temperature is 0° C everywhere (273 K)
+            }
+        }
+    }
+
+    // and there is a heat source in one corner
+    int source_x = N/4;
+    int source_y = N/4;
+    int source_z = (s.dim == 3) ? N/4 : 0;
+    A[gridIndex(s,N,source_x,source_y,source_z)] = 273 + 60;
+    refreshHalo(s, A, N);
+
+    // the layer shown is the one of the heat source
+    const long long shown = gridIndex(s,N,0,0,source_z);
+    const int stride = N + 2*s.radius;
+
+    printf("Initial:\n");
+    printTemperature(&A[shown], N, stride);
+
+    // both simulations start from here
+    value_t* B = malloc(sizeof(value_t) * size);
+    value_t* C = malloc(sizeof(value_t) * size);
+    memcpy(C, A, sizeof(value_t) * size);
+
+
+    // ---------- compute (OpenMP) ----------
+
+    timestamp begin = now();
+    for(int t=0; t<T; t++) {
+        stencilStep(s, A, B, N, source_x, source_y, source_z);
+
+        // swap matrices (just pointers, not content)
+        value_t* H = A;
+        A = B;
+        B = H;
+    }
+    timestamp end = now();
+    printf("OpenMP: %.3f ms, %.3f Gcell-updates/s\n", (end-begin)*1000, ((double)cells*T) / (end-begin) / 1e9);
+
+
+    // ---------- compute (OpenCL) ----------
+
+    // Part 1: ocl initialization
+    cl_context context;
+    cl_command_queue command_queue;
+    cl_device_id device_id = cluInitDevice(0, &context, &command_queue);
+
+    // Part 2: create memory buffers
+    cl_int err;
+    cl_mem devMatA = clCreateBuffer(context, CL_MEM_READ_WRITE, size * sizeof(value_t), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+    cl_mem devMatB = clCreateBuffer(context, CL_MEM_READ_WRITE, size * sizeof(value_t), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+
+    // Part 3: fill memory buffers (the ghost cells of B are written by the halo kernel)
+    err = clEnqueueWriteBuffer(command_queue, devMatA, CL_TRUE, 0, size * sizeof(value_t), C, 0, NULL, NULL);
+    CLU_ERRCHECK(err, "Failed to write matrix A to device");
+
+    // Part 4: generate the kernels for the stencil
+    char* options = stencilBuildOptions(s);
+    cl_program program = cluBuildProgramFromFile(context, device_id, "stencil_generic.cl", options);
+    free(options);
+    cl_kernel kernel = clCreateKernel(program, "stencil", &err);
+    CLU_ERRCHECK(err, "Failed to create stencil kernel from program");
+    cl_kernel halo = clCreateKernel(program, "halo", &err);
+    CLU_ERRCHECK(err, "Failed to create halo kernel from program");
+
+    // Part 5: set arguments in kernel (those which are constant)
+    const int R = s.radius;
+    const int RZ = (s.dim == 3) ? R : 0;
+    const size_t workGroupSize[3] = { 16, (s.dim == 3) ? 8 : 16, (s.dim == 3) ? 4 : 1 };
+    clSetKernelArg(kernel, 2, sizeof(int), &N);
+    clSetKernelArg(kernel, 3, sizeof(int), &source_x);
+    clSetKernelArg(kernel, 4, sizeof(int), &source_y);
+    clSetKernelArg(kernel, 5, sizeof(int), &source_z);
+    clSetKernelArg(kernel, 6, (workGroupSize[0]+2*R) * (workGroupSize[1]+2*R) * (workGroupSize[2]+2*RZ) * sizeof(float), NULL); // the local memory
+    clSetKernelArg(halo, 1, sizeof(int), &N);
+
+    // fix size and global work range
+    size_t globalWorkSize[3] = {
+        extendToMultiple(N, workGroupSize[0]),
+        extendToMultiple(N, workGroupSize[1]),
+        extendToMultiple(NZ, workGroupSize[2]),
+    };
+    // the halo kernel, one launch per dimension -- the lines along x and y are enumerated by (y,z)
+    // and (x,z), those along z by (x,y)
+    size_t haloWorkSize[3][2] = { { stride, NZ + 2*RZ }, { stride, NZ + 2*RZ }, { stride, stride } };
+
+    // Part 6: execute kernel
+    begin = now();
+    for(int t=0; t<T; t++) {
+
+        // compute the interior of B, then its ghost cells
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &devMatA);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &devMatB);
+        CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, kernel, 3, NULL, globalWorkSize, workGroupSize, 0, NULL, NULL), "Failed to enqueue stencil kernel");
+        clSetKernelArg(halo, 0, sizeof(cl_mem), &devMatB);
+        for(int d=0; d<s.dim; d++) {
+            clSetKernelArg(halo, 2, sizeof(int), &d);
+            CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, halo, 2, NULL, haloWorkSize[d], NULL, 0, NULL, NULL), "Failed to enqueue halo kernel");
+        }
+
+        // swap matrices (just pointers, not content)
+        cl_mem H = devMatA;
+        devMatA = devMatB;
+        devMatB = H;
+    }
+
+    // get back final version of A
+    err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, size * sizeof(value_t), C, 0, NULL, NULL);
+    CLU_ERRCHECK(err, "Failed to read matrix A from device");
+    end = now();
+    printf("OpenCL: %.3f ms, %.3f Gcell-updates/s\n", (end-begin)*1000, ((double)cells*T) / (end-begin) / 1e9);
+
+    // Part 7: cleanup
+    CLU_ERRCHECK(clFlush(command_queue),    "Failed to flush command queue");
+    CLU_ERRCHECK(clFinish(command_queue),   "Failed to wait for command queue completion");
+    CLU_ERRCHECK(clReleaseKernel(kernel),   "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseKernel(halo),     "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseProgram(program), "Failed to release program");
+    CLU_ERRCHECK(clReleaseMemObject(devMatA), "Failed to release Matrix A");
+    CLU_ERRCHECK(clReleaseMemObject(devMatB), "Failed to release Matrix B");
+    CLU_ERRCHECK(clReleaseCommandQueue(command_queue), "Failed to release command queue");
+    CLU_ERRCHECK(clReleaseContext(context),            "Failed to release OpenCL context");
+
+
+    // ---------- check ----------
+
+    printf("Final:\n");
+    printTemperature(&C[shown], N, stride);
+
+    // all temperatures stay within the initial range (all coefficients are positive, their sum
+    // is 1) and both simulations agree -- up to rounding, e.g. a constant field is not exactly
+    // preserved by a weighted sum and the device may contract multiply-adds
+    const double eps = 1e-3;
+    bool success = true;
+    double maxDiff = 0;
+    for(int z = 0; z<NZ; z++) {
+        for(int y = 0; y<N; y++) {
+            for(int x = 0; x<N; x++) {
+                long long i = gridIndex(s,N,x,y,z);
+                if (!(273-eps <= C[i] && C[i] <= 273+60+eps)) success = false;
+                maxDiff = fmax(maxDiff, fabs((double)C[i] - A[i]));
+            }
+        }
+    }
+    printf("Max. difference between OpenMP and OpenCL: %g K\n", maxDiff);
+    success = success && maxDiff < eps;
+
+    printf("Verification: %s\n", (success)?"OK":"FAILED");
+
+    // ---------- cleanup ----------
+
+    free(A);
+    free(B);
+    free(C);
+    releaseStencil(s);
+
+    // done
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+void printTemperature(const value_t* m, int N, int stride) {
+    const char* colors = " .-:=+*#%@";
+    const int numColors = 10;
+
+    // boundaries for temperature (for simplicity hard-coded)
+    const value_t max = 273 + 30;
+    const value_t min = 273 + 0;
+
+    // set the 'render' resolution
+    int H = 30;
+    int W = 50;
+
+    // step size in each dimension
+    int sH = N/H;
+    int sW = N/W;
+
+
+    // upper wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+    // room
+    for(int i=0; i<H; i++) {
+        // left wall
+        printf("X");
+        // actual room
+        for(int j=0; j<W; j++) {
+
+            // get max temperature in this tile
+            value_t max_t = 0;
+            for(int x=sH*i; x<sH*i+sH; x++) {
+                for(int y=sW*j; y<sW*j+sW; y++) {
+                    value_t t = m[(long long)x*stride+y];
+                    max_t = (max_t < t) ? t : max_t;
+                }
+            }
+            value_t temp = max_t;
+
+            // pick the 'color'
+            int c = ((temp - min) / (max - min)) * numColors;
+            c = (c >= numColors) ? numColors-1 : ((c < 0) ? 0 : c);
+
+            // print the average temperature
+            printf("%c",colors[c]);
+        }
+        // right wall
+        printf("X\n");
+    }
+
+    // lower wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+}
@@ -0,0 +1,675 @@
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "room.h"
+
+typedef float value_t;
+#define MPI_VALUE_T MPI_FLOAT
+
+
+// -- matrix utilities --
+
+typedef value_t* Matrix;
+
+Matrix createMatrix(int N, int M);
+
+void releaseMatrix(Matrix m);
+
+// the resolution of printed rooms, every character shows the maximum temperature of a tile
+#define RENDER_H 30
+#define RENDER_W 50
+
+// prints a room given the maximum temperatures of its tiles
+void printTiles(const value_t* tiles);
+
+// -- domain decomposition --
+
+// The room of size N is decomposed into a grid of tiles, one per process, as square as possible
+// (see MPI_Dims_create). Every process stores its n x m tile framed by a layer of ghost cells,
+// as (n+2) x (m+2) matrix holding the cell (i,j) of the tile at LIDX(i,j). The ghost cells at
+// the walls of the room repeat the outermost cells of the tile, like in heat_stencil_omp, the
+// others hold the outermost cells of the neighboring tiles, the halo.
+//
+// In every time step the halo exchange is started first, non-blocking, and the cells not
+// adjacent to the border of the tile -- those not needing the halo -- are updated while the
+// messages are in flight. Only then the exchange is waited for and the outermost rows and
+// columns of the tile are updated. All cells are updated by the same expression as in the
+// sequential version, such that the result does not depend on the number of processes.
+
+typedef struct _domain {
+    MPI_Comm comm;              // < the grid of processes, rank 0 being rank 0 of the original communicator
+    int dims[2];                // < its extent, rows x columns of tiles
+    int N;                      // < the size of the room
+    int i0, j0;                 // < the position of the tile within the room
+    int n, m;                   // < the size of the tile
+    int up, down, left, right;  // < the neighboring processes, MPI_PROC_NULL at the walls
+    MPI_Datatype column;        // < a column of the tile, excluding the ghost cells
+} domain;
+
+#define LIDX(i,j) ((long long)((i)+1)*(m+2) + ((j)+1))
+
+// the number of rows of the interior updated between two polls of the halo exchange, such that
+// it progresses while the interior is computed
+#define POLL_ROWS 32
+
+// decomposes the room of size N among the processes of comm
+domain createDomain(MPI_Comm comm, int N);
+
+void releaseDomain(domain* d);
+
+// sets up the room R of size N, stored with ghost cells -- a heat source in one corner or the
+// sources and walls of the given layout (see room.h) -- fixing its sources and walls in fixed
+void initRoom(Matrix R, room_mask fixed, int N, const char* layoutFile);
+
+// sets up the tile A of the room set up by initRoom, fixing its sources and walls in fixed
+void initTile(const domain* d, Matrix A, room_mask fixed, const char* layoutFile);
+
+// advances the tile A by a single step, the result is written to B; returns the time spent
+// waiting for the halo exchange
+double step(const domain* d, Matrix A, Matrix B, room_mask fixed);
+
+// prints the room on process 0, its tiles being A -- the maxima of the printed tiles are reduced
+// among the processes instead of collecting the room
+void printTemperature(const domain* d, const Matrix A);
+
+// collects the room on process 0, its tiles being A, as matrix with ghost cells (NULL on the others)
+Matrix gatherRoom(const domain* d, const Matrix A);
+
+// advances the room A of size N by a single step sequentially, like heat_stencil_omp, the result
+// is written to B
+void propagate(Matrix A, Matrix B, int N, room_mask fixed);
+
+// -- scaling --
+
+// The scaling reports run the simulation of the room with a single heat source on 1, 2, 4, ..
+// and all processes, SCALING_STEPS steps each. The room is of size N for the strong scaling
+// report and of size N * sqrt(p) on p processes for the weak one, such that every process
+// keeps about N x N cells.
+
+#ifndef SCALING_STEPS
+#define SCALING_STEPS 1000
+#endif
+
+typedef struct _measurement {
+    int dims[2];        // < the grid of processes
+    double time;        // < the time of the simulation, the maximum among the processes
+    double wait;        // < the time waiting for halo exchanges, the average among the processes
+} measurement;
+
+// simulates T steps of a room of size N on the processes of comm, the result is valid on process 0
+measurement measure(MPI_Comm comm, int N, int T);
+
+// prints the strong or weak scaling report for a room of size N (per process for weak scaling)
+void reportScaling(bool weak, int N);
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // 'parsing' optional input parameters
+    //  - N      ... the problem size (per process for the weak scaling report)
+    //  - verify ... re-run the simulation sequentially on process 0 and compare
+    //  - strong ... print the strong scaling report instead
+    //  - weak   ... print the weak scaling report instead
+    //  - any other argument is a room layout (see room.h)
+    int N = 500;
+    bool verify = false;
+    bool strong = false;
+    bool weak = false;
+    const char* layoutFile = NULL;
+    for(int a=1; a<argc; a++) {
+        char* end;
+        long value = strtol(argv[a], &end, 10);
+        if (!strcmp(argv[a], "verify")) {
+            verify = true;
+        } else if (!strcmp(argv[a], "strong")) {
+            strong = true;
+        } else if (!strcmp(argv[a], "weak")) {
+            weak = true;
+        } else if (*argv[a] && !*end) {
+            N = value;
+        } else {
+            layoutFile = argv[a];
+        }
+    }
+
+    if (strong || weak) {
+        if (strong) reportScaling(false, N);
+        if (strong && weak && !rank) printf("\n");
+        if (weak) reportScaling(true, N);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+
+    int T = N*100;
+    domain d = createDomain(MPI_COMM_WORLD, N);
+    if (!rank) {
+        printf("Computing heat-distribution for room size N=%d for T=%d timesteps on %d processes (%d x %d tiles)\n", N, T, size, d.dims[0], d.dims[1]);
+    }
+
+
+    // ---------- setup ----------
+
+    // create a buffer for storing the tile of this process, including the ghost cells
+    Matrix A = createMatrix(d.n+2, d.m+2);
+
+    // set up initial conditions in A, the cells being numbered within the tile
+    room_mask fixed = createMask((d.n > d.m) ? d.n : d.m);
+    initTile(&d, A, fixed, layoutFile);
+    if (layoutFile) {
+        long long count = countFixedCells(fixed);
+        long long total = 0;
+        MPI_Reduce(&count, &total, 1, MPI_LONG_LONG, MPI_SUM, 0, d.comm);
+        if (!rank) printf("Using layout %s, %lld fixed cells\n", layoutFile, total);
+    }
+
+    if (!rank) printf("Initial:\n");
+    printTemperature(&d, A);
+
+    // ---------- compute ----------
+
+    // create a second buffer for the computation
+    Matrix B = createMatrix(d.n+2, d.m+2);
+
+    MPI_Barrier(d.comm);
+    timestamp begin = now();
+    double wait = 0;
+
+    // for each time step ..
+    for(int t=0; t<T; t++) {
+
+        // .. we exchange the halo and propagate the temperature
+        wait += step(&d, A, B, fixed);
+
+        // swap matrices (just pointers, not content)
+        Matrix H = A;
+        A = B;
+        B = H;
+
+        // show intermediate step
+        if (!(t%1000)) {
+            if (!rank) printf("Step t=%d:\n", t);
+            printTemperature(&d, A);
+        }
+    }
+
+    timestamp end = now();
+    double time = end - begin;
+    double maxTime = 0;
+    double totalWait = 0;
+    MPI_Reduce(&time, &maxTime, 1, MPI_DOUBLE, MPI_MAX, 0, d.comm);
+    MPI_Reduce(&wait, &totalWait, 1, MPI_DOUBLE, MPI_SUM, 0, d.comm);
+    if (!rank) {
+        printf("Total time: %.3f ms\n", maxTime*1000);
+        printf("Throughput: %.3f Gcell-updates/s\n", ((double)N*N*T) / maxTime / 1e9);
+        printf("Waiting for halo exchanges: %.1f%% of the time on average\n", totalWait / size / maxTime * 100);
+    }
+
+    releaseMatrix(B);
+
+
+    // ---------- check ----------
+
+    if (!rank) printf("Final:\n");
+    printTemperature(&d, A);
+
+    int success = true;
+    for(long long i = 0; i<d.n; i++) {
+        int m = d.m;
+        for(long long j = 0; j<m; j++) {
+            value_t temp = A[LIDX(i,j)];
+            if (273 <= temp && temp <= 273+60) continue;
+            success = false;
+            break;
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &success, 1, MPI_INT, MPI_LAND, d.comm);
+
+    // the sequential simulation has to produce exactly the same room
+    if (verify) {
+        Matrix C = gatherRoom(&d, A);
+        if (!rank) {
+            printf("Running sequential simulation for comparison ..\n");
+            Matrix R = createMatrix(N+2, N+2);
+            Matrix S = createMatrix(N+2, N+2);
+            room_mask all = createMask(N);
+            initRoom(R, all, N, layoutFile);
+            for(int t=0; t<T; t++) {
+                propagate(R, S, N, all);
+                Matrix H = R;
+                R = S;
+                S = H;
+            }
+            bool identical = true;
+            for(long long i = 0; i<N; i++) {
+                identical = identical && !memcmp(&C[(i+1)*(N+2)+1], &R[(i+1)*(N+2)+1], sizeof(value_t)*N);
+            }
+            printf("Bit-identical to sequential version: %s\n", (identical) ? "yes" : "no");
+            success = success && identical;
+            releaseMatrix(R);
+            releaseMatrix(S);
+            releaseMask(all);
+        }
+        MPI_Bcast(&success, 1, MPI_INT, 0, d.comm);
+        releaseMatrix(C);
+    }
+
+    if (!rank) printf("Verification: %s\n", (success)?"OK":"FAILED");
+
+    // ---------- cleanup ----------
+
+    releaseMatrix(A);
+    releaseMask(fixed);
+    releaseDomain(&d);
+    MPI_Finalize();
+
+    // done
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+domain createDomain(MPI_Comm comm, int N) {
+    domain d;
+    d.N = N;
+
+    // the grid of processes -- without reordering, such that rank 0 prints
+    int size;
+    MPI_Comm_size(comm, &size);
+    d.dims[0] = 0;
+    d.dims[1] = 0;
+    MPI_Dims_create(size, 2, d.dims);
+    if (N < d.dims[0]) {
+        fprintf(stderr, "Room size N=%d too small for %d x %d tiles\n", N, d.dims[0], d.dims[1]);
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    int periods[2] = { 0, 0 };
+    MPI_Cart_create(comm, 2, d.dims, periods, 0, &d.comm);
+
+    // the rows and columns are distributed as evenly as possible
+    int rank, coords[2];
+    MPI_Comm_rank(d.comm, &rank);
+    MPI_Cart_coords(d.comm, rank, 2, coords);
+    d.i0 = (long long)coords[0] * N / d.dims[0];
+    d.j0 = (long long)coords[1] * N / d.dims[1];
+    d.n = (long long)(coords[0]+1) * N / d.dims[0] - d.i0;
+    d.m = (long long)(coords[1]+1) * N / d.dims[1] - d.j0;
+
+    MPI_Cart_shift(d.comm, 0, 1, &d.up, &d.down);
+    MPI_Cart_shift(d.comm, 1, 1, &d.left, &d.right);
+
+    MPI_Type_vector(d.n, 1, d.m+2, MPI_VALUE_T, &d.column);
+    MPI_Type_commit(&d.column);
+    return d;
+}
+
+void releaseDomain(domain* d) {
+    MPI_Type_free(&d->column);
+    MPI_Comm_free(&d->comm);
+}
+
+void initRoom(Matrix R, room_mask fixed, int N, const char* layoutFile) {
+    for(long long i = 0; i<N; i++) {
+        for(long long j = 0; j<N; j++) {
+            R[(i+1)*(N+2)+(j+1)] = 273;     // temperature is 0° C everywhere (273 K)
+        }
+    }
+    if (layoutFile) {
+        loadLayout(layoutFile, fixed, &R[(N+2)+1], N, N+2);
+    } else {
+        int source_x = N/4;
+        int source_y = N/4;
+        R[(long long)(source_x+1)*(N+2)+(source_y+1)] = 273 + 60;
+        fixCell(fixed, source_x, source_y);
+    }
+}
+
+void initTile(const domain* d, Matrix A, room_mask fixed, const char* layoutFile) {
+    int N = d->N;
+    int m = d->m;
+
+    // a layout covers the whole room, every process reads it and keeps its tile
+    if (layoutFile) {
+        Matrix R = createMatrix(N+2, N+2);
+        room_mask all = createMask(N);
+        initRoom(R, all, N, layoutFile);
+        for(int i = 0; i<d->n; i++) {
+            for(int j = 0; j<d->m; j++) {
+                A[LIDX(i,j)] = R[(long long)(d->i0+i+1)*(N+2) + (d->j0+j+1)];
+                if (isFixedCell(all, d->i0+i, d->j0+j)) fixCell(fixed, i, j);
+            }
+        }
+        releaseMatrix(R);
+        releaseMask(all);
+        return;
+    }
+
+    // otherwise the heat source is in the tile of a single process
+    for(int i = 0; i<d->n; i++) {
+        for(int j = 0; j<d->m; j++) {
+            A[LIDX(i,j)] = 273;
+        }
+    }
+    int source_x = N/4 - d->i0;
+    int source_y = N/4 - d->j0;
+    if (0 <= source_x && source_x < d->n && 0 <= source_y && source_y < d->m) {
+        A[LIDX(source_x,source_y)] = 273 + 60;
+        fixCell(fixed, source_x, source_y);
+    }
+}
+
+// updates the cells of rows i0 <= i < i1 and columns j0 <= j < j1 of a tile with m columns, the
+// result is written to B -- the same expression as in the sequential version
+static void update(const Matrix A, Matrix B, int m, int i0, int i1, int j0, int j1) {
+    for(long long i = i0; i<i1; i++) {
+        const value_t* a = &A[LIDX(i,0)];
+        value_t* b = &B[LIDX(i,0)];
+        for(long long j = j0; j<j1; j++) {
+
+            // get current temperature at (i,j)
+            value_t tc = a[j];
+
+            // get temperatures left/right and up/down, ghost cells at the border
+            value_t tl = a[j-1];
+            value_t tr = a[j+1];
+            value_t tu = a[j-(m+2)];
+            value_t td = a[j+(m+2)];
+
+            // update temperature at current point
+            b[j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
+        }
+    }
+}
+
+double step(const domain* d, Matrix A, Matrix B, room_mask fixed) {
+    int n = d->n;
+    int m = d->m;
+
+    // the ghost cells at the walls of the room
+    if (d->up == MPI_PROC_NULL) memcpy(&A[LIDX(-1,0)], &A[LIDX(0,0)], sizeof(value_t)*m);
+    if (d->down == MPI_PROC_NULL) memcpy(&A[LIDX(n,0)], &A[LIDX(n-1,0)], sizeof(value_t)*m);
+    for(int i = 0; i<n; i++) {
+        if (d->left == MPI_PROC_NULL) A[LIDX(i,-1)] = A[LIDX(i,0)];
+        if (d->right == MPI_PROC_NULL) A[LIDX(i,m)] = A[LIDX(i,m-1)];
+    }
+
+    // start the halo exchange: the outermost rows and columns go to the neighbors, theirs are
+    // received into the ghost cells -- tagged by the direction they travel in (0 down, 1 up,
+    // 2 right, 3 left), communication with MPI_PROC_NULL completes immediately
+    MPI_Request requests[8];
+    MPI_Irecv(&A[LIDX(-1,0)], m, MPI_VALUE_T, d->up,    0, d->comm, &requests[0]);
+    MPI_Irecv(&A[LIDX( n,0)], m, MPI_VALUE_T, d->down,  1, d->comm, &requests[1]);
+    MPI_Irecv(&A[LIDX(0,-1)], 1, d->column,   d->left,  2, d->comm, &requests[2]);
+    MPI_Irecv(&A[LIDX(0, m)], 1, d->column,   d->right, 3, d->comm, &requests[3]);
+    MPI_Isend(&A[LIDX(n-1,0)], m, MPI_VALUE_T, d->down,  0, d->comm, &requests[4]);
+    MPI_Isend(&A[LIDX(  0,0)], m, MPI_VALUE_T, d->up,    1, d->comm, &requests[5]);
+    MPI_Isend(&A[LIDX(0,m-1)], 1, d->column,   d->right, 2, d->comm, &requests[6]);
+    MPI_Isend(&A[LIDX(0,  0)], 1, d->column,   d->left,  3, d->comm, &requests[7]);
+
+    // update the interior meanwhile, polling the exchange such that it progresses
+    int done = false;
+    for(int i = 1; i<n-1; i += POLL_ROWS) {
+        update(A, B, m, i, (i+POLL_ROWS < n-1) ? i+POLL_ROWS : n-1, 1, m-1);
+        if (!done) MPI_Testall(8, requests, &done, MPI_STATUSES_IGNORE);
+    }
+
+    // wait for the halo, then update the border of the tile
+    timestamp begin = now();
+    MPI_Waitall(8, requests, MPI_STATUSES_IGNORE);
+    double wait = now() - begin;
+
+    update(A, B, m, 0, 1, 0, m);
+    if (n > 1) update(A, B, m, n-1, n, 0, m);
+    update(A, B, m, 1, n-1, 0, 1);
+    if (m > 1) update(A, B, m, 1, n-1, m-1, m);
+
+    // the fixed cells stay constant (e.g. the heat is still on)
+    for(int i = 0; i<n; i++) {
+        restoreFixedCells(fixed, i, &A[LIDX(i,0)], &B[LIDX(i,0)]);
+    }
+    return wait;
+}
+
+void printTemperature(const domain* d, const Matrix A) {
+    int m = d->m;
+
+    // step size in each dimension
+    int sH = d->N/RENDER_H;
+    int sW = d->N/RENDER_W;
+
+    // the maxima of the parts of the printed tiles within the tile of this process
+    value_t local[RENDER_H * RENDER_W];
+    for(int i=0; i<RENDER_H; i++) {
+        for(int j=0; j<RENDER_W; j++) {
+            int x0 = (sH*i > d->i0) ? sH*i : d->i0;
+            int x1 = (sH*i+sH < d->i0+d->n) ? sH*i+sH : d->i0+d->n;
+            int y0 = (sW*j > d->j0) ? sW*j : d->j0;
+            int y1 = (sW*j+sW < d->j0+d->m) ? sW*j+sW : d->j0+d->m;
+            value_t max_t = 0;
+            for(int x=x0; x<x1; x++) {
+                for(int y=y0; y<y1; y++) {
+                    value_t t = A[LIDX(x-d->i0, y-d->j0)];
+                    max_t = (max_t < t) ? t : max_t;
+                }
+            }
+            local[i*RENDER_W+j] = max_t;
+        }
+    }
+
+    value_t tiles[RENDER_H * RENDER_W];
+    MPI_Reduce(local, tiles, RENDER_H * RENDER_W, MPI_VALUE_T, MPI_MAX, 0, d->comm);
+
+    int rank;
+    MPI_Comm_rank(d->comm, &rank);
+    if (!rank) printTiles(tiles);
+}
+
+Matrix gatherRoom(const domain* d, const Matrix A) {
+    int N = d->N;
+    int m = d->m;
+    int rank, size;
+    MPI_Comm_rank(d->comm, &rank);
+    MPI_Comm_size(d->comm, &size);
+
+    // the tiles are sent without their ghost cells
+    Matrix packed = createMatrix(d->n, d->m);
+    for(int i = 0; i<d->n; i++) {
+        memcpy(&packed[(long long)i*d->m], &A[LIDX(i,0)], sizeof(value_t)*d->m);
+    }
+
+    // process 0 needs to know where they belong
+    int tile[4] = { d->i0, d->j0, d->n, d->m };
+    int* tiles = (!rank) ? malloc(sizeof(int)*4*size) : NULL;
+    MPI_Gather(tile, 4, MPI_INT, tiles, 4, MPI_INT, 0, d->comm);
+
+    int* counts = NULL;
+    int* displs = NULL;
+    Matrix all = NULL;
+    if (!rank) {
+        counts = malloc(sizeof(int)*size);
+        displs = malloc(sizeof(int)*size);
+        int offset = 0;
+        for(int r = 0; r<size; r++) {
+            counts[r] = tiles[4*r+2] * tiles[4*r+3];
+            displs[r] = offset;
+            offset += counts[r];
+        }
+        all = createMatrix(N, N);
+    }
+    MPI_Gatherv(packed, d->n*d->m, MPI_VALUE_T, all, counts, displs, MPI_VALUE_T, 0, d->comm);
+    releaseMatrix(packed);
+
+    // unpack the tiles into the room
+    Matrix R = NULL;
+    if (!rank) {
+        R = createMatrix(N+2, N+2);
+        for(int r = 0; r<size; r++) {
+            const int* t = &tiles[4*r];
+            for(int i = 0; i<t[2]; i++) {
+                memcpy(&R[(long long)(t[0]+i+1)*(N+2) + (t[1]+1)], &all[displs[r] + (long long)i*t[3]], sizeof(value_t)*t[3]);
+            }
+        }
+        releaseMatrix(all);
+        free(counts);
+        free(displs);
+        free(tiles);
+    }
+    return R;
+}
+
+void propagate(Matrix A, Matrix B, int N, room_mask fixed) {
+    // the room is a single tile
+    int m = N;
+
+    // the walls, like refreshGhostCells of heat_stencil_omp
+    for(int j = 0; j<N; j++) {
+        A[LIDX(-1,j)] = A[LIDX( 0 ,j)];
+        A[LIDX( N,j)] = A[LIDX(N-1,j)];
+    }
+    for(int i = 0; i<N; i++) {
+        A[LIDX(i,-1)] = A[LIDX(i, 0 )];
+        A[LIDX(i, N)] = A[LIDX(i,N-1)];
+    }
+
+    update(A, B, m, 0, N, 0, N);
+    for(int i = 0; i<N; i++) {
+        restoreFixedCells(fixed, i, &A[LIDX(i,0)], &B[LIDX(i,0)]);
+    }
+}
+
+measurement measure(MPI_Comm comm, int N, int T) {
+    domain d = createDomain(comm, N);
+    Matrix A = createMatrix(d.n+2, d.m+2);
+    Matrix B = createMatrix(d.n+2, d.m+2);
+    room_mask fixed = createMask((d.n > d.m) ? d.n : d.m);
+    initTile(&d, A, fixed, NULL);
+
+    MPI_Barrier(d.comm);
+    timestamp begin = now();
+    double wait = 0;
+    for(int t=0; t<T; t++) {
+        wait += step(&d, A, B, fixed);
+        Matrix H = A;
+        A = B;
+        B = H;
+    }
+    double time = now() - begin;
+
+    measurement res = { { d.dims[0], d.dims[1] }, 0, 0 };
+    int size;
+    MPI_Comm_size(d.comm, &size);
+    MPI_Reduce(&time, &res.time, 1, MPI_DOUBLE, MPI_MAX, 0, d.comm);
+    MPI_Reduce(&wait, &res.wait, 1, MPI_DOUBLE, MPI_SUM, 0, d.comm);
+    res.wait /= size;
+
+    releaseMatrix(A);
+    releaseMatrix(B);
+    releaseMask(fixed);
+    releaseDomain(&d);
+    return res;
+}
+
+void reportScaling(bool weak, int N) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (!rank) {
+        if (weak) {
+            printf("Weak scaling, %d timesteps, about N=%d x %d cells per process:\n", SCALING_STEPS, N, N);
+        } else {
+            printf("Strong scaling, %d timesteps, room size N=%d:\n", SCALING_STEPS, N);
+        }
+        printf("processes    tiles        N     time [ms]  Gcell-updates/s  speedup  efficiency  halo wait\n");
+    }
+
+    // 1, 2, 4, .. processes, and all of them
+    double base = 0;
+    for(int p = 1; p <= size; p = (p < size && 2*p > size) ? size : 2*p) {
+
+        // the first p processes run the simulation, the others skip it
+        MPI_Comm comm;
+        MPI_Comm_split(MPI_COMM_WORLD, (rank < p) ? 0 : MPI_UNDEFINED, rank, &comm);
+        if (comm == MPI_COMM_NULL) continue;
+        int roomSize = (weak) ? (int)lround(N * sqrt(p)) : N;
+        measurement res = measure(comm, roomSize, SCALING_STEPS);
+        MPI_Comm_free(&comm);
+
+        // the speedup of weak scaling is the scaled one, p times the work in the time taken
+        if (rank) continue;
+        if (p == 1) base = res.time;
+        double speedup = (weak) ? base * p / res.time : base / res.time;
+        printf("%9d  %3d x %-3d %7d  %12.3f  %15.3f  %7.2f  %9.1f%%  %8.1f%%\n",
+            p, res.dims[0], res.dims[1], roomSize, res.time*1000,
+            ((double)roomSize*roomSize*SCALING_STEPS) / res.time / 1e9,
+            speedup, speedup / p * 100, res.wait / res.time * 100
+        );
+    }
+}
+
+
+Matrix createMatrix(int N, int M) {
+    // create data and index vector
+    return malloc(sizeof(value_t)*N*M);
+}
+
+void releaseMatrix(Matrix m) {
+    free(m);
+}
+
+void printTiles(const value_t* tiles) {
+    const char* colors = " .-:=+*#%@";
+    const int numColors = 10;
+
+    // boundaries for temperature (for simplicity hard-coded)
+    const value_t max = 273 + 30;
+    const value_t min = 273 + 0;
+
+    // set the 'render' resolution
+    int H = RENDER_H;
+    int W = RENDER_W;
+
+
+    // upper wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+    // room
+    for(int i=0; i<H; i++) {
+        // left wall
+        printf("X");
+        // actual room
+        for(int j=0; j<W; j++) {
+
+            // get max temperature in this tile
+            value_t temp = tiles[i*W+j];
+
+            // pick the 'color'
+            int c = ((temp - min) / (max - min)) * numColors;
+            c = (c >= numColors) ? numColors-1 : ((c < 0) ? 0 : c);
+
+            // print the average temperature
+            printf("%c",colors[c]);
+        }
+        // right wall
+        printf("X\n");
+    }
+
+    // lower wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+}
@@ -1,8 +1,11 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "utils.h"
 #include "cl_utils.h"
+#include "snapshot.h"
+#include "room.h"
 
 
 typedef float value_t;
@@ -18,36 +21,114 @@ void releaseMatrix(Matrix m);
 
 void printTemperature(Matrix m, int N, int M);
 
+// the resolution of printTemperature, every character shows the maximum temperature of a tile
+#define RENDER_H 30
+#define RENDER_W 50
+
+// computes the maximum temperatures of the RENDER_H x RENDER_W tiles of the N x M room m
+void computeTileMaxima(Matrix m, int N, int M, value_t* tiles);
+
+// prints a room given the maximum temperatures of its tiles
+void printTiles(const value_t* tiles);
+
+// -- ghost cells --
+
+// The room is stored framed by a layer of ghost cells, as (N+2) x (N+2) matrix holding the
+// cell (i,j) at IDX(i,j), on the host as well as on the device (see heat_stencil.cl).
+
+#define IDX(i,j) ((long long)((i)+1)*(N+2) + ((j)+1))
+
+// copies the outermost cells of the room of size N to the adjacent ghost cells
+void refreshGhostCells(Matrix m, int N);
+
+// -- convergence --
+
+// Given a tolerance, the simulation stops early once no cell changes by more than the
+// tolerance during a time step. Every CHECK_INTERVAL-th step is computed by stencil_change,
+// which reduces the changes within every work group alongside the update. The partial
+// results are read without blocking and only evaluated at the next check, when they have
+// long arrived -- the host never waits for the device, but stops CHECK_INTERVAL steps late.
+
+#ifndef CHECK_INTERVAL
+#define CHECK_INTERVAL 100
+#endif
+
+// -- snapshots --
+
+// Given a file name, a downsampled snapshot of the field is written to it every
+// SNAPSHOT_INTERVAL steps in the background (see snapshot.h).
+
+#ifndef SNAPSHOT_INTERVAL
+#define SNAPSHOT_INTERVAL 100
+#endif
+
 // ----------------------
 
 
 int main(int argc, char** argv) {
 
-    // 'parsing' optional input parameter = problem size
+    // 'parsing' optional input parameters = problem size, time steps per kernel launch, tolerance (0 ... run all steps),
+    // snapshot file ("-" ... none) and room layout
     int N = 500;
     if (argc > 1) {
         N = atoi(argv[1]);
     }
+    int K = 4;
+    if (argc > 2) {
+        K = atoi(argv[2]);
+    }
+    if (K < 1 || K > 16) {
+        printf("The number of time steps per launch has to be within [1,16]\n");
+        return EXIT_FAILURE;
+    }
+    double tolerance = 0;
+    if (argc > 3) {
+        tolerance = atof(argv[3]);
+    }
+    const char* snapshotFile = NULL;
+    if (argc > 4 && strcmp(argv[4], "-")) {
+        snapshotFile = argv[4];
+    }
+    const char* layoutFile = NULL;
+    if (argc > 5) {
+        layoutFile = argv[5];
+    }
     int T = N*100;
-    printf("Computing heat-distribution for room size N=%d for T=%d timesteps\n", N, T);
+    printf("Computing heat-distribution for room size N=%d for T=%d timesteps (%d per launch)\n", N, T, K);
+    if (tolerance > 0) {
+        printf("Stopping once no cell changes by more than %g K per step, checked every %d steps\n", tolerance, CHECK_INTERVAL);
+    }
+    if (snapshotFile) {
+        printf("Writing a snapshot every %d steps to %s\n", SNAPSHOT_INTERVAL, snapshotFile);
+    }
 
     
     // ---------- setup ----------
 
-    // create a buffer for storing temperature fields
-    Matrix A = createMatrix(N,N);
+    // create a buffer for storing temperature fields, including the ghost cells
+    Matrix A = createMatrix(N+2,N+2);
     
     // set up initial conditions in A
     for(int i = 0; i<N; i++) {
         for(int j = 0; j<N; j++) {
-            A[i*N+j] = 273;             // temperature is 0° C everywhere (273 K)
+            A[IDX(i,j)] = 273;          // temperature is 0° C everywhere (273 K)
         }
     }
 
-    // and there is a heat source in one corner
-    int source_x = N/4;
-    int source_y = N/4;
-    A[source_x*N+source_y] = 273 + 60;
+    // and there is a heat source in one corner -- or the sources and walls of the given layout (see room.h)
+    room_mask fixed = createMask(N);
+    if (layoutFile) {
+        loadLayout(layoutFile, fixed, &A[IDX(0,0)], N, N+2);
+        printf("Using layout %s, %lld fixed cells\n", layoutFile, countFixedCells(fixed));
+    } else {
+        int source_x = N/4;
+        int source_y = N/4;
+        A[IDX(source_x,source_y)] = 273 + 60;
+        fixCell(fixed, source_x, source_y);
+    }
+
+    // the device updates the ghost cells after every step, initially the host does
+    refreshGhostCells(A, N);
 
     printf("Initial:\n");
     printTemperature(A,N,N);
@@ -67,26 +148,44 @@ int main(int argc, char** argv) {
 
     // Part 2: create memory buffers
     cl_int err;
-    cl_mem devMatA = clCreateBuffer(context, CL_MEM_READ_WRITE, N * N * sizeof(value_t), NULL, &err);
+    cl_mem devMatA = clCreateBuffer(context, CL_MEM_READ_WRITE, (N+2) * (N+2) * sizeof(value_t), NULL, &err);
     CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
-    cl_mem devMatB = clCreateBuffer(context, CL_MEM_READ_WRITE, N * N * sizeof(value_t), NULL, &err);
+    cl_mem devMatB = clCreateBuffer(context, CL_MEM_READ_WRITE, (N+2) * (N+2) * sizeof(value_t), NULL, &err);
     CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+    cl_mem devMask = clCreateBuffer(context, CL_MEM_READ_ONLY, (N * fixed.words + 1) * sizeof(cl_uint), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for the fixed cells");
 
-    // Part 3: fill memory buffers (transfering A is enough, B can be anything)
-    err = clEnqueueWriteBuffer(command_queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, NULL);
+    // Part 3: fill memory buffers (transfering A and the fixed cells is enough, B can be anything)
+    err = clEnqueueWriteBuffer(command_queue, devMatA, CL_TRUE, 0, (N+2) * (N+2) * sizeof(value_t), A, 0, NULL, NULL);
     CLU_ERRCHECK(err, "Failed to write matrix A to device");
+    err = clEnqueueWriteBuffer(command_queue, devMask, CL_TRUE, 0, (N * fixed.words + 1) * sizeof(cl_uint), fixed.bits, 0, NULL, NULL);
+    CLU_ERRCHECK(err, "Failed to write the fixed cells to device");
 
-    // Part 4: create kernel from source
-    cl_program program = cluBuildProgramFromFile(context, device_id, "heat_stencil.cl", NULL);
+    // Part 4: create kernels from source -- the number of steps of stencil_multi is fixed at build time
+    char options[64];
+    snprintf(options, sizeof(options), "-D STEPS=%d", K);
+    cl_program program = cluBuildProgramFromFile(context, device_id, "heat_stencil.cl", options);
     cl_kernel kernel = clCreateKernel(program, "stencil", &err);
-    CLU_ERRCHECK(err, "Failed to create mat_mul kernel from program");
+    CLU_ERRCHECK(err, "Failed to create stencil kernel from program");
+    cl_kernel multi = clCreateKernel(program, "stencil_multi", &err);
+    CLU_ERRCHECK(err, "Failed to create stencil_multi kernel from program");
+    cl_kernel boundary = clCreateKernel(program, "boundary", &err);
+    CLU_ERRCHECK(err, "Failed to create boundary kernel from program");
+    cl_kernel change = clCreateKernel(program, "stencil_change", &err);
+    CLU_ERRCHECK(err, "Failed to create stencil_change kernel from program");
+    cl_kernel tileMax = clCreateKernel(program, "tile_max", &err);
+    CLU_ERRCHECK(err, "Failed to create tile_max kernel from program");
 
     // Part 5: set arguments in kernel (those which are constant)
     const size_t workGroupSize[2] = { 16, 16 };
-    clSetKernelArg(kernel, 2, sizeof(int), &source_x);
-    clSetKernelArg(kernel, 3, sizeof(int), &source_y);
-    clSetKernelArg(kernel, 4, sizeof(int), &N);
-    clSetKernelArg(kernel, 5, (workGroupSize[0]+2) * (workGroupSize[1]+2) * sizeof(float), NULL); // the local memory
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), &devMask);
+    clSetKernelArg(kernel, 3, sizeof(int), &N);
+    clSetKernelArg(kernel, 4, (workGroupSize[0]+2) * (workGroupSize[1]+2) * sizeof(float), NULL); // the local memory
+    clSetKernelArg(multi, 2, sizeof(cl_mem), &devMask);
+    clSetKernelArg(multi, 3, sizeof(int), &N);
+    clSetKernelArg(multi, 4, 2 * (workGroupSize[0]+2*K) * (workGroupSize[1]+2*K) * sizeof(float), NULL); // two local buffers
+    clSetKernelArg(multi, 5, (workGroupSize[0]+2*K) * (workGroupSize[1]+2*K) * sizeof(cl_uchar), NULL); // the fixed cells
+    clSetKernelArg(boundary, 1, sizeof(int), &N);
 
     // fix size and global work range
     size_t size[2] = { N, N }; // two dimensional range
@@ -94,45 +193,133 @@ int main(int argc, char** argv) {
         extendToMultiple(size[0], workGroupSize[0]),
         extendToMultiple(size[1], workGroupSize[1]),
     };
-    
-    // for each time step ..
-    bool dirty = false;
-    for(int t=0; t<T; t++) {
 
-        // mark host-side buffer dirty
-        dirty = true;
+    // the changes reduced by every work group of stencil_change (the maximum and the sum of squares)
+    int numGroups = (globalWorkSize[0] / workGroupSize[0]) * (globalWorkSize[1] / workGroupSize[1]);
+    value_t* changes = malloc(2 * numGroups * sizeof(value_t));
+    cl_mem devChanges = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 2 * numGroups * sizeof(value_t), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for changes");
+    clSetKernelArg(change, 2, sizeof(cl_mem), &devMask);
+    clSetKernelArg(change, 3, sizeof(int), &N);
+    clSetKernelArg(change, 4, (workGroupSize[0]+2) * (workGroupSize[1]+2) * sizeof(float), NULL); // the local memory
+    clSetKernelArg(change, 5, sizeof(cl_mem), &devChanges);
+    clSetKernelArg(change, 6, 2 * workGroupSize[0] * workGroupSize[1] * sizeof(float), NULL); // for the reduction
+
+    // the tiles shown by printTemperature, reduced on the device -- one work group per tile
+    const int renderH = RENDER_H;
+    const int renderW = RENDER_W;
+    const size_t tileGroupSize[2] = { 64, 1 };
+    const size_t tileWorkSize[2] = { RENDER_W * tileGroupSize[0], RENDER_H * tileGroupSize[1] };
+    value_t tiles[RENDER_H * RENDER_W];
+    cl_mem devTiles = clCreateBuffer(context, CL_MEM_WRITE_ONLY, RENDER_H * RENDER_W * sizeof(value_t), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for tiles");
+    clSetKernelArg(tileMax, 1, sizeof(int), &N);
+    clSetKernelArg(tileMax, 2, sizeof(int), &renderH);
+    clSetKernelArg(tileMax, 3, sizeof(int), &renderW);
+    clSetKernelArg(tileMax, 4, sizeof(cl_mem), &devTiles);
+    clSetKernelArg(tileMax, 5, tileGroupSize[0] * tileGroupSize[1] * sizeof(float), NULL); // for the reduction
+
+    // the snapshots, starting with the initial state
+    snapshot_writer* snapshots = NULL;
+    if (snapshotFile) {
+        snapshots = createSnapshotWriter(snapshotFile, N, context, command_queue, program);
+        takeSnapshot(snapshots, devMatA, 0);
+    }
+
+    // the pending transfer of the changes reduced at step 'checked'
+    cl_event changesRead = NULL;
+    int checked = 0;
+    bool converged = false;
+    
+    // for each block of time steps ..
+    for(int t=0; t<T && !converged; ) {
+
+        // .. up to the next intermediate step shown below or the next snapshot
+        int next = (t % 1000 == 0) ? t+1 : (t/1000 + 1) * 1000 + 1;
+        if (next > T) next = T;
+        if (snapshots && next > (t/SNAPSHOT_INTERVAL + 1) * SNAPSHOT_INTERVAL) next = (t/SNAPSHOT_INTERVAL + 1) * SNAPSHOT_INTERVAL;
+
+        while (t < next) {
+
+            // enqeue a kernel call for K time steps, or for a single one towards the end of the block
+            // and for the steps checking the convergence, which must not be part of a multi-step launch
+            bool check = tolerance > 0 && (t+1) % CHECK_INTERVAL == 0;
+            bool beforeCheck = tolerance > 0 && CHECK_INTERVAL-1 - t % CHECK_INTERVAL < K;
+            cl_kernel cur = (check) ? change : (K > 1 && next - t >= K && !beforeCheck) ? multi : kernel;
+            clSetKernelArg(cur, 0, sizeof(cl_mem), &devMatA);
+            clSetKernelArg(cur, 1, sizeof(cl_mem), &devMatB);
+            CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, cur, 2, NULL, globalWorkSize, workGroupSize, 0, NULL, NULL), "Failed to enqueue 2D kernel");
+            t += (cur == multi) ? K : 1;
+
+            // followed by the update of the walls
+            clSetKernelArg(boundary, 0, sizeof(cl_mem), &devMatB);
+            CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, boundary, 1, NULL, size, NULL, 0, NULL, NULL), "Failed to enqueue 1D kernel");
+
+            // swap matrices (just handles, no conent)
+            cl_mem tmp = devMatA;
+            devMatA = devMatB;
+            devMatB = tmp;
+
+            if (!check) continue;
+
+            // evaluate the changes of the previous check
+            if (changesRead) {
+                CLU_ERRCHECK(clWaitForEvents(1, &changesRead), "Failed to wait for changes");
+                CLU_ERRCHECK(clReleaseEvent(changesRead),      "Failed to release event");
+                changesRead = NULL;
+
+                value_t maxChange = 0;
+                double sumChange = 0;
+                for(int g = 0; g<numGroups; g++) {
+                    maxChange = (changes[2*g] > maxChange) ? changes[2*g] : maxChange;
+                    sumChange += changes[2*g+1];
+                }
+                if (maxChange < tolerance) {
+                    printf("Converged after %d steps: max. change %g K, L2 norm of change %g K, stopped after %d steps\n", checked, maxChange, sqrt(sumChange), t);
+                    converged = true;
+                    break;
+                }
+            }
 
-        // enqeue a kernel call for the current time step
-        clSetKernelArg(kernel, 0, sizeof(cl_mem), &devMatA);
-        clSetKernelArg(kernel, 1, sizeof(cl_mem), &devMatB);
-        CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, kernel, 2, NULL, globalWorkSize, workGroupSize, 0, NULL, NULL), "Failed to enqueue 2D kernel");
+            // and fetch those of this step in the background
+            err = clEnqueueReadBuffer(command_queue, devChanges, CL_FALSE, 0, 2 * numGroups * sizeof(value_t), changes, 0, NULL, &changesRead);
+            CLU_ERRCHECK(err, "Failed to read changes from device");
+            checked = t;
+        }
 
-        // swap matrices (just handles, no conent)
-        cl_mem tmp = devMatA;
-        devMatA = devMatB;
-        devMatB = tmp;
+        // take a snapshot, without waiting for it
+        if (snapshots && t % SNAPSHOT_INTERVAL == 0) {
+            takeSnapshot(snapshots, devMatA, t);
+        }
 
         // show intermediate step
-        if (!(t%1000)) {
-
-            // download state of A to host
-            err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, NULL);
-            CLU_ERRCHECK(err, "Failed to read matrix A from device");
+        if (!((t-1)%1000)) {
 
-            // revert dirty flag
-            dirty = false;
+            // reduce the tiles on the device, only their maxima are downloaded
+            clSetKernelArg(tileMax, 0, sizeof(cl_mem), &devMatA);
+            CLU_ERRCHECK(clEnqueueNDRangeKernel(command_queue, tileMax, 2, NULL, tileWorkSize, tileGroupSize, 0, NULL, NULL), "Failed to enqueue tile_max kernel");
+            err = clEnqueueReadBuffer(command_queue, devTiles, CL_TRUE, 0, RENDER_H * RENDER_W * sizeof(value_t), tiles, 0, NULL, NULL);
+            CLU_ERRCHECK(err, "Failed to read tiles from device");
 
             // print the step
-            printf("Step t=%d:\n", t);
-            printTemperature(A,N,N);
+            printf("Step t=%d:\n", t-1);
+            printTiles(tiles);
         }
     }
 
-    // get back final version of A
-    if (dirty) {
-        // download state of A to host
-        err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, NULL);
-        CLU_ERRCHECK(err, "Failed to read matrix A from device");
+    // the changes of the last check are not needed any more
+    if (changesRead) {
+        CLU_ERRCHECK(clWaitForEvents(1, &changesRead), "Failed to wait for changes");
+        CLU_ERRCHECK(clReleaseEvent(changesRead),      "Failed to release event");
+    }
+
+    // get back final version of A, needed for the verification
+    err = clEnqueueReadBuffer(command_queue, devMatA, CL_TRUE, 0, (N+2) * (N+2) * sizeof(value_t), A, 0, NULL, NULL);
+    CLU_ERRCHECK(err, "Failed to read matrix A from device");
+
+    // the snapshots still being written
+    if (snapshots) {
+        releaseSnapshotWriter(snapshots);
     }
 
     // Part 7: cleanup
@@ -140,11 +327,20 @@ int main(int argc, char** argv) {
     CLU_ERRCHECK(clFlush(command_queue),    "Failed to flush command queue");
     CLU_ERRCHECK(clFinish(command_queue),   "Failed to wait for command queue completion");
     CLU_ERRCHECK(clReleaseKernel(kernel),   "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseKernel(boundary), "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseKernel(multi),    "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseKernel(change),   "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseKernel(tileMax),  "Failed to release kernel");
     CLU_ERRCHECK(clReleaseProgram(program), "Failed to release program");
 
     // free device memory
     CLU_ERRCHECK(clReleaseMemObject(devMatA), "Failed to release Matrix A");
     CLU_ERRCHECK(clReleaseMemObject(devMatB), "Failed to release Matrix B");
+    CLU_ERRCHECK(clReleaseMemObject(devChanges), "Failed to release changes");
+    CLU_ERRCHECK(clReleaseMemObject(devMask), "Failed to release the fixed cells");
+    releaseMask(fixed);
+    CLU_ERRCHECK(clReleaseMemObject(devTiles), "Failed to release tiles");
+    free(changes);
 
     // free management resources
     CLU_ERRCHECK(clReleaseCommandQueue(command_queue), "Failed to release command queue");
@@ -165,7 +361,7 @@ int main(int argc, char** argv) {
     bool success = true;
     for(long long i = 0; i<N; i++) {
         for(long long j = 0; j<N; j++) {
-            value_t temp = A[i*N+j];
+            value_t temp = A[IDX(i,j)];
             if (273 <= temp && temp <= 273+60) continue;
             success = false;
             break;
@@ -192,7 +388,48 @@ void releaseMatrix(Matrix m) {
     free(m);
 }
 
+void refreshGhostCells(Matrix m, int N) {
+    // upper and lower wall
+    for(int j = 0; j<N; j++) {
+        m[IDX(-1,j)] = m[IDX( 0 ,j)];
+        m[IDX( N,j)] = m[IDX(N-1,j)];
+    }
+    // left and right wall
+    for(int i = 0; i<N; i++) {
+        m[IDX(i,-1)] = m[IDX(i, 0 )];
+        m[IDX(i, N)] = m[IDX(i,N-1)];
+    }
+}
+
+// prints the N x M room m, stored with ghost cells
 void printTemperature(Matrix m, int N, int M) {
+    value_t tiles[RENDER_H * RENDER_W];
+    computeTileMaxima(m, N, M, tiles);
+    printTiles(tiles);
+}
+
+void computeTileMaxima(Matrix m, int N, int M, value_t* tiles) {
+    // step size in each dimension
+    int sH = N/RENDER_H;
+    int sW = M/RENDER_W;
+
+    for(int i=0; i<RENDER_H; i++) {
+        for(int j=0; j<RENDER_W; j++) {
+
+            // get max temperature in this tile
+            value_t max_t = 0;
+            for(int x=sH*i; x<sH*i+sH; x++) {
+                for(int y=sW*j; y<sW*j+sW; y++) {
+                    value_t t = m[(x+1)*(M+2)+(y+1)];
+                    max_t = (max_t < t) ? t : max_t;
+                }
+            }
+            tiles[i*RENDER_W+j] = max_t;
+        }
+    }
+}
+
+void printTiles(const value_t* tiles) {
     const char* colors = " .-:=+*#%@";
     const int numColors = 10;
 
@@ -201,12 +438,8 @@ void printTemperature(Matrix m, int N, int M) {
     const value_t min = 273 + 0;
 
     // set the 'render' resolution
-    int H = 30;
-    int W = 50;
-
-    // step size in each dimension
-    int sH = N/H;
-    int sW = M/W;
+    int H = RENDER_H;
+    int W = RENDER_W;
 
 
     // upper wall
@@ -223,13 +456,7 @@ void printTemperature(Matrix m, int N, int M) {
         for(int j=0; j<W; j++) {
 
             // get max temperature in this tile
-            value_t max_t = 0;
-            for(int x=sH*i; x<sH*i+sH; x++) {
-                for(int y=sW*j; y<sW*j+sW; y++) {
-                    max_t = (max_t < m[x*N+y]) ? m[x*N+y] : max_t;
-                }
-            }
-            value_t temp = max_t;
+            value_t temp = tiles[i*W+j];
 
             // pick the 'color'
             int c = ((temp - min) / (max - min)) * numColors;
@@ -249,4 +476,3 @@ void printTemperature(Matrix m, int N, int M) {
     printf("\n");
 
 }
-
@@ -1,7 +1,9 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "utils.h"
+#include "room.h"
 
 typedef float value_t;
 
@@ -16,36 +18,91 @@ void releaseMatrix(Matrix m);
 
 void printTemperature(Matrix m, int N, int M);
 
+// the resolution of printTemperature, every character shows the maximum temperature of a tile
+#define RENDER_H 30
+#define RENDER_W 50
+
+// computes the maximum temperatures of the RENDER_H x RENDER_W tiles of the N x M room m
+void computeTileMaxima(Matrix m, int N, int M, value_t* tiles);
+
+// prints a room given the maximum temperatures of its tiles
+void printTiles(const value_t* tiles);
+
+// -- ghost cells --
+
+// The room is stored framed by a layer of ghost cells, as (N+2) x (N+2) matrix holding the
+// cell (i,j) at IDX(i,j). Before every time step the ghost cells are set to the temperature
+// of the adjacent cell inside the room, such that the walls are insulating like before while
+// the update of the room itself needs no boundary checks.
+
+#define IDX(i,j) ((long long)((i)+1)*(N+2) + ((j)+1))
+
+// copies the outermost cells of the room of size N to the adjacent ghost cells
+void refreshGhostCells(Matrix m, int N);
+
+// computes the next temperatures b of row i of the room of size N from its current ones a,
+// both pointing to the cell (i,0) -- without any branches, such that the row gets vectorized
+static inline void updateRow(room_mask fixed, int i, const value_t* a, value_t* b, int N);
+
+// -- convergence --
+
+// Given a tolerance, the simulation stops early once no cell changes by more than the
+// tolerance during a time step. The changes are reduced alongside the update of every
+// CHECK_INTERVAL-th step only, a row at a time while it is still in cache, such that the
+// other steps are not slowed down.
+
+#ifndef CHECK_INTERVAL
+#define CHECK_INTERVAL 100
+#endif
+
 // ----------------------
 
 
 int main(int argc, char** argv) {
 
-    // 'parsing' optional input parameter = problem size
+    // 'parsing' optional input parameters = problem size, tolerance (0 ... run all steps) and room layout
     int N = 500;
     if (argc > 1) {
         N = atoi(argv[1]);
     }
+    double tolerance = 0;
+    if (argc > 2) {
+        tolerance = atof(argv[2]);
+    }
+    const char* layoutFile = NULL;
+    if (argc > 3) {
+        layoutFile = argv[3];
+    }
     int T = N*100;
     printf("Computing heat-distribution for room size N=%d for T=%d timesteps\n", N, T);
+    if (tolerance > 0) {
+        printf("Stopping once no cell changes by more than %g K per step, checked every %d steps\n", tolerance, CHECK_INTERVAL);
+    }
 
     
     // ---------- setup ----------
 
-    // create a buffer for storing temperature fields
-    Matrix A = createMatrix(N,N);
+    // create a buffer for storing temperature fields, including the ghost cells
+    Matrix A = createMatrix(N+2,N+2);
     
     // set up initial conditions in A
     for(int i = 0; i<N; i++) {
         for(int j = 0; j<N; j++) {
-            A[i*N+j] = 273;             // temperature is 0° C everywhere (273 K)
+            A[IDX(i,j)] = 273;          // temperature is 0° C everywhere (273 K)
         }
     }
 
-    // and there is a heat source in one corner
-    int source_x = N/4;
-    int source_y = N/4;
-    A[source_x*N+source_y] = 273 + 60;
+    // and there is a heat source in one corner -- or the sources and walls of the given layout (see room.h)
+    room_mask fixed = createMask(N);
+    if (layoutFile) {
+        loadLayout(layoutFile, fixed, &A[IDX(0,0)], N, N+2);
+        printf("Using layout %s, %lld fixed cells\n", layoutFile, countFixedCells(fixed));
+    } else {
+        int source_x = N/4;
+        int source_y = N/4;
+        A[IDX(source_x,source_y)] = 273 + 60;
+        fixCell(fixed, source_x, source_y);
+    }
 
     printf("Initial:\n");
     printTemperature(A,N,N);
@@ -53,7 +110,7 @@ int main(int argc, char** argv) {
     // ---------- compute ----------
 
     // create a second buffer for the computation    
-    Matrix B = createMatrix(N,N);
+    Matrix B = createMatrix(N+2,N+2);
 
     timestamp begin = now();
 
@@ -65,28 +122,32 @@ int main(int argc, char** argv) {
     // for each time step ..
     for(int t=0; t<T; t++) {
 
-        // .. we propagate the temperature 
-        #pragma omp parallel for
-        for(long long i = 0; i<N; i++) {
-            for(long long j = 0; j<N; j++) {
+        // .. we update the walls ..
+        refreshGhostCells(A, N);
 
-                // center stays constant (the heat is still on)
-                if (i == source_x && j == source_y) {
-                    B[i*N+j] = A[i*N+j];
-                    continue;
-                }
-
-                // get current temperature at (i,j)
-                value_t tc = A[i*N+j];
-
-                // get temperatures left/right and up/down
-                value_t tl = ( j !=  0  ) ? A[i*N+(j-1)] : tc;
-                value_t tr = ( j != N-1 ) ? A[i*N+(j+1)] : tc;
-                value_t tu = ( i !=  0  ) ? A[(i-1)*N+j] : tc;
-                value_t td = ( i != N-1 ) ? A[(i+1)*N+j] : tc;
+        // .. and propagate the temperature, a row at a time (see updateRow)
+        bool check = tolerance > 0 && (t+1) % CHECK_INTERVAL == 0;
+        if (!check) {
+            #pragma omp parallel for
+            for(long long i = 0; i<N; i++) {
+                updateRow(fixed, i, &A[IDX(i,0)], &B[IDX(i,0)], N);
+            }
+        }
 
-                // update temperature at current point
-                B[i*N+j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
+        // .. reducing the changes of all cells alongside every CHECK_INTERVAL-th step
+        value_t maxChange = 0;
+        double sumChange = 0;
+        if (check) {
+            #pragma omp parallel for reduction(max:maxChange) reduction(+:sumChange)
+            for(long long i = 0; i<N; i++) {
+                const value_t* a = &A[IDX(i,0)];
+                value_t* b = &B[IDX(i,0)];
+                updateRow(fixed, i, a, b, N);
+                for(long long j = 0; j<N; j++) {
+                    value_t change = fabsf(b[j] - a[j]);
+                    maxChange = (change > maxChange) ? change : maxChange;
+                    sumChange += change * change;
+                }
             }
         }
 
@@ -100,6 +161,12 @@ int main(int argc, char** argv) {
             printf("Step t=%d:\n", t);
             printTemperature(A,N,N);
         }
+
+        // stop once the field is stationary
+        if (check && maxChange < tolerance) {
+            printf("Converged after %d steps: max. change %g K, L2 norm of change %g K\n", t+1, maxChange, sqrt(sumChange));
+            break;
+        }
     }
 
 
@@ -110,6 +177,7 @@ int main(int argc, char** argv) {
     printf("Total time: %.3f ms\n", (end-begin)*1000);
 
     releaseMatrix(B);
+    releaseMask(fixed);
 
 
     // ---------- check ----------    
@@ -120,7 +188,7 @@ int main(int argc, char** argv) {
     bool success = true;
     for(long long i = 0; i<N; i++) {
         for(long long j = 0; j<N; j++) {
-            value_t temp = A[i*N+j];
+            value_t temp = A[IDX(i,j)];
             if (273 <= temp && temp <= 273+60) continue;
             success = false;
             break;
@@ -147,7 +215,69 @@ void releaseMatrix(Matrix m) {
     free(m);
 }
 
+void refreshGhostCells(Matrix m, int N) {
+    // upper and lower wall
+    for(int j = 0; j<N; j++) {
+        m[IDX(-1,j)] = m[IDX( 0 ,j)];
+        m[IDX( N,j)] = m[IDX(N-1,j)];
+    }
+    // left and right wall
+    for(int i = 0; i<N; i++) {
+        m[IDX(i,-1)] = m[IDX(i, 0 )];
+        m[IDX(i, N)] = m[IDX(i,N-1)];
+    }
+}
+
+static inline void updateRow(room_mask fixed, int i, const value_t* a, value_t* b, int N) {
+    for(long long j = 0; j<N; j++) {
+
+        // get current temperature at (i,j)
+        value_t tc = a[j];
+
+        // get temperatures left/right and up/down, ghost cells at the walls
+        value_t tl = a[j-1];
+        value_t tr = a[j+1];
+        value_t tu = a[j-(N+2)];
+        value_t td = a[j+(N+2)];
+
+        // update temperature at current point
+        b[j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
+    }
+
+    // the fixed cells stay constant (e.g. the heat is still on)
+    restoreFixedCells(fixed, i, a, b);
+}
+
+// prints the N x M room m, stored with ghost cells
 void printTemperature(Matrix m, int N, int M) {
+    value_t tiles[RENDER_H * RENDER_W];
+    computeTileMaxima(m, N, M, tiles);
+    printTiles(tiles);
+}
+
+void computeTileMaxima(Matrix m, int N, int M, value_t* tiles) {
+    // step size in each dimension
+    int sH = N/RENDER_H;
+    int sW = M/RENDER_W;
+
+    #pragma omp parallel for collapse(2)
+    for(int i=0; i<RENDER_H; i++) {
+        for(int j=0; j<RENDER_W; j++) {
+
+            // get max temperature in this tile
+            value_t max_t = 0;
+            for(int x=sH*i; x<sH*i+sH; x++) {
+                for(int y=sW*j; y<sW*j+sW; y++) {
+                    value_t t = m[(x+1)*(M+2)+(y+1)];
+                    max_t = (max_t < t) ? t : max_t;
+                }
+            }
+            tiles[i*RENDER_W+j] = max_t;
+        }
+    }
+}
+
+void printTiles(const value_t* tiles) {
     const char* colors = " .-:=+*#%@";
     const int numColors = 10;
 
@@ -156,12 +286,8 @@ void printTemperature(Matrix m, int N, int M) {
     const value_t min = 273 + 0;
 
     // set the 'render' resolution
-    int H = 30;
-    int W = 50;
-
-    // step size in each dimension
-    int sH = N/H;
-    int sW = M/W;
+    int H = RENDER_H;
+    int W = RENDER_W;
 
 
     // upper wall
@@ -178,13 +304,7 @@ void printTemperature(Matrix m, int N, int M) {
         for(int j=0; j<W; j++) {
 
             // get max temperature in this tile
-            value_t max_t = 0;
-            for(int x=sH*i; x<sH*i+sH; x++) {
-                for(int y=sW*j; y<sW*j+sW; y++) {
-                    max_t = (max_t < m[x*N+y]) ? m[x*N+y] : max_t;
-                }
-            }
-            value_t temp = max_t;
+            value_t temp = tiles[i*W+j];
 
             // pick the 'color'
             int c = ((temp - min) / (max - min)) * numColors;
@@ -204,4 +324,3 @@ void printTemperature(Matrix m, int N, int M) {
     printf("\n");
 
 }
-
@@ -0,0 +1,413 @@
+#include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "room.h"
+
+typedef float value_t;
+
+
+// -- padded grid --
+
+// The room is stored with ghost cells like in heat_stencil_omp.c, but every row is padded
+// such that its first cell inside the room is aligned to the size of an AVX-512 vector:
+// the cell (i,j) is at IDX(i,j) = (i+1)*S + PAD + j, the row stride S being a multiple of
+// PAD floats. The ghost cells of a row are at PAD-1 and PAD+N.
+
+#define ALIGNMENT 64
+#define PAD ((int)(ALIGNMENT / sizeof(value_t)))
+
+#define IDX(i,j) ((long long)((i)+1)*S + PAD + (j))
+
+typedef value_t* Matrix;
+
+// the row stride of a room of size N
+int rowStride(int N);
+
+// allocates the padded grid of a room of size N, release with releaseMatrix
+Matrix createGrid(int N);
+
+void releaseMatrix(Matrix m);
+
+// copies the outermost cells of the room of size N to the adjacent ghost cells
+void refreshGhostCells(Matrix m, int N, int S);
+
+// prints the N x M room m with row stride S
+void printTemperature(Matrix m, int N, int M, int S);
+
+// -- row kernels --
+
+// A row kernel computes the new temperatures b[0..n) of a row of cells a[0..n), the
+// neighbors being a[-1], a[n] and the rows a[-S..] and a[S..]. a and b are aligned to
+// ALIGNMENT bytes. The SIMD kernels compute in single precision with the same order of
+// operations as the generic kernel, so their results are bit-identical to it, while the
+// reference kernel computes in double precision like heat_stencil_omp.c.
+typedef void (*row_kernel)(const value_t* a, value_t* b, int n, int S);
+
+void updateRowReference(const value_t* a, value_t* b, int n, int S);
+void updateRowGeneric(const value_t* a, value_t* b, int n, int S);
+void updateRowAVX2(const value_t* a, value_t* b, int n, int S);
+void updateRowAVX512(const value_t* a, value_t* b, int n, int S);
+
+typedef enum _kernel_id {
+    KERNEL_REFERENCE,
+    KERNEL_GENERIC,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+    NUM_KERNELS
+} kernel_id;
+
+const char* KERNEL_NAMES[NUM_KERNELS] = { "reference", "generic", "avx2", "avx512" };
+const row_kernel KERNELS[NUM_KERNELS] = { updateRowReference, updateRowGeneric, updateRowAVX2, updateRowAVX512 };
+
+// whether the CPU running this program supports the given kernel
+bool isSupported(kernel_id k);
+
+// simulates T time steps starting from A, B being a second buffer, the fixed cells keeping their
+// values; returns the buffer holding the final state and the time spent, intermediate steps are
+// printed if requested
+Matrix simulate(Matrix A, Matrix B, int N, int T, room_mask fixed, row_kernel update, bool show, double* seconds);
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    // 'parsing' optional input parameters
+    //  - N       ... the problem size
+    //  - kernel  ... one of the row kernels above, the fastest supported one by default
+    //  - compare ... re-run the simulation with the reference kernel and compare
+    //  - any other argument is a room layout (see room.h)
+    int N = 500;
+    int kernel = -1;
+    bool compare = false;
+    const char* layoutFile = NULL;
+    for(int a=1; a<argc; a++) {
+        if (!strcmp(argv[a], "compare")) {
+            compare = true;
+            continue;
+        }
+        bool named = false;
+        for(int k=0; k<NUM_KERNELS; k++) {
+            if (strcmp(argv[a], KERNEL_NAMES[k])) continue;
+            kernel = k;
+            named = true;
+        }
+        if (named) continue;
+        char* end;
+        long value = strtol(argv[a], &end, 10);
+        if (*argv[a] && !*end) {
+            N = value;
+        } else {
+            layoutFile = argv[a];
+        }
+    }
+    if (kernel < 0) {
+        for(int k=0; k<NUM_KERNELS; k++) {
+            if (isSupported(k)) kernel = k;
+        }
+    }
+    if (!isSupported(kernel)) {
+        printf("The %s kernel is not supported by this CPU\n", KERNEL_NAMES[kernel]);
+        return EXIT_FAILURE;
+    }
+    int T = N*100;
+    printf("Computing heat-distribution for room size N=%d for T=%d timesteps using the %s kernel\n", N, T, KERNEL_NAMES[kernel]);
+
+
+    // ---------- setup ----------
+
+    // create a buffer for storing temperature fields
+    const int S = rowStride(N);
+    Matrix A = createGrid(N);
+
+    // set up initial conditions in A
+    for(int i = 0; i<N; i++) {
+        for(int j = 0; j<N; j++) {
+            A[IDX(i,j)] = 273;          // temperature is 0° C everywhere (273 K)
+        }
+    }
+
+    // and there is a heat source in one corner -- or the sources and walls of the given layout (see room.h)
+    room_mask fixed = createMask(N);
+    if (layoutFile) {
+        loadLayout(layoutFile, fixed, &A[IDX(0,0)], N, S);
+        printf("Using layout %s, %lld fixed cells\n", layoutFile, countFixedCells(fixed));
+    } else {
+        int source_x = N/4;
+        int source_y = N/4;
+        A[IDX(source_x,source_y)] = 273 + 60;
+        fixCell(fixed, source_x, source_y);
+    }
+
+    // keep the initial state for the comparison
+    Matrix I = NULL;
+    if (compare) {
+        I = createGrid(N);
+        memcpy(I, A, sizeof(value_t)*(N+2)*S);
+    }
+
+    printf("Initial:\n");
+    printTemperature(A,N,N,S);
+
+    // ---------- compute ----------
+
+    // create a second buffer for the computation
+    Matrix B = createGrid(N);
+
+    double seconds;
+    Matrix R = simulate(A, B, N, T, fixed, KERNELS[kernel], true, &seconds);
+
+    printf("Total time: %.3f ms\n", seconds*1000);
+    printf("Throughput: %.3f Gpoints/s\n", ((double)N*N*T) / seconds / 1e9);
+
+
+    // ---------- check ----------
+
+    printf("Final:\n");
+    printTemperature(R,N,N,S);
+
+    bool success = true;
+    for(long long i = 0; i<N; i++) {
+        for(long long j = 0; j<N; j++) {
+            value_t temp = R[IDX(i,j)];
+            if (273 <= temp && temp <= 273+60) continue;
+            success = false;
+            break;
+        }
+    }
+
+    // the reference kernel is the current version, computing in double precision
+    if (compare) {
+        printf("Running reference simulation for comparison ..\n");
+        double refSeconds;
+        Matrix Q = simulate(I, (R == A) ? B : A, N, T, fixed, updateRowReference, false, &refSeconds);
+        printf("Reference time: %.3f ms\n", refSeconds*1000);
+        printf("Reference throughput: %.3f Gpoints/s\n", ((double)N*N*T) / refSeconds / 1e9);
+        printf("Speedup: %.2f\n", refSeconds / seconds);
+
+        value_t maxDiff = 0;
+        for(long long i = 0; i<N; i++) {
+            for(long long j = 0; j<N; j++) {
+                value_t diff = R[IDX(i,j)] - Q[IDX(i,j)];
+                if (diff < 0) diff = -diff;
+                if (diff > maxDiff) maxDiff = diff;
+            }
+        }
+        printf("Max. deviation from reference: %g K\n", maxDiff);
+        releaseMatrix(I);
+    }
+
+    printf("Verification: %s\n", (success)?"OK":"FAILED");
+
+    // ---------- cleanup ----------
+
+    releaseMatrix(A);
+    releaseMatrix(B);
+    releaseMask(fixed);
+
+    // done
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+Matrix simulate(Matrix A, Matrix B, int N, int T, room_mask fixed, row_kernel update, bool show, double* seconds) {
+    const int S = rowStride(N);
+
+    timestamp begin = now();
+
+    // for each time step ..
+    for(int t=0; t<T; t++) {
+
+        // .. we update the walls ..
+        refreshGhostCells(A, N, S);
+
+        // .. and propagate the temperature, a row at a time
+        #pragma omp parallel for
+        for(long long i = 0; i<N; i++) {
+            update(&A[IDX(i,0)], &B[IDX(i,0)], N, S);
+
+            // the fixed cells stay constant (e.g. the heat is still on)
+            restoreFixedCells(fixed, i, &A[IDX(i,0)], &B[IDX(i,0)]);
+        }
+
+        // swap matrices (just pointers, not content)
+        Matrix H = A;
+        A = B;
+        B = H;
+
+        // show intermediate step
+        if (show && !(t%1000)) {
+            printf("Step t=%d:\n", t);
+            printTemperature(A,N,N,S);
+        }
+    }
+
+    timestamp end = now();
+    *seconds = end - begin;
+    return A;
+}
+
+
+void updateRowReference(const value_t* a, value_t* b, int n, int S) {
+    for(int j = 0; j<n; j++) {
+        value_t tc = a[j];
+        value_t tl = a[j-1];
+        value_t tr = a[j+1];
+        value_t tu = a[j-S];
+        value_t td = a[j+S];
+        b[j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
+    }
+}
+
+void updateRowGeneric(const value_t* a, value_t* b, int n, int S) {
+    for(int j = 0; j<n; j++) {
+        value_t tc = a[j];
+        value_t tl = a[j-1];
+        value_t tr = a[j+1];
+        value_t tu = a[j-S];
+        value_t td = a[j+S];
+        b[j] = tc + 0.2f * (tl + tr + tu + td + (-4*tc));
+    }
+}
+
+// the vector kernels load the row above, the row below and the center aligned, the
+// left and right neighbors are the same vector shifted by one element and loaded unaligned
+
+__attribute__((target("avx2")))
+void updateRowAVX2(const value_t* a, value_t* b, int n, int S) {
+    const __m256 f = _mm256_set1_ps(0.2f);
+    const __m256 m = _mm256_set1_ps(-4);
+    int j = 0;
+    for(; j+8 <= n; j += 8) {
+        __m256 tc = _mm256_load_ps(a+j);
+        __m256 tl = _mm256_loadu_ps(a+j-1);
+        __m256 tr = _mm256_loadu_ps(a+j+1);
+        __m256 tu = _mm256_load_ps(a+j-S);
+        __m256 td = _mm256_load_ps(a+j+S);
+        __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(tl, tr), tu), td), _mm256_mul_ps(m, tc));
+        _mm256_store_ps(b+j, _mm256_add_ps(tc, _mm256_mul_ps(f, sum)));
+    }
+    // the rest of the row
+    updateRowGeneric(a+j, b+j, n-j, S);
+}
+
+__attribute__((target("avx512f")))
+void updateRowAVX512(const value_t* a, value_t* b, int n, int S) {
+    const __m512 f = _mm512_set1_ps(0.2f);
+    const __m512 m = _mm512_set1_ps(-4);
+    int j = 0;
+    for(; j+16 <= n; j += 16) {
+        __m512 tc = _mm512_load_ps(a+j);
+        __m512 tl = _mm512_loadu_ps(a+j-1);
+        __m512 tr = _mm512_loadu_ps(a+j+1);
+        __m512 tu = _mm512_load_ps(a+j-S);
+        __m512 td = _mm512_load_ps(a+j+S);
+        __m512 sum = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_add_ps(tl, tr), tu), td), _mm512_mul_ps(m, tc));
+        _mm512_store_ps(b+j, _mm512_add_ps(tc, _mm512_mul_ps(f, sum)));
+    }
+    // the rest of the row
+    updateRowGeneric(a+j, b+j, n-j, S);
+}
+
+bool isSupported(kernel_id k) {
+    __builtin_cpu_init();
+    switch(k) {
+    case KERNEL_REFERENCE: return true;
+    case KERNEL_GENERIC:   return true;
+    case KERNEL_AVX2:      return __builtin_cpu_supports("avx2");
+    case KERNEL_AVX512:    return __builtin_cpu_supports("avx512f");
+    default:               return false;
+    }
+}
+
+
+int rowStride(int N) {
+    // a ghost cell on either side of the room, rounded up to full vectors
+    return PAD + (N + 1 + PAD-1) / PAD * PAD;
+}
+
+Matrix createGrid(int N) {
+    size_t bytes = sizeof(value_t) * (N+2) * rowStride(N);
+    Matrix m = aligned_alloc(ALIGNMENT, bytes);
+    // the padding is never read, but should not hold garbage either
+    memset(m, 0, bytes);
+    return m;
+}
+
+void releaseMatrix(Matrix m) {
+    free(m);
+}
+
+void refreshGhostCells(Matrix m, int N, int S) {
+    // upper and lower wall
+    for(int j = 0; j<N; j++) {
+        m[IDX(-1,j)] = m[IDX( 0 ,j)];
+        m[IDX( N,j)] = m[IDX(N-1,j)];
+    }
+    // left and right wall
+    for(int i = 0; i<N; i++) {
+        m[IDX(i,-1)] = m[IDX(i, 0 )];
+        m[IDX(i, N)] = m[IDX(i,N-1)];
+    }
+}
+
+void printTemperature(Matrix m, int N, int M, int S) {
+    const char* colors = " .-:=+*#%@";
+    const int numColors = 10;
+
+    // boundaries for temperature (for simplicity hard-coded)
+    const value_t max = 273 + 30;
+    const value_t min = 273 + 0;
+
+    // set the 'render' resolution
+    int H = 30;
+    int W = 50;
+
+    // step size in each dimension
+    int sH = N/H;
+    int sW = M/W;
+
+
+    // upper wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+    // room
+    for(int i=0; i<H; i++) {
+        // left wall
+        printf("X");
+        // actual room
+        for(int j=0; j<W; j++) {
+
+            // get max temperature in this tile
+            value_t max_t = 0;
+            for(int x=sH*i; x<sH*i+sH; x++) {
+                for(int y=sW*j; y<sW*j+sW; y++) {
+                    max_t = (max_t < m[IDX(x,y)]) ? m[IDX(x,y)] : max_t;
+                }
+            }
+            value_t temp = max_t;
+
+            // pick the 'color'
+            int c = ((temp - min) / (max - min)) * numColors;
+            c = (c >= numColors) ? numColors-1 : ((c < 0) ? 0 : c);
+
+            // print the average temperature
+            printf("%c",colors[c]);
+        }
+        // right wall
+        printf("X\n");
+    }
+
+    // lower wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+}
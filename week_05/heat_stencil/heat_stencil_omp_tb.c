@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "utils.h"
+#include "room.h"
+
+typedef float value_t;
+
+
+// -- matrix utilities --
+
+typedef value_t* Matrix;
+
+Matrix createMatrix(int N, int M);
+
+void releaseMatrix(Matrix m);
+
+void printTemperature(Matrix m, int N, int M);
+
+// -- temporal blocking --
+
+// Instead of sweeping over the whole field once per time step, the field is split
+// into TILE x TILE tiles, each advanced by up to TIME_BLOCK steps at a time while it
+// resides in cache. A tile is copied together with a halo of TIME_BLOCK cells into a
+// private buffer (an overlapped trapezoid): after s steps only the cells s away from
+// the (non-global) halo border are still valid, which after TIME_BLOCK steps is exactly
+// the tile itself. The halos are computed redundantly by neighboring tiles, but the
+// tiles are independent and every cell is updated by the same expression as in the
+// sequential version, so the results are bit-identical. Like in the sequential version,
+// the buffers are framed by ghost cells, refreshed at the walls of the room before every
+// step, such that the rows are updated without any boundary checks.
+//
+// Larger tiles reduce the redundant work, (TILE+2*TIME_BLOCK)^2 / TILE^2, but the two
+// buffers of a thread should fit into its L2 cache (2 x 274^2 floats = 600 KB by default).
+
+#ifndef TILE
+#define TILE 256
+#endif
+
+#ifndef TIME_BLOCK
+#define TIME_BLOCK 8
+#endif
+
+// the size of the buffers, a tile including its halo and a layer of ghost cells
+#define BUFFER_SIZE (TILE + 2*TIME_BLOCK + 2)
+
+// advances A by the given number of steps (at most TIME_BLOCK), the result is written to B --
+// the fixed cells keep their values; buffers holds two BUFFER_SIZE x BUFFER_SIZE buffers per thread
+void propagateBlocked(const Matrix A, Matrix B, int N, int steps, room_mask fixed, Matrix buffers);
+
+// advances A by a single step without blocking, like the sequential version, the result is written to B
+void propagate(const Matrix A, Matrix B, int N, room_mask fixed);
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    // 'parsing' optional input parameters
+    //  - N      ... the problem size
+    //  - verify ... re-run the simulation sequentially, without temporal blocking, and compare
+    //  - any other argument is a room layout (see room.h)
+    int N = 500;
+    bool verify = false;
+    const char* layoutFile = NULL;
+    for(int a=1; a<argc; a++) {
+        char* end;
+        long value = strtol(argv[a], &end, 10);
+        if (!strcmp(argv[a], "verify")) {
+            verify = true;
+        } else if (*argv[a] && !*end) {
+            N = value;
+        } else {
+            layoutFile = argv[a];
+        }
+    }
+    int T = N*100;
+    printf("Computing heat-distribution for room size N=%d for T=%d timesteps\n", N, T);
+
+
+    // ---------- setup ----------
+
+    // create a buffer for storing temperature fields
+    Matrix A = createMatrix(N,N);
+
+    // set up initial conditions in A
+    for(int i = 0; i<N; i++) {
+        for(int j = 0; j<N; j++) {
+            A[i*N+j] = 273;             // temperature is 0° C everywhere (273 K)
+        }
+    }
+
+    // and there is a heat source in one corner -- or the sources and walls of the given layout (see room.h)
+    room_mask fixed = createMask(N);
+    if (layoutFile) {
+        loadLayout(layoutFile, fixed, A, N, N);
+        printf("Using layout %s, %lld fixed cells\n", layoutFile, countFixedCells(fixed));
+    } else {
+        int source_x = N/4;
+        int source_y = N/4;
+        A[source_x*N+source_y] = 273 + 60;
+        fixCell(fixed, source_x, source_y);
+    }
+
+    // keep the initial state for the verification
+    Matrix I = NULL;
+    if (verify) {
+        I = createMatrix(N,N);
+        memcpy(I, A, sizeof(value_t)*N*N);
+    }
+
+    printf("Initial:\n");
+    printTemperature(A,N,N);
+
+    // ---------- compute ----------
+
+    // create a second buffer for the computation
+    Matrix B = createMatrix(N,N);
+
+    // and the private buffers of the threads, allocated once instead of for every block
+    Matrix buffers = createMatrix(2*omp_get_max_threads()*BUFFER_SIZE, BUFFER_SIZE);
+
+    timestamp begin = now();
+
+    // for each block of time steps ..
+    for(int t=0; t<T; ) {
+
+        // .. blocks end at the intermediate steps shown below
+        int next = (t % 1000 == 0) ? t+1 : (t/1000 + 1) * 1000 + 1;
+        int steps = next - t;
+        if (steps > TIME_BLOCK) steps = TIME_BLOCK;
+        if (t + steps > T) steps = T - t;
+
+        // .. we propagate the temperature by several steps at once
+        propagateBlocked(A, B, N, steps, fixed, buffers);
+
+        // swap matrices (just pointers, not content)
+        Matrix H = A;
+        A = B;
+        B = H;
+
+        // show intermediate step
+        t += steps;
+        if (!((t-1)%1000)) {
+            printf("Step t=%d:\n", t-1);
+            printTemperature(A,N,N);
+        }
+    }
+
+    timestamp end = now();
+    printf("Total time: %.3f ms\n", (end-begin)*1000);
+    printf("Throughput: %.3f Gcell-updates/s\n", ((double)N*N*T) / (end-begin) / 1e9);
+
+
+    // ---------- check ----------
+
+    printf("Final:\n");
+    printTemperature(A,N,N);
+
+    bool success = true;
+    for(long long i = 0; i<N; i++) {
+        for(long long j = 0; j<N; j++) {
+            value_t temp = A[i*N+j];
+            if (273 <= temp && temp <= 273+60) continue;
+            success = false;
+            break;
+        }
+    }
+
+    // the sequential simulation has to produce exactly the same field
+    if (verify) {
+        printf("Running sequential simulation for comparison ..\n");
+        for(int t=0; t<T; t++) {
+            propagate(I, B, N, fixed);
+            Matrix H = I;
+            I = B;
+            B = H;
+        }
+        bool identical = !memcmp(A, I, sizeof(value_t)*N*N);
+        printf("Bit-identical to sequential version: %s\n", (identical) ? "yes" : "no");
+        success = success && identical;
+        releaseMatrix(I);
+    }
+
+    releaseMatrix(B);
+    releaseMatrix(buffers);
+    releaseMask(fixed);
+
+    printf("Verification: %s\n", (success)?"OK":"FAILED");
+
+    // ---------- cleanup ----------
+
+    releaseMatrix(A);
+
+    // done
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// updates the n cells of the row starting at a, rows being W cells apart, into the row b -- the
+// same expression as in the sequential version, without any branches, such that it gets vectorized;
+// the AVX2 clone, picked at load time if supported, converts twice as many cells to double at once
+__attribute__((target_clones("avx2","default")))
+static void updateRow(const value_t* a, value_t* b, int n, int W) {
+    for(int j = 0; j<n; j++) {
+
+        // get current temperature at (i,j)
+        value_t tc = a[j];
+
+        // get temperatures left/right and up/down, ghost cells at the walls
+        value_t tl = a[j-1];
+        value_t tr = a[j+1];
+        value_t tu = a[j-W];
+        value_t td = a[j+W];
+
+        // update temperature at current point
+        b[j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
+    }
+}
+
+void propagateBlocked(const Matrix A, Matrix B, int N, int steps, room_mask fixed, Matrix buffers) {
+    const int W = BUFFER_SIZE;
+
+    #pragma omp parallel
+    {
+        // two private buffers of W x W cells, indexed relative to the tile's halo corner
+        Matrix P = &buffers[2LL*omp_get_thread_num()*W*W];
+        Matrix Q = P + W*W;
+
+        #pragma omp for collapse(2) schedule(static)
+        for(int ti = 0; ti < N; ti += TILE) {
+            for(int tj = 0; tj < N; tj += TILE) {
+
+                // the region covered by the buffers, clipped to the room
+                int r0 = (ti - steps > 0) ? ti - steps : 0;
+                int r1 = (ti + TILE + steps < N) ? ti + TILE + steps : N;
+                int c0 = (tj - steps > 0) ? tj - steps : 0;
+                int c1 = (tj + TILE + steps < N) ? tj + TILE + steps : N;
+
+                // the cell (X,Y) of the room, the region is framed by a layer of ghost cells
+                #define L(M,X,Y) M[((X)-r0+1)*W + ((Y)-c0+1)]
+
+                for(int i = r0; i<r1; i++) {
+                    memcpy(&L(P,i,c0), &A[(long long)i*N+c0], sizeof(value_t)*(c1-c0));
+                }
+
+                for(int s=1; s<=steps; s++) {
+
+                    // the cells still valid after s steps -- the walls of the room do not shrink the region
+                    int lo_i = (r0 == 0) ? 0 : r0 + s;
+                    int hi_i = (r1 == N) ? N : r1 - s;
+                    int lo_j = (c0 == 0) ? 0 : c0 + s;
+                    int hi_j = (c1 == N) ? N : c1 - s;
+
+                    // the ghost cells at the walls of the room take the temperature of the adjacent cell
+                    if (lo_i == 0) memcpy(&L(P,-1,lo_j), &L(P,0,lo_j), sizeof(value_t)*(hi_j-lo_j));
+                    if (hi_i == N) memcpy(&L(P,N,lo_j), &L(P,N-1,lo_j), sizeof(value_t)*(hi_j-lo_j));
+                    for(int i = lo_i; i<hi_i; i++) {
+                        if (lo_j == 0) L(P,i,-1) = L(P,i,0);
+                        if (hi_j == N) L(P,i,N) = L(P,i,N-1);
+                    }
+
+                    for(int i = lo_i; i<hi_i; i++) {
+                        updateRow(&L(P,i,lo_j), &L(Q,i,lo_j), hi_j-lo_j, W);
+
+                        // the fixed cells stay constant (e.g. the heat is still on)
+                        restoreFixedCellsRange(fixed, i, lo_j, hi_j, &L(P,i,lo_j), &L(Q,i,lo_j));
+                    }
+
+                    Matrix H = P;
+                    P = Q;
+                    Q = H;
+                }
+
+                // write back the tile itself
+                int ei = (ti + TILE < N) ? ti + TILE : N;
+                int ej = (tj + TILE < N) ? tj + TILE : N;
+                for(int i = ti; i<ei; i++) {
+                    memcpy(&B[(long long)i*N+tj], &L(P,i,tj), sizeof(value_t)*(ej-tj));
+                }
+
+                #undef L
+            }
+        }
+    }
+}
+
+void propagate(const Matrix A, Matrix B, int N, room_mask fixed) {
+    for(long long i = 0; i<N; i++) {
+        for(long long j = 0; j<N; j++) {
+
+            // the fixed cells stay constant (e.g. the heat is still on)
+            if (isFixedCell(fixed, i, j)) {
+                B[i*N+j] = A[i*N+j];
+                continue;
+            }
+
+            // get current temperature at (i,j)
+            value_t tc = A[i*N+j];
+
+            // get temperatures left/right and up/down
+            value_t tl = ( j !=  0  ) ? A[i*N+(j-1)] : tc;
+            value_t tr = ( j != N-1 ) ? A[i*N+(j+1)] : tc;
+            value_t tu = ( i !=  0  ) ? A[(i-1)*N+j] : tc;
+            value_t td = ( i != N-1 ) ? A[(i+1)*N+j] : tc;
+
+            // update temperature at current point
+            B[i*N+j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
+        }
+    }
+}
+
+
+Matrix createMatrix(int N, int M) {
+    // create data and index vector
+    return malloc(sizeof(value_t)*N*M);
+}
+
+void releaseMatrix(Matrix m) {
+    free(m);
+}
+
+void printTemperature(Matrix m, int N, int M) {
+    const char* colors = " .-:=+*#%@";
+    const int numColors = 10;
+
+    // boundaries for temperature (for simplicity hard-coded)
+    const value_t max = 273 + 30;
+    const value_t min = 273 + 0;
+
+    // set the 'render' resolution
+    int H = 30;
+    int W = 50;
+
+    // step size in each dimension
+    int sH = N/H;
+    int sW = M/W;
+
+
+    // upper wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+    // room
+    for(int i=0; i<H; i++) {
+        // left wall
+        printf("X");
+        // actual room
+        for(int j=0; j<W; j++) {
+
+            // get max temperature in this tile
+            value_t max_t = 0;
+            for(int x=sH*i; x<sH*i+sH; x++) {
+                for(int y=sW*j; y<sW*j+sW; y++) {
+                    max_t = (max_t < m[x*N+y]) ? m[x*N+y] : max_t;
+                }
+            }
+            value_t temp = max_t;
+
+            // pick the 'color'
+            int c = ((temp - min) / (max - min)) * numColors;
+            c = (c >= numColors) ? numColors-1 : ((c < 0) ? 0 : c);
+
+            // print the average temperature
+            printf("%c",colors[c]);
+        }
+        // right wall
+        printf("X\n");
+    }
+
+    // lower wall
+    for(int i=0; i<W+2; i++) {
+        printf("X");
+    }
+    printf("\n");
+
+}
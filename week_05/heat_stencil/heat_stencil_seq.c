@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 #include "utils.h"
+#include "room.h"
 
 typedef float value_t;
 
@@ -16,36 +17,59 @@ void releaseMatrix(Matrix m);
 
 void printTemperature(Matrix m, int N, int M);
 
+// -- ghost cells --
+
+// The room is stored framed by a layer of ghost cells, as (N+2) x (N+2) matrix holding the
+// cell (i,j) at IDX(i,j). Before every time step the ghost cells are set to the temperature
+// of the adjacent cell inside the room, such that the walls are insulating like before while
+// the update of the room itself needs no boundary checks.
+
+#define IDX(i,j) ((long long)((i)+1)*(N+2) + ((j)+1))
+
+// copies the outermost cells of the room of size N to the adjacent ghost cells
+void refreshGhostCells(Matrix m, int N);
+
 // ----------------------
 
 
 int main(int argc, char** argv) {
 
-    // 'parsing' optional input parameter = problem size
+    // 'parsing' optional input parameters = problem size and room layout
     int N = 500;
     if (argc > 1) {
         N = atoi(argv[1]);
     }
+    const char* layoutFile = NULL;
+    if (argc > 2) {
+        layoutFile = argv[2];
+    }
     int T = N*100;
     printf("Computing heat-distribution for room size N=%d for T=%d timesteps\n", N, T);
 
     
     // ---------- setup ----------
 
-    // create a buffer for storing temperature fields
-    Matrix A = createMatrix(N,N);
+    // create a buffer for storing temperature fields, including the ghost cells
+    Matrix A = createMatrix(N+2,N+2);
     
     // set up initial conditions in A
     for(int i = 0; i<N; i++) {
         for(int j = 0; j<N; j++) {
-            A[i*N+j] = 273;             // temperature is 0° C everywhere (273 K)
+            A[IDX(i,j)] = 273;          // temperature is 0° C everywhere (273 K)
         }
     }
 
-    // and there is a heat source in one corner
-    int source_x = N/4;
-    int source_y = N/4;
-    A[source_x*N+source_y] = 273 + 60;
+    // and there is a heat source in one corner -- or the sources and walls of the given layout (see room.h)
+    room_mask fixed = createMask(N);
+    if (layoutFile) {
+        loadLayout(layoutFile, fixed, &A[IDX(0,0)], N, N+2);
+        printf("Using layout %s, %lld fixed cells\n", layoutFile, countFixedCells(fixed));
+    } else {
+        int source_x = N/4;
+        int source_y = N/4;
+        A[IDX(source_x,source_y)] = 273 + 60;
+        fixCell(fixed, source_x, source_y);
+    }
 
     printf("Initial:\n");
     printTemperature(A,N,N);
@@ -53,34 +77,36 @@ int main(int argc, char** argv) {
     // ---------- compute ----------
 
     // create a second buffer for the computation    
-    Matrix B = createMatrix(N,N);
+    Matrix B = createMatrix(N+2,N+2);
 
     timestamp begin = now();
     // for each time step ..
     for(int t=0; t<T; t++) {
 
-        // .. we propagate the temperature 
+        // .. we update the walls ..
+        refreshGhostCells(A, N);
+
+        // .. and propagate the temperature -- without any branches, such that the rows get vectorized
         for(long long i = 0; i<N; i++) {
+            const value_t* a = &A[IDX(i,0)];
+            value_t* b = &B[IDX(i,0)];
             for(long long j = 0; j<N; j++) {
 
-                // center stays constant (the heat is still on)
-                if (i == source_x && j == source_y) {
-                    B[i*N+j] = A[i*N+j];
-                    continue;
-                }
-
                 // get current temperature at (i,j)
-                value_t tc = A[i*N+j];
+                value_t tc = a[j];
 
-                // get temperatures left/right and up/down
-                value_t tl = ( j !=  0  ) ? A[i*N+(j-1)] : tc;
-                value_t tr = ( j != N-1 ) ? A[i*N+(j+1)] : tc;
-                value_t tu = ( i !=  0  ) ? A[(i-1)*N+j] : tc;
-                value_t td = ( i != N-1 ) ? A[(i+1)*N+j] : tc;
+                // get temperatures left/right and up/down, ghost cells at the walls
+                value_t tl = a[j-1];
+                value_t tr = a[j+1];
+                value_t tu = a[j-(N+2)];
+                value_t td = a[j+(N+2)];
 
                 // update temperature at current point
-                B[i*N+j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
+                b[j] = tc + 0.2 * (tl + tr + tu + td + (-4*tc));
             }
+
+            // the fixed cells stay constant (e.g. the heat is still on)
+            restoreFixedCells(fixed, i, a, b);
         }
 
         // swap matrices (just pointers, not content)
@@ -98,6 +124,7 @@ int main(int argc, char** argv) {
     printf("Total time: %.3f ms\n", (end-begin)*1000);
 
     releaseMatrix(B);
+    releaseMask(fixed);
 
 
     // ---------- check ----------    
@@ -108,7 +135,7 @@ int main(int argc, char** argv) {
     bool success = true;
     for(long long i = 0; i<N; i++) {
         for(long long j = 0; j<N; j++) {
-            value_t temp = A[i*N+j];
+            value_t temp = A[IDX(i,j)];
             if (273 <= temp && temp <= 273+60) continue;
             success = false;
             break;
@@ -135,6 +162,20 @@ void releaseMatrix(Matrix m) {
     free(m);
 }
 
+void refreshGhostCells(Matrix m, int N) {
+    // upper and lower wall
+    for(int j = 0; j<N; j++) {
+        m[IDX(-1,j)] = m[IDX( 0 ,j)];
+        m[IDX( N,j)] = m[IDX(N-1,j)];
+    }
+    // left and right wall
+    for(int i = 0; i<N; i++) {
+        m[IDX(i,-1)] = m[IDX(i, 0 )];
+        m[IDX(i, N)] = m[IDX(i,N-1)];
+    }
+}
+
+// prints the N x M room m, stored with ghost cells
 void printTemperature(Matrix m, int N, int M) {
     const char* colors = " .-:=+*#%@";
     const int numColors = 10;
@@ -169,7 +210,8 @@ void printTemperature(Matrix m, int N, int M) {
             value_t max_t = 0;
             for(int x=sH*i; x<sH*i+sH; x++) {
                 for(int y=sW*j; y<sW*j+sW; y++) {
-                    max_t = (max_t < m[x*N+y]) ? m[x*N+y] : max_t;
+                    value_t t = m[(x+1)*(M+2)+(y+1)];
+                    max_t = (max_t < t) ? t : max_t;
                 }
             }
             value_t temp = max_t;
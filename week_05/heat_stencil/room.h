@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Rooms with fixed cells (Dirichlet boundary conditions) -- heat sources, walls and any other
+// regions keeping their temperature.
+//
+// The fixed cells of a room of size N are a bitmask of W = ceil(N/32) words per row of
+// the room, bit j%32 of word i*W + j/32 being set if cell (i,j) is fixed. A fixed cell keeps its
+// value: the stencils update all cells alike and restore the fixed ones afterwards, on the host
+// by iterating over the set bits of a row (see restoreFixedCells), on the device by selecting
+// the old value (see heat_stencil.cl) -- the mask costs a bit per cell, not a branch. A second
+// bitmask marks the rows holding fixed cells, such that the host skips the others at once.
+//
+// Layouts are read from text files, a map of equally long lines scaled to the size of the room:
+// the cell (i,j) of a room of size N is described by the character at row i*H/N and column
+// j*W/N of an H x W map, being
+//
+//   '.'        ... air, initially at 273 K
+//   'S'        ... a heat source, fixed at 273 + 60 K
+//   '#'        ... a wall, fixed at 273 K
+//   '0' .. '6' ... fixed at 273 + 10 * the digit K
+//
+// The layout is written to the cells of the room only, the cell (i,j) being at i*stride + j
+// relative to the cell (0,0) -- (N+2) for rooms stored with ghost cells.
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _room_mask {
+    int N;
+    int words;          // < per row
+    uint32_t* bits;
+    uint32_t* rows;     // < bit i%32 of word i/32 set if row i holds fixed cells
+} room_mask;
+
+// creates a mask of a room of size N without fixed cells
+room_mask createMask(int N);
+
+void releaseMask(room_mask m);
+
+// fixes the cell (i,j)
+void fixCell(room_mask m, int i, int j);
+
+// whether the cell (i,j) is fixed
+int isFixedCell(room_mask m, int i, int j);
+
+// the number of fixed cells
+long long countFixedCells(room_mask m);
+
+// restores the fixed cells of row i from a to b, both pointing to the first cell of the row
+static inline void restoreFixedCells(room_mask m, int i, const float* a, float* b) {
+    if (!((m.rows[i/32] >> (i%32)) & 1)) return;
+    const uint32_t* row = &m.bits[(long long)i * m.words];
+    for(int k = 0; k < m.words; k++) {
+        for(uint32_t w = row[k]; w; w &= w - 1) {
+            int j = 32*k + __builtin_ctz(w);
+            b[j] = a[j];
+        }
+    }
+}
+
+// restores the fixed cells j0 <= j < j1 of row i from a to b, both pointing to the cell (i,j0)
+static inline void restoreFixedCellsRange(room_mask m, int i, int j0, int j1, const float* a, float* b) {
+    if (!((m.rows[i/32] >> (i%32)) & 1)) return;
+    const uint32_t* row = &m.bits[(long long)i * m.words];
+    for(int k = j0/32; k < (j1+31)/32; k++) {
+        uint32_t w = row[k];
+        if (32*k < j0) w &= ~0u << (j0 - 32*k);
+        if (32*k+32 > j1) w &= ~0u >> (32*k+32 - j1);
+        for(; w; w &= w - 1) {
+            int j = 32*k + __builtin_ctz(w);
+            b[j-j0] = a[j-j0];
+        }
+    }
+}
+
+// sets up the room of size N, its cell (0,0) at A and rows being stride cells apart, as
+// described by the layout file and fixes the cells of its sources and walls in m
+void loadLayout(const char* fn, room_mask m, float* A, int N, int stride);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+room_mask createMask(int N) {
+    room_mask m;
+    m.N = N;
+    m.words = (N + 31) / 32;
+    m.bits = calloc((long long)N * m.words + 1, sizeof(uint32_t));
+    m.rows = calloc(m.words, sizeof(uint32_t));
+    return m;
+}
+
+void releaseMask(room_mask m) {
+    free(m.bits);
+    free(m.rows);
+}
+
+void fixCell(room_mask m, int i, int j) {
+    m.bits[(long long)i * m.words + j/32] |= 1u << (j%32);
+    m.rows[i/32] |= 1u << (i%32);
+}
+
+int isFixedCell(room_mask m, int i, int j) {
+    return (m.bits[(long long)i * m.words + j/32] >> (j%32)) & 1;
+}
+
+long long countFixedCells(room_mask m) {
+    long long count = 0;
+    for(long long k = 0; k < (long long)m.N * m.words; k++) {
+        count += __builtin_popcount(m.bits[k]);
+    }
+    return count;
+}
+
+void loadLayout(const char* fn, room_mask m, float* A, int N, int stride) {
+    FILE* file = fopen(fn, "r");
+    if (!file) {
+        fprintf(stderr, "Unable to open layout file %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    // read the map, line by line
+    char line[1024];
+    char* map = NULL;
+    int H = 0;
+    int W = 0;
+    while (fgets(line, sizeof(line), file)) {
+        int len = strcspn(line, "\r\n");
+        if (len == 0) continue;
+        if (W && len != W) {
+            fprintf(stderr, "Line %d of layout %s has %d instead of %d characters\n", H+1, fn, len, W);
+            exit(EXIT_FAILURE);
+        }
+        W = len;
+        map = realloc(map, (H+1) * W);
+        memcpy(map + H*W, line, W);
+        H++;
+    }
+    fclose(file);
+    if (!H) {
+        fprintf(stderr, "Layout %s is empty\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 0; i<N; i++) {
+        for(int j = 0; j<N; j++) {
+            char c = map[(long long)i*H/N * W + (long long)j*W/N];
+            float* cell = &A[(long long)i*stride + j];
+            if (c == '.') {
+                *cell = 273;
+            } else if (c == 'S') {
+                *cell = 273 + 60;
+            } else if (c == '#') {
+                *cell = 273;
+            } else if ('0' <= c && c <= '6') {
+                *cell = 273 + 10 * (c - '0');
+            } else {
+                fprintf(stderr, "Unknown character '%c' in layout %s\n", c, fn);
+                exit(EXIT_FAILURE);
+            }
+            if (c != '.') fixCell(m, i, j);
+        }
+    }
+    free(map);
+}
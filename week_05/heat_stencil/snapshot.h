@@ -0,0 +1,247 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "utils.h"
+#include "cl_utils.h"
+
+// Asynchronous snapshots of the temperature field of heat_stencil_ocl.
+//
+// A snapshot is downsampled on the device first (the downsample kernel of heat_stencil.cl
+// averages blocks of F x F cells, such that the frame is at most SNAPSHOT_SIZE cells wide)
+// and read without blocking into one of SNAPSHOT_BUFFERS host buffers. A writer thread
+// waits for the transfers, compresses the frames and appends them to the snapshot file,
+// so the simulation only pays for enqueuing the two commands -- unless the writer falls
+// behind by more than SNAPSHOT_BUFFERS frames, then it is waited for.
+//
+// The file starts with a header of four int32 values, "HSNP" and the sizes N, F and D of
+// the room, the blocks and the D x D frames. Every frame is the int32 step it was taken
+// after and the int32 number of bytes following. Those are the bits of the frame's float
+// values XORed with those of the previous frame (0 before the first) -- temperatures
+// changing slowly differ in their low order bits only -- split into byte planes, first
+// the most significant byte of all values, then the second one, and so on. Every run of
+// zero bytes is replaced by a 0 and the length of the run (7 bits per byte, the lowest
+// first, the highest bit set in all but the last byte).
+
+
+#ifndef SNAPSHOT_SIZE
+#define SNAPSHOT_SIZE 256
+#endif
+
+#ifndef SNAPSHOT_BUFFERS
+#define SNAPSHOT_BUFFERS 4
+#endif
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _snapshot_writer {
+    FILE* file;
+    int N, F, D;
+
+    // the device side
+    cl_command_queue queue;
+    cl_kernel kernel;
+    cl_mem frame;
+
+    // the ring of host buffers, frames head .. head+count-1 are pending
+    float* buffers[SNAPSHOT_BUFFERS];
+    cl_event reads[SNAPSHOT_BUFFERS];
+    int steps[SNAPSHOT_BUFFERS];
+    int head;
+    int count;
+    bool done;
+    mtx_t lock;
+    cnd_t changed;
+    thrd_t thread;
+
+    // owned by the writer thread: the current, the previous and the encoded frame
+    uint32_t* current;
+    uint32_t* previous;
+    uint8_t* encoded;
+
+    // statistics
+    int frames;
+    long long bytes;
+    double enqueueTime;
+    double stallTime;
+} snapshot_writer;
+
+// creates a writer appending the snapshots of a room of size N to the given file, using the
+// downsample kernel of the given program
+snapshot_writer* createSnapshotWriter(const char* fn, int N, cl_context context, cl_command_queue queue, cl_program program);
+
+// takes a snapshot of the field (stored with ghost cells) after the given step
+void takeSnapshot(snapshot_writer* w, cl_mem field, int step);
+
+// waits for all pending snapshots, prints some statistics and releases the writer
+void releaseSnapshotWriter(snapshot_writer* w);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+// encodes a run of zero bytes at out, returns the number of bytes
+static int encodeRun(uint8_t* out, int run) {
+    int len = 0;
+    out[len++] = 0;
+    for(; run >= 0x80; run >>= 7) out[len++] = 0x80 | (run & 0x7F);
+    out[len++] = run;
+    return len;
+}
+
+// encodes the n values of the frame as described above, returns the number of bytes
+static int encodeFrame(const uint32_t* frame, uint32_t* previous, uint8_t* out, int n) {
+    int len = 0;
+    int run = 0;
+    for(int p=3; p>=0; p--) {
+        for(int k=0; k<n; k++) {
+            uint8_t b = ((frame[k] ^ previous[k]) >> (8*p)) & 0xFF;
+            if (!b) {
+                run++;
+                continue;
+            }
+            // the zero bytes before this one
+            if (run) len += encodeRun(out + len, run);
+            run = 0;
+            out[len++] = b;
+        }
+    }
+    if (run) len += encodeRun(out + len, run);
+    memcpy(previous, frame, sizeof(uint32_t) * n);
+    return len;
+}
+
+static int snapshotWriterThread(void* arg) {
+    snapshot_writer* w = arg;
+    int n = w->D * w->D;
+    while (true) {
+        // wait for the next frame
+        mtx_lock(&w->lock);
+        while (w->count == 0 && !w->done) cnd_wait(&w->changed, &w->lock);
+        if (w->count == 0) {
+            mtx_unlock(&w->lock);
+            break;
+        }
+        int slot = w->head;
+        mtx_unlock(&w->lock);
+
+        // it may still be in transit
+        CLU_ERRCHECK(clWaitForEvents(1, &w->reads[slot]), "Failed to wait for snapshot");
+        CLU_ERRCHECK(clReleaseEvent(w->reads[slot]),      "Failed to release event");
+
+        memcpy(w->current, w->buffers[slot], sizeof(uint32_t) * n);
+        int32_t header[2] = { w->steps[slot], encodeFrame(w->current, w->previous, w->encoded, n) };
+        fwrite(header, sizeof(int32_t), 2, w->file);
+        fwrite(w->encoded, 1, header[1], w->file);
+        w->frames++;
+        w->bytes += sizeof(header) + header[1];
+
+        // the buffer may be reused
+        mtx_lock(&w->lock);
+        w->head = (w->head + 1) % SNAPSHOT_BUFFERS;
+        w->count--;
+        cnd_broadcast(&w->changed);
+        mtx_unlock(&w->lock);
+    }
+    return 0;
+}
+
+snapshot_writer* createSnapshotWriter(const char* fn, int N, cl_context context, cl_command_queue queue, cl_program program) {
+    snapshot_writer* w = calloc(1, sizeof(snapshot_writer));
+    w->file = fopen(fn, "wb");
+    if (!w->file) {
+        fprintf(stderr, "Unable to open snapshot file %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    w->N = N;
+    w->F = (N + SNAPSHOT_SIZE - 1) / SNAPSHOT_SIZE;
+    w->D = (N + w->F - 1) / w->F;
+    int32_t header[4] = { 0x504E5348, N, w->F, w->D };     // "HSNP" on little-endian machines
+    fwrite(header, sizeof(int32_t), 4, w->file);
+
+    cl_int err;
+    w->queue = queue;
+    w->kernel = clCreateKernel(program, "downsample", &err);
+    CLU_ERRCHECK(err, "Failed to create downsample kernel from program");
+    w->frame = clCreateBuffer(context, CL_MEM_WRITE_ONLY, w->D * w->D * sizeof(float), NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for snapshots");
+    clSetKernelArg(w->kernel, 1, sizeof(int), &w->N);
+    clSetKernelArg(w->kernel, 2, sizeof(int), &w->F);
+    clSetKernelArg(w->kernel, 3, sizeof(cl_mem), &w->frame);
+
+    for(int s=0; s<SNAPSHOT_BUFFERS; s++) {
+        w->buffers[s] = malloc(w->D * w->D * sizeof(float));
+    }
+    w->current = malloc(w->D * w->D * sizeof(uint32_t));
+    w->previous = calloc(w->D * w->D, sizeof(uint32_t));
+    w->encoded = malloc(2 * w->D * w->D * sizeof(uint32_t) + 8);  // < the worst case, alternating zero and non-zero bytes
+
+    mtx_init(&w->lock, mtx_plain);
+    cnd_init(&w->changed);
+    if (thrd_create(&w->thread, snapshotWriterThread, w) != thrd_success) {
+        fprintf(stderr, "Unable to start snapshot writer\n");
+        exit(EXIT_FAILURE);
+    }
+    return w;
+}
+
+void takeSnapshot(snapshot_writer* w, cl_mem field, int step) {
+    timestamp begin = now();
+
+    // wait for a free buffer
+    mtx_lock(&w->lock);
+    while (w->count == SNAPSHOT_BUFFERS) cnd_wait(&w->changed, &w->lock);
+    int slot = (w->head + w->count) % SNAPSHOT_BUFFERS;
+    mtx_unlock(&w->lock);
+
+    timestamp ready = now();
+
+    // downsample and fetch the frame in the background
+    size_t size[2] = { extendToMultiple(w->D, 16), extendToMultiple(w->D, 16) };
+    clSetKernelArg(w->kernel, 0, sizeof(cl_mem), &field);
+    CLU_ERRCHECK(clEnqueueNDRangeKernel(w->queue, w->kernel, 2, NULL, size, NULL, 0, NULL, NULL), "Failed to enqueue downsample kernel");
+    cl_int err = clEnqueueReadBuffer(w->queue, w->frame, CL_FALSE, 0, w->D * w->D * sizeof(float), w->buffers[slot], 0, NULL, &w->reads[slot]);
+    CLU_ERRCHECK(err, "Failed to read snapshot from device");
+    CLU_ERRCHECK(clFlush(w->queue), "Failed to flush command queue");
+    w->steps[slot] = step;
+
+    // hand it over to the writer
+    mtx_lock(&w->lock);
+    w->count++;
+    cnd_broadcast(&w->changed);
+    mtx_unlock(&w->lock);
+
+    timestamp end = now();
+    w->stallTime += ready - begin;
+    w->enqueueTime += end - ready;
+}
+
+void releaseSnapshotWriter(snapshot_writer* w) {
+    mtx_lock(&w->lock);
+    w->done = true;
+    cnd_broadcast(&w->changed);
+    mtx_unlock(&w->lock);
+    thrd_join(w->thread, NULL);
+
+    long long raw = (long long)w->frames * w->D * w->D * sizeof(float);
+    printf("Snapshots: %d frames of %dx%d cells, %.1f KB written (%.1f%% of raw), ", w->frames, w->D, w->D, w->bytes / 1024.0, (raw) ? 100.0 * w->bytes / raw : 0.0);
+    printf("%.3f ms spent enqueuing, %.3f ms waiting for the writer\n", w->enqueueTime * 1000, w->stallTime * 1000);
+
+    fclose(w->file);
+    CLU_ERRCHECK(clReleaseKernel(w->kernel),   "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseMemObject(w->frame), "Failed to release snapshot buffer");
+    for(int s=0; s<SNAPSHOT_BUFFERS; s++) {
+        free(w->buffers[s]);
+    }
+    free(w->current);
+    free(w->previous);
+    free(w->encoded);
+    mtx_destroy(&w->lock);
+    cnd_destroy(&w->changed);
+    free(w);
+}
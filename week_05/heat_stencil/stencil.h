@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A generic stencil engine for 2D and 3D grids.
+//
+// A stencil is described by its dimension (2 or 3), its radius R and the coefficients of the
+// (2R+1)^dim cells around a cell -- the new value of a cell is the weighted sum of the old
+// values of those cells. The engine provides
+//  - an OpenMP implementation, stencilStep, accumulating the non-zero coefficients one at a
+//    time over whole rows, such that the inner loops vectorize
+//  - the OpenCL kernels of stencil_generic.cl, generated from the description at build time
+//    (see stencilBuildOptions) -- the coefficients become constants, such that the terms of
+//    zero coefficients are dropped by the compiler (e.g. 7 of the 27 terms of a 7-point stencil)
+//
+// Grids of size N are stored like the rooms of heat_stencil, framed by R layers of ghost cells
+// in every dimension (2D grids being a single layer, without ghost layers above and below).
+// The ghost cells repeat the nearest cell of the grid -- for R = 1 those are the walls of
+// heat_stencil -- and are refreshed after every step. A single cell, the heat source, keeps
+// its value.
+
+typedef float value_t;
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _stencil_desc {
+    int dim;            // < 2 or 3
+    int radius;         // < R
+    value_t* coeffs;    // < (2R+1)^dim coefficients, the x offset varying fastest (see stencilCoeff)
+} stencil_desc;
+
+// creates a stencil of the given dimension and radius, all coefficients being 0
+stencil_desc createStencil(int dim, int radius);
+
+// the coefficient of offset (dx,dy,dz), -R <= dx,dy,dz <= R (dz = 0 in 2D)
+value_t* stencilCoeff(stencil_desc s, int dx, int dy, int dz);
+
+// creates the stencil of an explicit heat diffusion step with the given number of points
+// (5 or 9 in 2D, 7 or 27 in 3D) and diffusion constant alpha
+stencil_desc createHeatStencil(int points, value_t alpha);
+
+void releaseStencil(stencil_desc s);
+
+// the number of cells of a grid of size N, including the ghost cells
+long long gridSize(stencil_desc s, int N);
+
+// the index of cell (x,y,z) of a grid of size N, -R <= x,y,z < N+R (z = 0 in 2D)
+static inline long long gridIndex(stencil_desc s, int N, int x, int y, int z) {
+    int R = s.radius;
+    int RZ = (s.dim == 3) ? R : 0;
+    long long P = N + 2*R;
+    return ((long long)(z + RZ) * P + (y + R)) * P + (x + R);
+}
+
+// copies the nearest cells of the grid A of size N to its ghost cells
+void refreshHalo(stencil_desc s, value_t* A, int N);
+
+// copies the nearest cells of the grid A of size N to its ghost cells beyond the walls
+// perpendicular to dimension d (0 = x, 1 = y, 2 = z), including those of the lower dimensions --
+// done for all dimensions in order, the ghost cells of the edges and corners are filled as well
+void refreshHaloLayers(stencil_desc s, value_t* A, int N, int d);
+
+// computes the next state B of the grid A of size N, including its ghost cells -- the cell
+// (source_x,source_y,source_z) keeps its value
+void stencilStep(stencil_desc s, const value_t* A, value_t* B, int N, int source_x, int source_y, int source_z);
+
+// the options for building stencil_generic.cl for the given stencil, to be freed by the caller
+char* stencilBuildOptions(stencil_desc s);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+stencil_desc createStencil(int dim, int radius) {
+    if ((dim != 2 && dim != 3) || radius < 1) {
+        fprintf(stderr, "Unsupported stencil: %dD, radius %d\n", dim, radius);
+        exit(EXIT_FAILURE);
+    }
+    int K = 2*radius + 1;
+    stencil_desc s = { dim, radius, NULL };
+    s.coeffs = calloc((dim == 3) ? K*K*K : K*K, sizeof(value_t));
+    return s;
+}
+
+value_t* stencilCoeff(stencil_desc s, int dx, int dy, int dz) {
+    int R = s.radius;
+    int K = 2*R + 1;
+    int RZ = (s.dim == 3) ? R : 0;
+    return &s.coeffs[((dz + RZ) * K + (dy + R)) * K + (dx + R)];
+}
+
+stencil_desc createHeatStencil(int points, value_t alpha) {
+    int dim = (points == 5 || points == 9) ? 2 : 3;
+    if (points != 5 && points != 9 && points != 7 && points != 27) {
+        fprintf(stderr, "Unsupported heat stencil: %d points\n", points);
+        exit(EXIT_FAILURE);
+    }
+    stencil_desc s = createStencil(dim, 1);
+
+    // the weights of the neighbors sharing a face, an edge or a corner with the cell, relative to
+    // alpha -- the 9-point and 27-point ones are those of the isotropic discrete Laplacians
+    value_t face = 1, edge = 0, corner = 0;
+    if (points == 9)  { face = 4.0/6;   edge = 1.0/6; }
+    if (points == 27) { face = 14.0/30; edge = 3.0/30; corner = 1.0/30; }
+
+    // and the cell itself keeps the rest
+    double center = 1;
+    int RZ = (dim == 3) ? 1 : 0;
+    for(int dz=-RZ; dz<=RZ; dz++) {
+        for(int dy=-1; dy<=1; dy++) {
+            for(int dx=-1; dx<=1; dx++) {
+                int distance = abs(dx) + abs(dy) + abs(dz);
+                if (distance == 0) continue;
+                value_t c = alpha * ((distance == 1) ? face : (distance == 2) ? edge : corner);
+                *stencilCoeff(s, dx, dy, dz) = c;
+                center -= c;
+            }
+        }
+    }
+    *stencilCoeff(s, 0, 0, 0) = center;
+    return s;
+}
+
+void releaseStencil(stencil_desc s) {
+    free(s.coeffs);
+}
+
+long long gridSize(stencil_desc s, int N) {
+    long long P = N + 2*s.radius;
+    return (s.dim == 3) ? P*P*P : P*P;
+}
+
+void refreshHalo(stencil_desc s, value_t* A, int N) {
+    for(int d=0; d<s.dim; d++) {
+        refreshHaloLayers(s, A, N, d);
+    }
+}
+
+void refreshHaloLayers(stencil_desc s, value_t* A, int N, int d) {
+    int R = s.radius;
+    int RZ = (s.dim == 3) ? R : 0;
+    int NZ = (s.dim == 3) ? N : 1;
+    long long P = N + 2*R;
+
+    // the strides and padded extents of x, y and z, the lines along d are enumerated by u and v
+    long long stride[3] = { 1, P, P*P };
+    int padded[3] = { N + 2*R, N + 2*R, NZ + 2*RZ };
+    int u = (d == 0) ? 1 : 0;
+    int v = (d == 2) ? 1 : 2;
+    int extent = (d == 2) ? NZ : N;
+    int r = (d == 2) ? RZ : R;
+
+    // like the halo kernel
+    #pragma omp parallel for collapse(2)
+    for(int b=0; b<padded[v]; b++) {
+        for(int a=0; a<padded[u]; a++) {
+            // the first cell of the line within the grid
+            value_t* line = &A[a*stride[u] + b*stride[v] + r*stride[d]];
+            for(int g=1; g<=r; g++) {
+                line[-g*stride[d]] = line[0];
+                line[(extent-1+g)*stride[d]] = line[(extent-1)*stride[d]];
+            }
+        }
+    }
+}
+
+void stencilStep(stencil_desc s, const value_t* A, value_t* B, int N, int source_x, int source_y, int source_z) {
+    int R = s.radius;
+    int K = 2*R + 1;
+    int RZ = (s.dim == 3) ? R : 0;
+    int NZ = (s.dim == 3) ? N : 1;
+    long long P = N + 2*R;
+
+    // the non-zero coefficients and the offsets of their cells, in the order of the coefficients
+    long long offsets[(2*RZ+1)*K*K];
+    value_t weights[(2*RZ+1)*K*K];
+    int taps = 0;
+    for(int dz=-RZ; dz<=RZ; dz++) {
+        for(int dy=-R; dy<=R; dy++) {
+            for(int dx=-R; dx<=R; dx++) {
+                value_t c = *stencilCoeff(s, dx, dy, dz);
+                if (c == 0) continue;
+                offsets[taps] = (dz*P + dy)*P + dx;
+                weights[taps++] = c;
+            }
+        }
+    }
+
+    #pragma omp parallel for collapse(2)
+    for(int z=0; z<NZ; z++) {
+        for(int y=0; y<N; y++) {
+            long long row = gridIndex(s,N,0,y,z);
+            value_t* restrict out = &B[row];
+            for(int x=0; x<N; x++) {
+                out[x] = 0;
+            }
+            for(int t=0; t<taps; t++) {
+                const value_t* restrict in = &A[row + offsets[t]];
+                value_t c = weights[t];
+                for(int x=0; x<N; x++) {
+                    out[x] += c * in[x];
+                }
+            }
+        }
+    }
+
+    // the heat source keeps its value
+    long long source = gridIndex(s,N,source_x,source_y,source_z);
+    B[source] = A[source];
+
+    refreshHalo(s, B, N);
+}
+
+char* stencilBuildOptions(stencil_desc s) {
+    int K = 2*s.radius + 1;
+    int n = (s.dim == 3) ? K*K*K : K*K;
+
+    // the coefficients as hexadecimal float literals, such that they are exact
+    char* options = malloc(64 + 24*n);
+    int len = sprintf(options, "-D ST_DIM=%d -D ST_RADIUS=%d -D ST_COEFFS={", s.dim, s.radius);
+    for(int i=0; i<n; i++) {
+        len += sprintf(options + len, "%s%af", (i) ? "," : "", s.coeffs[i]);
+    }
+    sprintf(options + len, "}");
+    return options;
+}
@@ -0,0 +1,128 @@
+
+// The kernels of the stencil engine (see stencil.h), generated at build time from a stencil
+// description given by
+//
+//   ST_DIM     ... the dimension, 2 or 3
+//   ST_RADIUS  ... the radius R
+//   ST_COEFFS  ... the (2R+1)^ST_DIM coefficients as initializer list, the x offset varying fastest
+//
+// The grids are stored with R layers of ghost cells, like the rooms of heat_stencil.cl, such
+// that the stencil kernel needs no boundary checks. Like there, a work group loads its tile and
+// the surrounding halo into local memory once and every work item computes its cell from there.
+
+typedef float value_t;
+
+#define R ST_RADIUS
+#define K (2*R+1)
+
+// 2D grids are a single layer, without ghost layers above and below
+#if ST_DIM == 3
+#define RZ R
+#else
+#define RZ 0
+#endif
+#define KZ (2*RZ+1)
+
+__constant value_t coeffs[KZ*K*K] = ST_COEFFS;
+
+// the cell (x,y,z) of a grid of size N, -R <= x,y,z < N+R
+#define G(X,Y,Z) ((((long)(Z)+RZ)*(N+2*R) + ((Y)+R))*(N+2*R) + ((X)+R))
+
+__kernel void stencil(
+    __global const value_t* A,
+    __global value_t* B,
+    int N,
+    int source_x,
+    int source_y,
+    int source_z,
+    __local value_t* L		// the tile and its halo, (mx+2R) x (my+2R) x (mz+2RZ) cells
+) {
+    // obtain position of this 'thread'
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int z = get_global_id(2);
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int lz = get_local_id(2);
+
+    int mx = get_local_size(0);
+    int my = get_local_size(1);
+    int mz = get_local_size(2);
+
+    int NZ = (ST_DIM == 3) ? N : 1;
+
+    // the extent of the local buffer
+    const int LX = mx + 2*R;
+    const int LY = my + 2*R;
+    const int LZ = mz + 2*RZ;
+
+    // load the tile and its halo, the work items striding over the local buffer -- the ghost
+    // cells form the halo at the walls, cells beyond them are not needed
+    int x0 = get_group_id(0) * mx - R;
+    int y0 = get_group_id(1) * my - R;
+    int z0 = get_group_id(2) * mz - RZ;
+    for(int k = (lz*my + ly)*mx + lx; k < LX*LY*LZ; k += mx*my*mz) {
+        int i = k % LX;
+        int j = (k / LX) % LY;
+        int l = k / (LX*LY);
+        if (x0+i < N+R && y0+j < N+R && z0+l < NZ+RZ) L[k] = A[G(x0+i, y0+j, z0+l)];
+    }
+
+    // finally: memory fence
+    barrier(CLK_LOCAL_MEM_FENCE); // WARNING: same barrier must be reached by all work items
+
+    // now we are allowed to kill the excessive work items
+    if (x >= N || y >= N || z >= NZ) return;
+
+    // the weighted sum, in the order of the coefficients -- the loops are unrolled and the
+    // coefficients known, so the terms of zero coefficients vanish at compile time
+    value_t sum = 0;
+    #pragma unroll
+    for(int dz = 0; dz < KZ; dz++) {
+        #pragma unroll
+        for(int dy = 0; dy < K; dy++) {
+            #pragma unroll
+            for(int dx = 0; dx < K; dx++) {
+                value_t c = coeffs[(dz*K + dy)*K + dx];
+                if (c != 0) sum += c * L[((lz+dz)*LY + (ly+dy))*LX + (lx+dx)];
+            }
+        }
+    }
+
+    // the heat source keeps its value
+    long c = G(x,y,z);
+    B[c] = (x == source_x && y == source_y && z == source_z) ? A[c] : sum;
+}
+
+// completes a step: copies the nearest cells of the grid to the ghost cells beyond the walls
+// perpendicular to dimension d (0 = x, 1 = y, 2 = z), including those of the lower dimensions --
+// launched for d = 0 .. ST_DIM-1, one work item per line along d, enumerated by the padded
+// extents of the two other dimensions u and v
+__kernel void halo(
+    __global value_t* B,
+    int N,
+    int d
+) {
+    int NZ = (ST_DIM == 3) ? N : 1;
+    long P = N + 2*R;
+
+    // the strides and padded extents of x, y and z
+    long stride[3] = { 1, P, P*P };
+    int padded[3] = { N + 2*R, N + 2*R, NZ + 2*RZ };
+    int u = (d == 0) ? 1 : 0;
+    int v = (d == 2) ? 1 : 2;
+    int extent = (d == 2) ? NZ : N;
+    int r = (d == 2) ? RZ : R;
+
+    int a = get_global_id(0);
+    int b = get_global_id(1);
+    if (a >= padded[u] || b >= padded[v]) return;
+
+    // the first cell of the line within the grid
+    __global value_t* line = B + a*stride[u] + b*stride[v] + r*stride[d];
+    for(int g = 1; g <= r; g++) {
+        line[-g*stride[d]] = line[0];
+        line[(extent-1+g)*stride[d]] = line[(extent-1)*stride[d]];
+    }
+}
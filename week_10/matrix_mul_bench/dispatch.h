@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A cost model for selecting the backend of a matrix multiplication.
+//
+// The runtime of C (M x N) = A (M x K) * B (K x N) on a backend is predicted as
+//
+//     overhead + 2*M*N*K / flop_rate + transfers
+//
+// where the transfers of A, B and C to / from an OpenCL device cost
+//
+//     3 * latency + 4*(M*K + K*N + M*N) / bandwidth
+//
+// and are 0 for the CPU. The parameters of every backend are measured once by
+// timing two problem sizes each and fitting a line through the results. They are
+// kept in a plain text file, one backend per line:
+//
+//     <overhead> <flop rate> <latency> <bandwidth> <backend name>
+
+
+#define DISPATCH_FILE "mm_dispatch.txt"
+
+// the problem sizes used for measuring compute and transfer costs
+#define DISPATCH_CALIBRATION_SMALL 64
+#define DISPATCH_CALIBRATION_LARGE 512
+#define DISPATCH_TRANSFER_SMALL (4*1024)
+#define DISPATCH_TRANSFER_LARGE (16*1024*1024)
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _mm_backend_profile {
+    char name[256];
+    double overhead;        // < fixed costs of a computation in seconds (e.g. a kernel launch)
+    double flop_rate;       // < floating point operations per second
+    double latency;         // < fixed costs of a transfer in seconds, 0 for the CPU
+    double bandwidth;       // < bytes per second between host and device, 0 for the CPU
+} mm_backend_profile;
+
+typedef struct _mm_profile_table {
+    mm_backend_profile* entries;
+    int size;
+} mm_profile_table;
+
+// the predicted runtime of C = A * B on the given backend in seconds
+double predictRuntime(const mm_backend_profile* p, int M, int N, int K);
+
+// the predicted share of the transfers in the runtime above, in seconds
+double predictTransfers(const mm_backend_profile* p, int M, int N, int K);
+
+// fits t = fixed + x / rate through the measurements (x0,t0) and (x1,t1), x0 < x1
+void fitCosts(double x0, double t0, double x1, double t1, double* fixed, double* rate);
+
+// loads the profiles from the given file, a missing file gives an empty table
+mm_profile_table loadProfileTable(const char* fn);
+
+// obtains the profile of the named backend, NULL if there is none
+const mm_backend_profile* lookupProfile(const mm_profile_table* table, const char* name);
+
+// adds or replaces the profile of a backend
+void updateProfile(mm_profile_table* table, const mm_backend_profile* profile);
+
+// writes the profiles to the given file
+void storeProfileTable(const mm_profile_table* table, const char* fn);
+
+void releaseProfileTable(mm_profile_table table);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+double predictTransfers(const mm_backend_profile* p, int M, int N, int K) {
+    if (p->bandwidth <= 0) return 0;
+    double bytes = sizeof(float) * ((double)M*K + (double)K*N + (double)M*N);
+    return 3 * p->latency + bytes / p->bandwidth;
+}
+
+double predictRuntime(const mm_backend_profile* p, int M, int N, int K) {
+    return p->overhead + 2.0*M*N*K / p->flop_rate + predictTransfers(p, M, N, K);
+}
+
+void fitCosts(double x0, double t0, double x1, double t1, double* fixed, double* rate) {
+    // with noisy measurements the line may be falling or cross below 0 --
+    // then the larger measurement alone is the more reliable estimate
+    if (t1 <= t0) {
+        *fixed = 0;
+        *rate = x1 / t1;
+        return;
+    }
+    *rate = (x1 - x0) / (t1 - t0);
+    *fixed = t0 - x0 / *rate;
+    if (*fixed < 0) {
+        *fixed = 0;
+        *rate = x1 / t1;
+    }
+}
+
+mm_profile_table loadProfileTable(const char* fn) {
+    mm_profile_table table = { NULL, 0 };
+    FILE* fp = fopen(fn, "r");
+    if (!fp) return table;
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        mm_backend_profile p;
+        int offset = 0;
+        int read = sscanf(line, "%lf %lf %lf %lf %n", &p.overhead, &p.flop_rate, &p.latency, &p.bandwidth, &offset);
+        if (read != 4 || offset == 0 || p.flop_rate <= 0) {
+            fprintf(stderr, "Ignoring invalid line in dispatch file %s: %s", fn, line);
+            continue;
+        }
+        // the rest of the line is the backend name
+        snprintf(p.name, sizeof(p.name), "%s", line + offset);
+        p.name[strcspn(p.name, "\r\n")] = '\0';
+        updateProfile(&table, &p);
+    }
+    fclose(fp);
+    return table;
+}
+
+const mm_backend_profile* lookupProfile(const mm_profile_table* table, const char* name) {
+    for(int i=0; i<table->size; i++) {
+        if (!strcmp(table->entries[i].name, name)) return &table->entries[i];
+    }
+    return NULL;
+}
+
+void updateProfile(mm_profile_table* table, const mm_backend_profile* profile) {
+    mm_backend_profile* e = (mm_backend_profile*)lookupProfile(table, profile->name);
+    if (!e) {
+        table->entries = realloc(table->entries, sizeof(mm_backend_profile) * (table->size + 1));
+        e = &table->entries[table->size++];
+    }
+    *e = *profile;
+}
+
+void storeProfileTable(const mm_profile_table* table, const char* fn) {
+    FILE* fp = fopen(fn, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to write dispatch file %s\n", fn);
+        return;
+    }
+    fprintf(fp, "# overhead[s] flop_rate[1/s] latency[s] bandwidth[B/s] backend\n");
+    for(int i=0; i<table->size; i++) {
+        const mm_backend_profile* p = &table->entries[i];
+        fprintf(fp, "%.9f %.6e %.9f %.6e %s\n", p->overhead, p->flop_rate, p->latency, p->bandwidth, p->name);
+    }
+    fclose(fp);
+}
+
+void releaseProfileTable(mm_profile_table table) {
+    free(table.entries);
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Support for splitting a product between the CPU and an OpenCL device.
+//
+// The rows of C are split such that both sides finish at the same time: the
+// CPU computes the first share * N rows, the device the remaining ones. The
+// share is learned from the rows per second both sides achieved in previous
+// runs and kept per (device, size bucket) in a plain text file, one entry per line:
+//
+//     <bucket> <CPU share> <device name>
+//
+// where the size bucket of N is floor(log2(N)) (see sizeBucket in tuning.h).
+
+
+#define HYBRID_FILE "mm_hybrid.txt"
+
+// the CPU share used if there is no entry for a device and size yet
+#define HYBRID_DEFAULT_SHARE 0.2
+
+// the weight of a new measurement, the rest is kept from previous runs to smooth out noise
+#define HYBRID_LEARNING_RATE 0.5
+
+// the share never drops to 0 (or rises to 1), otherwise the idle side could not be measured anymore
+#define HYBRID_MIN_SHARE 0.01
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _mm_hybrid_entry {
+    char device[256];
+    int bucket;
+    double share;
+} mm_hybrid_entry;
+
+typedef struct _mm_hybrid_table {
+    mm_hybrid_entry* entries;
+    int size;
+} mm_hybrid_table;
+
+// the balanced CPU share given the rows per second achieved by the CPU and the device
+double balancedShare(double cpu_rate, double device_rate);
+
+// blends a measured share into the learned one and clamps the result
+double learnShare(double share, double measured);
+
+// the number of rows computed by the CPU for the given share, at least one per side
+int hybridCPURows(double share, int N);
+
+// loads the table of learned shares from the given file, a missing file gives an empty table
+mm_hybrid_table loadHybridTable(const char* fn);
+
+// obtains the learned CPU share for the given device and size bucket, the default if there is none
+double lookupShare(const mm_hybrid_table* table, const char* device, int bucket);
+
+// adds or replaces the entry for the given device and size bucket
+void updateShare(mm_hybrid_table* table, const char* device, int bucket, double share);
+
+// writes the table to the given file
+void storeHybridTable(const mm_hybrid_table* table, const char* fn);
+
+void releaseHybridTable(mm_hybrid_table table);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+double balancedShare(double cpu_rate, double device_rate) {
+    // with CPU share s, both finish at the same time if s / cpu_rate == (1-s) / device_rate
+    return cpu_rate / (cpu_rate + device_rate);
+}
+
+double learnShare(double share, double measured) {
+    double res = (1 - HYBRID_LEARNING_RATE) * share + HYBRID_LEARNING_RATE * measured;
+    if (res < HYBRID_MIN_SHARE) res = HYBRID_MIN_SHARE;
+    if (res > 1 - HYBRID_MIN_SHARE) res = 1 - HYBRID_MIN_SHARE;
+    return res;
+}
+
+int hybridCPURows(double share, int N) {
+    int rows = (int)(share * N + 0.5);
+    if (rows < 1) rows = 1;
+    if (rows > N-1) rows = N-1;
+    return rows;
+}
+
+mm_hybrid_table loadHybridTable(const char* fn) {
+    mm_hybrid_table table = { NULL, 0 };
+    FILE* fp = fopen(fn, "r");
+    if (!fp) return table;
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        mm_hybrid_entry e;
+        int offset = 0;
+        int read = sscanf(line, "%d %lf %n", &e.bucket, &e.share, &offset);
+        if (read != 2 || offset == 0) {
+            fprintf(stderr, "Ignoring invalid line in hybrid split file %s: %s", fn, line);
+            continue;
+        }
+        // the rest of the line is the device name
+        snprintf(e.device, sizeof(e.device), "%s", line + offset);
+        e.device[strcspn(e.device, "\r\n")] = '\0';
+        updateShare(&table, e.device, e.bucket, e.share);
+    }
+    fclose(fp);
+    return table;
+}
+
+double lookupShare(const mm_hybrid_table* table, const char* device, int bucket) {
+    for(int i=0; i<table->size; i++) {
+        if (table->entries[i].bucket == bucket && !strcmp(table->entries[i].device, device)) {
+            return table->entries[i].share;
+        }
+    }
+    return HYBRID_DEFAULT_SHARE;
+}
+
+void updateShare(mm_hybrid_table* table, const char* device, int bucket, double share) {
+    mm_hybrid_entry* e = NULL;
+    for(int i=0; i<table->size; i++) {
+        if (table->entries[i].bucket == bucket && !strcmp(table->entries[i].device, device)) {
+            e = &table->entries[i];
+        }
+    }
+    if (!e) {
+        table->entries = realloc(table->entries, sizeof(mm_hybrid_entry) * (table->size + 1));
+        e = &table->entries[table->size++];
+        snprintf(e->device, sizeof(e->device), "%s", device);
+        e->bucket = bucket;
+    }
+    e->share = share;
+}
+
+void storeHybridTable(const mm_hybrid_table* table, const char* fn) {
+    FILE* fp = fopen(fn, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to write hybrid split file %s\n", fn);
+        return;
+    }
+    fprintf(fp, "# bucket CPU_SHARE device\n");
+    for(int i=0; i<table->size; i++) {
+        const mm_hybrid_entry* e = &table->entries[i];
+        fprintf(fp, "%d %.4f %s\n", e->bucket, e->share, e->device);
+    }
+    fclose(fp);
+}
+
+void releaseHybridTable(mm_hybrid_table table) {
+    free(table.entries);
+}
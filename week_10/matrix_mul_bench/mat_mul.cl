@@ -19,3 +19,144 @@ __kernel void mat_mul(
     }
     c[i*N+j] = sum;
 }
+
+
+// C += A * B (or C = A * B if accumulate is 0) for an M x K matrix A and a
+// K x N matrix B -- used for accumulating the blocks of out-of-core products
+__kernel void mat_mul_acc(
+    __global float* c, 
+    __global const float* a, 
+    __global const float* b,
+    int M,
+    int N,
+    int K,
+    int accumulate
+) {
+    size_t i = get_global_id(1);
+    size_t j = get_global_id(0);
+
+    if (i >= M || j >= N) return;
+
+    float sum = (accumulate) ? c[i*N+j] : 0;
+    for(int k = 0; k<K; k++) {
+        sum += a[i*K+k] * b[k*N+j];
+    }
+    c[i*N+j] = sum;
+}
+
+
+// -- fused epilogues --
+
+// the operations following the product x of an element in column j with previous value c
+// (see mm_epilogue in mm_cpu.h): alpha * x + beta * c + bias[j], ReLU, clamping to [lo,hi]
+float applyEpilogue(float x, float c, int j, float alpha, float beta, __global const float* bias, int relu, float lo, float hi) {
+    float res = alpha * x + beta * c;
+    if (bias) res += bias[j];
+    if (relu) res = fmax(res, 0.0f);
+    return fmin(fmax(res, lo), hi);
+}
+
+// C = epilogue(A * B), C is only read if beta is not 0 and written once -- bias may be
+// NULL, lo = -INFINITY and hi = INFINITY disable the clamping
+__kernel void mat_mul_ex(
+    __global float* c, 
+    __global const float* a, 
+    __global const float* b,
+    int N,
+    float alpha,
+    float beta,
+    __global const float* bias,
+    int relu,
+    float lo,
+    float hi
+) {
+    size_t i = get_global_id(1);
+    size_t j = get_global_id(0);
+
+    if (i >= N || j >= N) return;
+
+    float sum = 0;
+    for(int k = 0; k<N; k++) {
+        sum += a[i*N+k] * b[k*N+j];
+    }
+    float old = (beta != 0) ? c[i*N+j] : 0;
+    c[i*N+j] = applyEpilogue(sum, old, j, alpha, beta, bias, relu, lo, hi);
+}
+
+// the same epilogue as a separate pass over the product t = A * B
+__kernel void mat_mul_epilogue(
+    __global float* c, 
+    __global const float* t,
+    int N,
+    float alpha,
+    float beta,
+    __global const float* bias,
+    int relu,
+    float lo,
+    float hi
+) {
+    size_t i = get_global_id(1);
+    size_t j = get_global_id(0);
+
+    if (i >= N || j >= N) return;
+
+    float old = (beta != 0) ? c[i*N+j] : 0;
+    c[i*N+j] = applyEpilogue(t[i*N+j], old, j, alpha, beta, bias, relu, lo, hi);
+}
+
+// -- mixed precision variants --
+
+// (double precision and complex kernels are generated in mat_mul_generic.cl)
+
+// fp16 inputs with fp32 accumulation -- half is only used as a storage
+// format through vload_half, so no cl_khr_fp16 support is required
+__kernel void mat_mul_f16(
+    __global float* c, 
+    __global const half* a, 
+    __global const half* b,
+    int N
+) {
+    size_t i = get_global_id(1);
+    size_t j = get_global_id(0);
+
+    if (i >= N || j >= N) return;
+
+    float sum = 0;
+    for(int k = 0; k<N; k++) {
+        sum += vload_half(i*N+k, a) * vload_half(k*N+j, b);
+    }
+    c[i*N+j] = sum;
+}
+
+// int8 x int8 -> int32 -- b is transposed (row j holds column j of B), such
+// that groups of 4 consecutive bytes of both operands form a packed dot product
+__kernel void mat_mul_i8(
+    __global int* c, 
+    __global const char* a, 
+    __global const char* bt,
+    int N
+) {
+    size_t i = get_global_id(1);
+    size_t j = get_global_id(0);
+
+    if (i >= N || j >= N) return;
+
+    __global const char* ra = a + i*N;
+    __global const char* rb = bt + j*N;
+
+    int sum = 0;
+    int k = 0;
+    for(; k+4 <= N; k+=4) {
+        char4 va = vload4(0, ra + k);
+        char4 vb = vload4(0, rb + k);
+#ifdef __opencl_c_integer_dot_product_input_4x8bit
+        sum += dot(va, vb);
+#else
+        sum += va.x*vb.x + va.y*vb.y + va.z*vb.z + va.w*vb.w;
+#endif
+    }
+    for(; k<N; k++) {
+        sum += ra[k] * rb[k];
+    }
+    c[i*N+j] = sum;
+}
@@ -0,0 +1,394 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "cl_utils.h"
+#include "dispatch.h"
+#include "mm_cpu.h"
+#include "philox.h"
+#include "verify.h"
+
+// Computes C (M x N) = A (M x K) * B (K x N) on the backend predicted to be the
+// fastest: the sequential CPU engine, the OpenMP CPU engine or one of the OpenCL
+// devices (see dispatch.h for the cost model). Backends without a profile are
+// measured first, the profiles are kept for later runs.
+
+typedef float value_t;
+
+
+// -- backends --
+
+#define MAX_BACKENDS 16
+
+typedef enum _mm_backend_kind {
+    BACKEND_SEQ,        // < the CPU engine on a single thread
+    BACKEND_OMP,        // < the CPU engine on all threads
+    BACKEND_OCL         // < the mat_mul_acc kernel on an OpenCL device
+} mm_backend_kind;
+
+typedef struct _mm_backend {
+    mm_backend_kind kind;
+    int device;                 // < the OpenCL device number
+    mm_backend_profile profile;
+} mm_backend;
+
+// lists all backends of this machine, returns their number
+int listBackends(mm_backend* out, int max);
+
+// computes C = A * B on the given backend, returns the wall time in seconds
+double runBackend(const mm_backend* b, value_t* C, const value_t* A, const value_t* B, int M, int N, int K);
+
+// measures the profile of the given backend
+void calibrateBackend(mm_backend* b);
+
+// compares rows x N results C with the reference R, the error bound depending on K
+mm_error_stats compareRows(const value_t* C, const value_t* R, int rows, int N, int K);
+
+// ----------------------
+
+// the seed for generating input matrices
+uint64_t SEED = 0;
+
+// the number of rows verified against the CPU engine for non-square products
+#define CHECK_ROWS 16
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    // 'parsing' optional input parameters
+    //  - N or M N K  ... the problem size (default N = 1000)
+    //  - calibrate   ... re-measure all backend profiles
+    int dims[3] = { 1000, 1000, 1000 };
+    int num_dims = 0;
+    bool calibrate = false;
+    for(int a=1; a<argc; a++) {
+        if (!strcmp(argv[a], "calibrate")) {
+            calibrate = true;
+        } else if (atoi(argv[a]) > 0 && num_dims < 3) {
+            dims[num_dims++] = atoi(argv[a]);
+        } else {
+            printf("Usage: %s [N | M N K] [calibrate]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (num_dims == 1) dims[1] = dims[2] = dims[0];
+    if (num_dims == 2) {
+        printf("Usage: %s [N | M N K] [calibrate]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int M = dims[0], N = dims[1], K = dims[2];
+    printf("Computing matrix-matrix product with M=%d, N=%d, K=%d\n", M, N, K);
+
+
+    // ---------- cost model ----------
+
+    mm_backend backends[MAX_BACKENDS];
+    int num_backends = listBackends(backends, MAX_BACKENDS);
+
+    // backends are only measured once, unless requested otherwise
+    mm_profile_table table = loadProfileTable(DISPATCH_FILE);
+    bool updated = false;
+    for(int b=0; b<num_backends; b++) {
+        const mm_backend_profile* known = lookupProfile(&table, backends[b].profile.name);
+        if (known && !calibrate) {
+            backends[b].profile = *known;
+            continue;
+        }
+        printf("Calibrating %s ..\n", backends[b].profile.name);
+        calibrateBackend(&backends[b]);
+        updateProfile(&table, &backends[b].profile);
+        updated = true;
+    }
+    if (updated) storeProfileTable(&table, DISPATCH_FILE);
+    releaseProfileTable(table);
+
+    // predict and pick the fastest
+    int best = 0;
+    double predicted[MAX_BACKENDS];
+    printf("\nPredicted runtimes:\n");
+    for(int b=0; b<num_backends; b++) {
+        const mm_backend_profile* p = &backends[b].profile;
+        predicted[b] = predictRuntime(p, M, N, K);
+        printf("\t%-40s %10.3f ms (%.2f GFLOPS, transfers %.3f ms)\n", p->name, predicted[b]*1e3,
+            p->flop_rate / 1e9, predictTransfers(p, M, N, K)*1e3);
+        if (predicted[b] < predicted[best]) best = b;
+    }
+    printf("Decision: %s for M=%d, N=%d, K=%d, predicted %.3f ms\n", backends[best].profile.name, M, N, K, predicted[best]*1e3);
+
+
+    // ---------- compute ----------
+
+    value_t* A = malloc(sizeof(value_t) * M * K);
+    value_t* B = malloc(sizeof(value_t) * K * N);
+    value_t* C = malloc(sizeof(value_t) * M * N);
+    fillMatrixRandom(A, M, K, SEED, 0, 0.5f, 1.5f);
+    fillMatrixRandom(B, K, N, SEED, 1, 0.5f, 1.5f);
+
+    double seconds = runBackend(&backends[best], C, A, B, M, N, K);
+    printf("Total time: %.3f ms (predicted %.3f ms)\n", seconds*1e3, predicted[best]*1e3);
+    printf("GFLOPS: %.3f\n", (2.0*M*N*K) / seconds / 1e9);
+
+
+    // ---------- check ----------
+
+    mm_error_stats stats;
+    if (M == N && N == K) {
+        stats = verifyFreivalds(A, B, C, N, SEED);
+    } else {
+        // a sample of rows, compared with the CPU engine
+        int rows = (M < CHECK_ROWS) ? M : CHECK_ROWS;
+        value_t* As = malloc(sizeof(value_t) * rows * K);
+        value_t* Cs = malloc(sizeof(value_t) * rows * N);
+        value_t* R = malloc(sizeof(value_t) * rows * N);
+        for(int s=0; s<rows; s++) {
+            long long i = (long long)s * M / rows;
+            memcpy(As + (long long)s*K, A + i*K, sizeof(value_t) * K);
+            memcpy(Cs + (long long)s*N, C + i*N, sizeof(value_t) * N);
+        }
+        gemmF32(R, As, B, rows, N, K);
+        stats = compareRows(Cs, R, rows, N, K);
+        free(As);
+        free(Cs);
+        free(R);
+    }
+    printf("Verification: ");
+    printErrorStats(stats);
+    printf("\n");
+
+
+    // ---------- cleanup ----------
+
+    free(A);
+    free(B);
+    free(C);
+
+    // done
+    return (stats.success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int listBackends(mm_backend* out, int max) {
+    int num = 0;
+    out[num].kind = BACKEND_SEQ;
+    out[num].device = -1;
+    snprintf(out[num].profile.name, sizeof(out[num].profile.name), "cpu-seq");
+    num++;
+    out[num].kind = BACKEND_OMP;
+    out[num].device = -1;
+    snprintf(out[num].profile.name, sizeof(out[num].profile.name), "cpu-omp (%d threads)", omp_get_max_threads());
+    num++;
+
+    // all OpenCL devices, numbered like by cluInitDevice
+    cl_uint num_platforms = 0;
+    if (clGetPlatformIDs(0, NULL, &num_platforms) != CL_SUCCESS) num_platforms = 0;
+    cl_platform_id platforms[num_platforms+1];
+    if (num_platforms > 0) {
+        CLU_ERRCHECK(clGetPlatformIDs(num_platforms, platforms, NULL), "Failed to retrieve ocl platforms");
+    }
+    int device = 0;
+    for(cl_uint p=0; p<num_platforms; p++) {
+        cl_uint num_devices = 0;
+        if (clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices) != CL_SUCCESS) continue;
+        cl_device_id devices[num_devices+1];
+        CLU_ERRCHECK(clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, num_devices, devices, NULL), "Failed to retrieve ocl devices");
+        for(cl_uint d=0; d<num_devices && num<max; d++, device++) {
+            char name[200];
+            cluGetDeviceName(devices[d], sizeof(name), name);
+            out[num].kind = BACKEND_OCL;
+            out[num].device = device;
+            snprintf(out[num].profile.name, sizeof(out[num].profile.name), "ocl-%d %s", device, name);
+            num++;
+        }
+    }
+    return num;
+}
+
+// the OpenCL resources of a device backend
+typedef struct _mm_device {
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+    cl_kernel kernel;
+} mm_device;
+
+mm_device openDevice(int num) {
+    mm_device d;
+    cl_device_id device = cluInitDevice(num, &d.context, &d.queue);
+    d.program = cluBuildProgramFromFile(d.context, device, "mat_mul.cl", NULL);
+    cl_int err;
+    d.kernel = clCreateKernel(d.program, "mat_mul_acc", &err);
+    CLU_ERRCHECK(err, "Failed to create mat_mul_acc kernel from program");
+    return d;
+}
+
+void closeDevice(mm_device d) {
+    CLU_ERRCHECK(clReleaseKernel(d.kernel), "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseProgram(d.program), "Failed to release program");
+    CLU_ERRCHECK(clReleaseCommandQueue(d.queue), "Failed to release command queue");
+    CLU_ERRCHECK(clReleaseContext(d.context), "Failed to release OpenCL context");
+}
+
+int roundUpToMultiple(int N, int B) {
+    if ((N % B) == 0) return N;
+    return N + (B - (N%B));
+}
+
+// runs the kernel on device buffers, returns the wall time in seconds
+double computeOnDevice(mm_device d, cl_mem C, cl_mem A, cl_mem B, int M, int N, int K) {
+    int accumulate = 0;
+    cluSetKernelArguments(d.kernel, 7,
+        sizeof(cl_mem), (void *)&C,
+        sizeof(cl_mem), (void *)&A,
+        sizeof(cl_mem), (void *)&B,
+        sizeof(int), &M,
+        sizeof(int), &N,
+        sizeof(int), &K,
+        sizeof(int), &accumulate
+    );
+    size_t size[2] = { roundUpToMultiple(N,32), roundUpToMultiple(M,32) };
+    timestamp begin = now();
+    CLU_ERRCHECK(clEnqueueNDRangeKernel(d.queue, d.kernel, 2, NULL, size, NULL, 0, NULL, NULL), "Failed to enqueue 2D kernel");
+    CLU_ERRCHECK(clFinish(d.queue), "Failed to wait for command queue completion");
+    return now() - begin;
+}
+
+double runBackend(const mm_backend* b, value_t* C, const value_t* A, const value_t* B, int M, int N, int K) {
+    if (b->kind != BACKEND_OCL) {
+        int threads = omp_get_max_threads();
+        if (b->kind == BACKEND_SEQ) omp_set_num_threads(1);
+        timestamp begin = now();
+        gemmF32(C, A, B, M, N, K);
+        timestamp end = now();
+        omp_set_num_threads(threads);
+        return end - begin;
+    }
+
+    // the device is set up before the time measurement, like a long-running dispatcher would
+    mm_device d = openDevice(b->device);
+    cl_int err;
+    cl_mem devA = clCreateBuffer(d.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(value_t) * M * K, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+    cl_mem devB = clCreateBuffer(d.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(value_t) * K * N, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+    cl_mem devC = clCreateBuffer(d.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(value_t) * M * N, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
+
+    timestamp begin = now();
+    CLU_ERRCHECK(clEnqueueWriteBuffer(d.queue, devA, CL_TRUE, 0, sizeof(value_t) * M * K, A, 0, NULL, NULL), "Failed to write matrix A to device");
+    CLU_ERRCHECK(clEnqueueWriteBuffer(d.queue, devB, CL_TRUE, 0, sizeof(value_t) * K * N, B, 0, NULL, NULL), "Failed to write matrix B to device");
+    computeOnDevice(d, devC, devA, devB, M, N, K);
+    CLU_ERRCHECK(clEnqueueReadBuffer(d.queue, devC, CL_TRUE, 0, sizeof(value_t) * M * N, C, 0, NULL, NULL), "Failed reading back result");
+    timestamp end = now();
+
+    CLU_ERRCHECK(clReleaseMemObject(devA), "Failed to release Matrix A");
+    CLU_ERRCHECK(clReleaseMemObject(devB), "Failed to release Matrix B");
+    CLU_ERRCHECK(clReleaseMemObject(devC), "Failed to release Matrix C");
+    closeDevice(d);
+    return end - begin;
+}
+
+// the best of 3 runs of a blocking transfer of the given size to the device
+double timeTransfer(mm_device d, cl_mem buffer, const void* data, size_t bytes) {
+    double best = INFINITY;
+    for(int r=0; r<3; r++) {
+        timestamp begin = now();
+        CLU_ERRCHECK(clEnqueueWriteBuffer(d.queue, buffer, CL_TRUE, 0, bytes, data, 0, NULL, NULL), "Failed to write buffer to device");
+        double seconds = now() - begin;
+        if (seconds < best) best = seconds;
+    }
+    return best;
+}
+
+void calibrateBackend(mm_backend* b) {
+    const int S = DISPATCH_CALIBRATION_SMALL, L = DISPATCH_CALIBRATION_LARGE;
+    value_t* A = malloc(sizeof(value_t) * L * L);
+    value_t* B = malloc(sizeof(value_t) * L * L);
+    value_t* C = malloc(sizeof(value_t) * L * L);
+    fillMatrixRandom(A, L, L, SEED, 0, 0.5f, 1.5f);
+    fillMatrixRandom(B, L, L, SEED, 1, 0.5f, 1.5f);
+
+    // the best of 3 computations for both sizes (the first one includes any warm-up)
+    double small = INFINITY, large = INFINITY;
+    mm_device d;
+    cl_mem devA = NULL, devB = NULL, devC = NULL;
+    if (b->kind == BACKEND_OCL) {
+        d = openDevice(b->device);
+        cl_int err;
+        devA = clCreateBuffer(d.context, CL_MEM_READ_WRITE, DISPATCH_TRANSFER_LARGE, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+        devB = clCreateBuffer(d.context, CL_MEM_READ_ONLY, sizeof(value_t) * L * L, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+        devC = clCreateBuffer(d.context, CL_MEM_READ_WRITE, sizeof(value_t) * L * L, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
+        CLU_ERRCHECK(clEnqueueWriteBuffer(d.queue, devA, CL_TRUE, 0, sizeof(value_t) * L * L, A, 0, NULL, NULL), "Failed to write matrix A to device");
+        CLU_ERRCHECK(clEnqueueWriteBuffer(d.queue, devB, CL_TRUE, 0, sizeof(value_t) * L * L, B, 0, NULL, NULL), "Failed to write matrix B to device");
+    }
+    for(int r=0; r<3; r++) {
+        double ts, tl;
+        if (b->kind == BACKEND_OCL) {
+            ts = computeOnDevice(d, devC, devA, devB, S, S, S);
+            tl = computeOnDevice(d, devC, devA, devB, L, L, L);
+        } else {
+            ts = runBackend(b, C, A, B, S, S, S);
+            tl = runBackend(b, C, A, B, L, L, L);
+        }
+        if (ts < small) small = ts;
+        if (tl < large) large = tl;
+    }
+    fitCosts(2.0*S*S*S, small, 2.0*L*L*L, large, &b->profile.overhead, &b->profile.flop_rate);
+
+    // transfers, only for devices
+    b->profile.latency = 0;
+    b->profile.bandwidth = 0;
+    if (b->kind == BACKEND_OCL) {
+        char* data = calloc(DISPATCH_TRANSFER_LARGE, 1);
+        double ts = timeTransfer(d, devA, data, DISPATCH_TRANSFER_SMALL);
+        double tl = timeTransfer(d, devA, data, DISPATCH_TRANSFER_LARGE);
+        fitCosts(DISPATCH_TRANSFER_SMALL, ts, DISPATCH_TRANSFER_LARGE, tl, &b->profile.latency, &b->profile.bandwidth);
+        free(data);
+
+        CLU_ERRCHECK(clReleaseMemObject(devA), "Failed to release Matrix A");
+        CLU_ERRCHECK(clReleaseMemObject(devB), "Failed to release Matrix B");
+        CLU_ERRCHECK(clReleaseMemObject(devC), "Failed to release Matrix C");
+        closeDevice(d);
+    }
+    printf("\toverhead: %.3f ms, %.2f GFLOPS", b->profile.overhead*1e3, b->profile.flop_rate/1e9);
+    if (b->kind == BACKEND_OCL) {
+        printf(", transfer latency: %.3f ms, bandwidth: %.2f GB/s", b->profile.latency*1e3, b->profile.bandwidth/1e9);
+    }
+    printf("\n");
+
+    free(A);
+    free(B);
+    free(C);
+}
+
+mm_error_stats compareRows(const value_t* C, const value_t* R, int rows, int N, int K) {
+    mm_error_stats res;
+    res.tolerance = verifyTolerance(K);
+    res.max_rel_error = 0;
+    res.mean_rel_error = 0;
+    res.max_ulps = 0;
+    res.num_failed = 0;
+    for(long long e = 0; e<(long long)rows*N; e++) {
+        double scale = fabs(R[e]) > DBL_MIN ? fabs(R[e]) : 1.0;
+        double err = fabs((double)C[e] - R[e]) / scale;
+
+        // NaN must never pass
+        if (!(err <= res.tolerance)) res.num_failed++;
+        if (err != err) err = INFINITY;
+
+        long long ulps = ulpDistance(C[e], R[e]);
+        if (err > res.max_rel_error) res.max_rel_error = err;
+        if (ulps > res.max_ulps) res.max_ulps = ulps;
+        res.mean_rel_error += err;
+    }
+    res.mean_rel_error /= (double)rows*N;
+    res.success = (res.num_failed == 0);
+    return res;
+}
@@ -5,6 +5,12 @@
 
 #include "utils.h"
 #include "cl_utils.h"
+#include "hybrid.h"
+#include "mm_cpu.h"
+#include "philox.h"
+#include "ref_cache.h"
+#include "tuning.h"
+#include "verify.h"
 
 typedef float value_t;
 
@@ -17,49 +23,231 @@ Matrix createMatrix(int N, int M);
 
 void releaseMatrix(Matrix m);
 
+// -- precision modes --
+
+typedef enum _mm_precision {
+    PREC_F32,       // < float inputs and results
+    PREC_F16,       // < half inputs, float accumulation and results
+    PREC_F64,       // < double inputs and results
+    PREC_I8,        // < int8 inputs (B transposed), int32 results
+    PREC_C64,       // < single precision complex inputs and results
+    PREC_C128       // < double precision complex inputs and results
+} mm_precision;
+
+typedef struct _mm_precision_info {
+    const char* name;       // < the name of the mode on the command line
+    const char* source;     // < the OpenCL program containing the kernel
+    const char* kernel;     // < the OpenCL kernel implementing the mode
+    const char* unit;       // < the unit of performance results
+    size_t in_size;         // < the size of an input element
+    size_t out_size;        // < the size of a result element
+    int ops;                // < the real operations of one multiply-add (8 for complex numbers)
+    size_t group;           // < the work-group edge required by the kernel, 0 if any is fine
+} mm_precision_info;
+
+// the fp64 and complex kernels are generated from the template shared with the CPU engine
+const mm_precision_info PRECISIONS[] = {
+    { "fp32", "mat_mul.cl",         "mat_mul",      "GFLOPS", sizeof(float),   sizeof(float),   2, 0       },
+    { "fp16", "mat_mul.cl",         "mat_mul_f16",  "GFLOPS", sizeof(half_t),  sizeof(float),   2, 0       },
+    { "fp64", "mat_mul_generic.cl", "mat_mul_f64",  "GFLOPS", sizeof(double),  sizeof(double),  2, MM_TILE },
+    { "int8", "mat_mul.cl",         "mat_mul_i8",   "GOPS",   sizeof(int8_t),  sizeof(int32_t), 2, 0       },
+    { "c64",  "mat_mul_generic.cl", "mat_mul_c64",  "GFLOPS", sizeof(float2),  sizeof(float2),  8, MM_TILE },
+    { "c128", "mat_mul_generic.cl", "mat_mul_c128", "GFLOPS", sizeof(double2), sizeof(double2), 8, MM_TILE },
+};
+#define NUM_PRECISIONS 6
+
+// the inputs of a benchmark, in float and in the format of the precision mode
+typedef struct _mm_inputs {
+    Matrix A, B;    // < float versions of the inputs, exactly representable in the precision mode
+                    //   (the real parts for complex modes)
+    void* a;        // < A in the input format
+    void* b;        // < B in the input format (transposed for int8)
+} mm_inputs;
+
+mm_inputs createInputs(mm_precision p, int N);
+
+void releaseInputs(mm_inputs in);
+
+// computes the reference result R = A * B using the CPU engine
+void computeReference(mm_precision p, mm_inputs in, void* R, int N);
+
+// obtains the reference result for the given inputs from the cache or by computing it,
+// returns NULL for sizes verified through Freivalds' check
+void* obtainReference(mm_precision p, mm_inputs in, int N);
+
 // ----------------------
 
 typedef struct _cl_mm_environment {
+    cl_device_id device;
     cl_context context;
     cl_command_queue queue;
+    cl_command_queue transfer_queue;    // < a second queue for overlapping transfers with compute
     cl_program program;
     cl_kernel kernel;    
+    size_t group;                       // < the work-group edge required by kernel, 0 if any
+    cl_program tuned_program;           // < the program of the tuned kernel, if any
+    cl_kernel tuned_kernel;             // < an autotuned fp32 kernel used instead of kernel, if any
+    mm_tuning_config tuning;            // < the configuration of the tuned kernel
+    char device_name[256];
 } cl_mm_environment;
 
-cl_mm_environment createMMEnvironment();
+cl_mm_environment createMMEnvironment(mm_precision p);
 
 void destroyMMEnvironment(cl_mm_environment);
 
+// switches env to the tuned kernel of the given configuration, NULL (or TS=0) restores the
+// default kernel; returns false if the configuration can not be built or run on the device
+bool useTuning(cl_mm_environment* env, const mm_tuning_config* config);
+
+// enqueues the computation of C = A * B with the current kernel of env
+void enqueueMatMul(cl_mm_environment env, int N, cl_mem C, cl_mem A, cl_mem B, cl_uint num_wait, const cl_event* wait, cl_event* event);
+
 int roundUpToMultiple(int N, int B) {
     if ((N % B) == 0) return N;
     return N + (B - (N%B));
 }
 
+// verifies C against the reference R if available, otherwise through Freivalds' check
+mm_error_stats checkResult(mm_precision p, mm_inputs in, void* C, void* R, int N);
+
+// runs the kernel NUM_PIPELINE_RUNS times back-to-back, overlapping the upload of the
+// next input and the download of the previous result with the current computation;
+// returns the effective GFLOPS including all transfers
+double runPipelined(cl_mm_environment env, mm_precision p, int N, mm_inputs in, void* C);
+
+// computes C = A * B (fp32) with the first rows of C computed by the CPU engine and the
+// remaining ones by the device at the same time, split according to the CPU share;
+// returns the combined GFLOPS and updates the share with the balance measured in this run
+double runHybrid(cl_mm_environment env, int N, mm_inputs in, float* C, double* share);
+
+// compares the kernel with fused epilogue (mat_mul_ex) to the plain kernel followed by a separate
+// epilogue pass (fp32), sets the GFLOPS of the fused kernel and returns the verification result
+mm_error_stats runEpilogue(cl_mm_environment env, int N, mm_inputs in, double* gflops);
+
+// explores the configurations of the tuned kernel for all benchmark sizes and records
+// the best one per size bucket in the tuning file
+int runAutotuning(cl_mm_environment* env);
+
+// the number of leading terms dropped from every dot product of the wrong results of the self-test
+#define SELFTEST_MISSING_TERMS 3
+
+// checks that the verification (fp32) accepts the reference result and rejects one missing the
+// first SELFTEST_MISSING_TERMS terms of every dot product, for all sizes verified through
+// Freivalds' check -- the same error is rejected by the full comparison; no device is needed
+int runSelfTest();
+
 // ----------------------
 
 int SIZES[] = { 500, 734, 1024, 1493, 2345, 4001 };
 int NUM_SIZES = 6;
 int NUM_REPETITION = 3;
+int NUM_PIPELINE_RUNS = 10;
+
+// from this size on, results are verified by Freivalds' check instead of a full reference
+int FREIVALDS_THRESHOLD = 2000;
+
+// the seed for generating input matrices (together with N, the key for cached references)
+uint64_t SEED = 0;
 
 // ----------------------
 
 
 int main(int argc, char** argv) {
 
+    // 'parsing' optional benchmark mode and precision
+    //  - latency    ... (default) times the kernel alone, buffers are re-created for every run
+    //  - throughput ... end-to-end throughput of a pipeline keeping buffers alive across runs
+    //  - autotune   ... searches the best kernel configuration per size, used by later fp32 runs
+    //  - hybrid     ... splits the rows of C between the CPU and the device (fp32 only)
+    //  - epilogue   ... fused vs. separate bias / ReLU / clamp epilogues (fp32 only)
+    //  - selftest   ... checks that the verification rejects wrong results (fp32 only)
+    //  - fp32 (default), fp16, fp64, int8, c64, c128 ... the element type of inputs / results
+    bool throughput = false;
+    bool autotune = false;
+    bool hybrid = false;
+    bool epilogue = false;
+    bool selftest = false;
+    mm_precision precision = PREC_F32;
+    for(int a=1; a<argc; a++) {
+        bool known = false;
+        if (!strcmp(argv[a],"throughput")) {
+            throughput = true;
+            known = true;
+        } else if (!strcmp(argv[a],"latency")) {
+            throughput = false;
+            known = true;
+        } else if (!strcmp(argv[a],"autotune")) {
+            autotune = true;
+            known = true;
+        } else if (!strcmp(argv[a],"hybrid")) {
+            hybrid = true;
+            known = true;
+        } else if (!strcmp(argv[a],"epilogue")) {
+            epilogue = true;
+            known = true;
+        } else if (!strcmp(argv[a],"selftest")) {
+            selftest = true;
+            known = true;
+        }
+        for(int p=0; p<NUM_PRECISIONS; p++) {
+            if (strcmp(argv[a],PRECISIONS[p].name)) continue;
+            precision = (mm_precision)p;
+            known = true;
+        }
+        if (!known) {
+            printf("Usage: %s [latency|throughput|autotune|hybrid|epilogue|selftest] [fp32|fp16|fp64|int8|c64|c128]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (autotune && precision != PREC_F32) {
+        printf("Autotuning is only supported for fp32\n");
+        return EXIT_FAILURE;
+    }
+    if ((hybrid || epilogue || selftest) && precision != PREC_F32) {
+        printf("The %s mode is only supported for fp32\n", (hybrid) ? "hybrid" : (epilogue) ? "epilogue" : "selftest");
+        return EXIT_FAILURE;
+    }
+    if (selftest) {
+        printf("Benchmark mode: selftest (verification only), precision: fp32\n");
+        return runSelfTest();
+    }
+    const mm_precision_info info = PRECISIONS[precision];
+    const char* mode = (hybrid) ? "hybrid (CPU + device, incl. transfers)" : (epilogue) ? "epilogue (fused vs. separate, kernel only)"
+                     : (throughput) ? "throughput (incl. transfers)" : "latency (kernel only)";
+    printf("Benchmark mode: %s, precision: %s\n", mode, info.name);
+
 
     // ---------- setup ----------
 
-    cl_mm_environment env = createMMEnvironment();
+    cl_mm_environment env = createMMEnvironment(precision);
+
+    if (autotune) {
+        int res = runAutotuning(&env);
+        destroyMMEnvironment(env);
+        return res;
+    }
+
+    // tuned kernel configurations from previous autotuning runs (fp32 only)
+    mm_tuning_table tuning = { NULL, 0 };
+    if (precision == PREC_F32) {
+        tuning = loadTuningTable(TUNING_FILE);
+    }
+
+    // CPU / device splits learned in previous hybrid runs
+    mm_hybrid_table splits = { NULL, 0 };
+    if (hybrid) {
+        splits = loadHybridTable(HYBRID_FILE);
+    }
 
     
     // ------ benchmarking -------
 
-    srand(0);
     printf("Start benchmarking ...\n");
 
     // the best performance
     double mflops[NUM_SIZES];
     bool allValid = true;
+    double worstError = 0;
 
     // for each size ...
     for(int i=0; i<NUM_SIZES; i++) {
@@ -71,56 +259,78 @@ int main(int argc, char** argv) {
         
         printf("\nSetting up N=%d ..\n", N);
         
-        // create input
-        restrict Matrix A = createMatrix(N,N);
-        restrict Matrix B = createMatrix(N,N);
-        restrict Matrix C = createMatrix(N,N);
-        restrict Matrix R = createMatrix(N,N);
-
-        // fill matrix
-        for(int i = 0; i<N; i++) {
-            for(int j = 0; j<N; j++) {
-                A[i*N+j] = rand() / (float)RAND_MAX + 0.5;      // some matrix
-                B[i*N+j] = rand() / (float)RAND_MAX + 0.5;      // some other matrix
-            }
+        // create input (in parallel, the result is independent of the number of threads)
+        mm_inputs in = createInputs(precision, N);
+        void* C = malloc(info.out_size * N * N);
+        void* R = obtainReference(precision, in, N);
+
+        // pick the tuned kernel for this size, if there is one
+        const mm_tuning_config* config = lookupTuning(&tuning, env.device_name, sizeBucket(N));
+        if (config && config->ts > 0 && useTuning(&env, config)) {
+            printf("\tUsing tuned kernel: TS=%d, WPT=%d, VW=%d, UNROLL=%d, USE_LOCAL=%d\n",
+                config->ts, config->wpt, config->vw, config->unroll, config->use_local);
+        } else {
+            useTuning(&env, NULL);
         }
 
-        // compute reference results
-        double cpu_start = now();
-        #pragma omp parallel for
-        for(int i = 0; i<N; i++) {
-            // a slightly optimized CPU version of MM
-            for(int j = 0; j<N; j++) {
-                R[i*N+j] = 0;
-            }
-            for(int k=0; k<N; k++) {
-                for(int j=0; j<N; j++) {
-                    R[i*N+j] += A[i*N+k] * B[k*N+j];
-                }
+        // in throughput mode the whole pipeline forms a single measurement
+        if (throughput && !hybrid && !epilogue) {
+            memset(C,0,info.out_size * N * N);
+            mflops[i] = runPipelined(env, precision, N, in, C);
+            mm_error_stats stats = checkResult(precision, in, C, R, N);
+            printf("\tRuns: %d, effective %s: %5.3f, Verification: ", NUM_PIPELINE_RUNS, info.unit, mflops[i]);
+            printErrorStats(stats);
+            printf("\n");
+            if (!stats.success) allValid = false;
+            if (worstError < stats.max_rel_error) worstError = stats.max_rel_error;
+        }
+
+        // in hybrid mode, every run refines the split for the next one
+        if (hybrid) {
+            double share = lookupShare(&splits, env.device_name, sizeBucket(N));
+            for(int r=0; r<NUM_REPETITION; r++) {
+                memset(C,0,info.out_size * N * N);
+                double gflops = runHybrid(env, N, in, C, &share);
+                mm_error_stats stats = checkResult(precision, in, C, R, N);
+                printf("%s: %5.3f, Verification: ", info.unit, gflops);
+                printErrorStats(stats);
+                printf("\n");
+                if (!stats.success) allValid = false;
+                if (worstError < stats.max_rel_error) worstError = stats.max_rel_error;
+                if (mflops[i] < gflops) mflops[i] = gflops;
             }
+            updateShare(&splits, env.device_name, sizeBucket(N), share);
+        }
+
+        // the epilogue comparison is a single measurement as well
+        if (epilogue) {
+            mm_error_stats stats = runEpilogue(env, N, in, &mflops[i]);
+            printf("%s: %5.3f, Verification: ", info.unit, mflops[i]);
+            printErrorStats(stats);
+            printf("\n");
+            if (!stats.success) allValid = false;
+            if (worstError < stats.max_rel_error) worstError = stats.max_rel_error;
         }
-        double cpu_end = now();
-        double cpu_duration = cpu_end - cpu_start;
-        printf("\tCPU setup took %2.3fs / %5.3f GFLOPS\n", cpu_duration, (2.0*N*N*N) / cpu_duration / 1e9);
 
         // repeat X times ..
-        for(int r=0; r<NUM_REPETITION; r++) {
+        for(int r=0; !throughput && !hybrid && !epilogue && r<NUM_REPETITION; r++) {
 
             // clear result
-            memset(C,0,sizeof(value_t) * N * N);
+            memset(C,0,info.out_size * N * N);
     
             // create buffer on device
             cl_int err;
-            cl_mem devMatA = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * N * sizeof(value_t), NULL, &err);
+            cl_mem devMatA = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * N * info.in_size, NULL, &err);
             CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
-            cl_mem devMatB = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * N * sizeof(value_t), NULL, &err);
+            cl_mem devMatB = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * N * info.in_size, NULL, &err);
             CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
-            cl_mem devMatC = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, N * N * sizeof(value_t), NULL, &err);
+            cl_mem devMatC = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, N * N * info.out_size, NULL, &err);
+            CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
 
             // transfer data
-            err = clEnqueueWriteBuffer(env.queue, devMatA, CL_TRUE, 0, N * N * sizeof(value_t), A, 0, NULL, NULL);
+            err = clEnqueueWriteBuffer(env.queue, devMatA, CL_TRUE, 0, N * N * info.in_size, in.a, 0, NULL, NULL);
             CLU_ERRCHECK(err, "Failed to write matrix A to device");
-            err = clEnqueueWriteBuffer(env.queue, devMatB, CL_TRUE, 0,  N * N * sizeof(value_t), B, 0, NULL, NULL);
+            err = clEnqueueWriteBuffer(env.queue, devMatB, CL_TRUE, 0,  N * N * info.in_size, in.b, 0, NULL, NULL);
             CLU_ERRCHECK(err, "Failed to write matrix B to device");
 
 
@@ -129,19 +339,9 @@ int main(int argc, char** argv) {
 
             // -- run computation --
 
-            // set arguments and execute kernel
-            size_t S = roundUpToMultiple(N,32);
-            size_t size[2] = {S, S};
-            cluSetKernelArguments(env.kernel, 4,
-                sizeof(cl_mem), (void *)&devMatC,
-                sizeof(cl_mem), (void *)&devMatA,
-                sizeof(cl_mem), (void *)&devMatB,
-                sizeof(int), &N
-            );
-
-            // submit kernel
+            // set arguments and submit kernel
             cl_event event;
-            CLU_ERRCHECK(clEnqueueNDRangeKernel(env.queue, env.kernel, 2, NULL, size, NULL, 0, NULL, &event), "Failed to enqueue 2D kernel");
+            enqueueMatMul(env, N, devMatC, devMatA, devMatB, 0, NULL, &event);
 
             // wait for kernel
             clWaitForEvents(1,&event);
@@ -164,27 +364,22 @@ int main(int argc, char** argv) {
             CLU_ERRCHECK(clReleaseEvent(event), "Failed to release event");
 
             // copy results back to host
-            err = clEnqueueReadBuffer(env.queue, devMatC, CL_TRUE, 0, N * N * sizeof(value_t), C, 0, NULL, NULL);
+            err = clEnqueueReadBuffer(env.queue, devMatC, CL_TRUE, 0, N * N * info.out_size, C, 0, NULL, NULL);
             CLU_ERRCHECK(err, "Failed reading back result");
 
             // check result
-            bool success = true;
-            for(int i = 0; i<N; i++) {
-                for(int j = 0; j<N; j++) {
-                    // if result is close enough, we are fine
-                    if (fabsf(C[i*N+j]-R[i*N+j]) < 1e-10) continue;
-                    //printf("Wrong result for (%d,%d): %f vs. %f\n", i,j,C[i*N+j],R[i*N+j]);
-                    success = false;
-                }
-            }
+            mm_error_stats stats = checkResult(precision, in, C, R, N);
             
             
             double seconds = duration / 1e9;
-            double curMflops = (2.0*N*N*N) / seconds / 1e9;
-            printf("\tDuration: %2.3fs, GFLOPS: %5.3f, Verification: %s\n", seconds, curMflops, (success)?"OK":"FAILED");
+            double curMflops = ((double)info.ops*N*N*N) / seconds / 1e9;
+            printf("\tDuration: %2.3fs, %s: %5.3f, Verification: ", seconds, info.unit, curMflops);
+            printErrorStats(stats);
+            printf("\n");
             
             // keep track of overall success
-            if (!success) allValid = false;
+            if (!stats.success) allValid = false;
+            if (worstError < stats.max_rel_error) worstError = stats.max_rel_error;
             
             // record best performance
             if (mflops[i] < curMflops) mflops[i] = curMflops;
@@ -202,20 +397,26 @@ int main(int argc, char** argv) {
 
 
         // free host memory
-        releaseMatrix(A);
-        releaseMatrix(B);
-        releaseMatrix(C);
-        releaseMatrix(R);
+        releaseInputs(in);
+        free(C);
+        free(R);
 
     }
 
     // cleanup
     
+    if (hybrid) {
+        storeHybridTable(&splits, HYBRID_FILE);
+        printf("\nLearned CPU shares written to %s\n", HYBRID_FILE);
+    }
+    releaseHybridTable(splits);
+    releaseTuningTable(tuning);
     destroyMMEnvironment(env);
 
     // finally: report overall result
     printf("\n");
     printf("-------------------------------------------------\n");
+    printf("Largest relative error: %.2e\n", worstError);
         
     if (!allValid) {
         
@@ -229,7 +430,7 @@ int main(int argc, char** argv) {
             prod *= mflops[i];
         }
         double score = pow(prod,1.0/NUM_SIZES);
-        printf("Overall result: %5.3f GFLOPS\n", score);
+        printf("Overall result: %5.3f %s\n", score, info.unit);
         
     }
     printf("-------------------------------------------------\n");
@@ -248,18 +449,707 @@ void releaseMatrix(Matrix m) {
     free(m);
 }
 
-cl_mm_environment createMMEnvironment() {
+mm_inputs createInputs(mm_precision p, int N) {
+    mm_inputs in;
+    long long size = (long long)N * N;
+    in.A = createMatrix(N,N);
+    in.B = createMatrix(N,N);
+
+    // integer inputs cover the full int8 range, all others are around 1
+    float lo = (p == PREC_I8) ? -128.0f : 0.5f;
+    float hi = (p == PREC_I8) ?  128.0f : 1.5f;
+    fillMatrixRandom(in.A, N, N, SEED, 0, lo, hi);      // some matrix
+    fillMatrixRandom(in.B, N, N, SEED, 1, lo, hi);      // some other matrix
+
+    switch(p) {
+    case PREC_F32:
+        in.a = in.A;
+        in.b = in.B;
+        break;
+    case PREC_F16:
+        // round to half, the float versions keep the rounded values for the verification
+        in.a = malloc(sizeof(half_t) * size);
+        in.b = malloc(sizeof(half_t) * size);
+        convertToHalf(in.A, in.a, size);
+        convertToHalf(in.B, in.b, size);
+        convertFromHalf(in.a, in.A, size);
+        convertFromHalf(in.b, in.B, size);
+        break;
+    case PREC_F64: {
+        double* a = malloc(sizeof(double) * size);
+        double* b = malloc(sizeof(double) * size);
+        #pragma omp parallel for schedule(static)
+        for(long long i = 0; i<size; i++) {
+            a[i] = in.A[i];
+            b[i] = in.B[i];
+        }
+        in.a = a;
+        in.b = b;
+        break;
+    }
+    case PREC_C64:
+    case PREC_C128: {
+        // the imaginary parts come from separate streams
+        Matrix Ai = createMatrix(N,N);
+        Matrix Bi = createMatrix(N,N);
+        fillMatrixRandom(Ai, N, N, SEED, 2, lo, hi);
+        fillMatrixRandom(Bi, N, N, SEED, 3, lo, hi);
+        in.a = malloc(PRECISIONS[p].in_size * size);
+        in.b = malloc(PRECISIONS[p].in_size * size);
+        #pragma omp parallel for schedule(static)
+        for(long long i = 0; i<size; i++) {
+            if (p == PREC_C64) {
+                ((float2*)in.a)[i] = (float2){ in.A[i], Ai[i] };
+                ((float2*)in.b)[i] = (float2){ in.B[i], Bi[i] };
+            } else {
+                ((double2*)in.a)[i] = (double2){ in.A[i], Ai[i] };
+                ((double2*)in.b)[i] = (double2){ in.B[i], Bi[i] };
+            }
+        }
+        releaseMatrix(Ai);
+        releaseMatrix(Bi);
+        break;
+    }
+    case PREC_I8: {
+        int8_t* a = malloc(size);
+        int8_t* b = malloc(size);
+        #pragma omp parallel for schedule(static)
+        for(long long i = 0; i<size; i++) {
+            in.A[i] = floorf(in.A[i]);
+            in.B[i] = floorf(in.B[i]);
+            a[i] = (int8_t)in.A[i];
+            b[i] = (int8_t)in.B[i];
+        }
+        // B is handed over transposed
+        in.a = a;
+        in.b = malloc(size);
+        transposeI8(b, in.b, N, N);
+        free(b);
+        break;
+    }
+    }
+    return in;
+}
+
+void releaseInputs(mm_inputs in) {
+    if (in.a != in.A) free(in.a);
+    if (in.b != in.B) free(in.b);
+    releaseMatrix(in.A);
+    releaseMatrix(in.B);
+}
+
+void computeReference(mm_precision p, mm_inputs in, void* R, int N) {
+    switch(p) {
+    case PREC_F32: gemmF32(R, in.a, in.b, N, N, N); return;
+    case PREC_F16: gemmF16(R, in.a, in.b, N, N, N); return;
+    case PREC_F64: gemmF64(R, in.a, in.b, N, N, N); return;
+    case PREC_I8:  gemmI8(R, in.a, in.b, N, N, N);  return;
+    case PREC_C64:  gemmC64(R, in.a, in.b, N, N, N);  return;
+    case PREC_C128: gemmC128(R, in.a, in.b, N, N, N); return;
+    }
+}
+
+void* obtainReference(mm_precision p, mm_inputs in, int N) {
+    const mm_precision_info info = PRECISIONS[p];
+    if (N >= FREIVALDS_THRESHOLD) {
+        printf("\tSkipping reference, verifying using Freivalds' check\n");
+        return NULL;
+    }
+
+    void* R = malloc(info.out_size * N * N);
+    if (loadReference(R, info.out_size, info.name, N, SEED)) {
+        printf("\tLoaded reference result from cache\n");
+        return R;
+    }
+
+    double cpu_start = now();
+    computeReference(p, in, R, N);
+    double cpu_end = now();
+    double cpu_duration = cpu_end - cpu_start;
+    printf("\tCPU setup took %2.3fs / %5.3f %s\n", cpu_duration, ((double)info.ops*N*N*N) / cpu_duration / 1e9, info.unit);
+    storeReference(R, info.out_size, info.name, N, SEED);
+    return R;
+}
+
+// widens n floats to doubles
+double* toDoubles(const float* in, long long n) {
+    double* res = malloc(sizeof(double) * n);
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i<n; i++) {
+        res[i] = in[i];
+    }
+    return res;
+}
+
+mm_error_stats checkResult(mm_precision p, mm_inputs in, void* C, void* R, int N) {
+    // results are accepted within a tolerance scaled by N, any summation order is fine
+    switch(p) {
+    case PREC_F64:
+        if (R) return verifyWithReferenceF64(C, R, N);
+        return verifyFreivaldsF64(in.a, in.b, C, N, N);
+    case PREC_I8:
+        if (R) return verifyWithReferenceI32(C, R, N);
+        return verifyFreivaldsI8(in.a, in.b, C, N, N);
+    case PREC_C64: {
+        // checked in double precision, the values are exactly representable
+        double* a = toDoubles(in.a, 2*N*N);
+        double* b = toDoubles(in.b, 2*N*N);
+        double* c = toDoubles(C, 2*N*N);
+        double* r = (R) ? toDoubles(R, 2*N*N) : NULL;
+        mm_error_stats res = (r) ? verifyWithReferenceComplex(c, r, N, FLT_EPSILON) : verifyFreivaldsComplex(a, b, c, N, FLT_EPSILON, N);
+        free(a);
+        free(b);
+        free(c);
+        free(r);
+        return res;
+    }
+    case PREC_C128:
+        // double2 matrices are interleaved doubles already
+        if (R) return verifyWithReferenceComplex(C, R, N, DBL_EPSILON);
+        return verifyFreivaldsComplex(in.a, in.b, C, N, DBL_EPSILON, N);
+    default:
+        // fp16 results are compared with a reference computed from the same rounded inputs
+        if (R) return verifyWithReference(C, R, N);
+        return verifyFreivalds(in.A, in.B, C, N, N);
+    }
+}
+
+// enqueues a non-blocking upload of A and B on the transfer queue once "wait" (if any) is complete
+void enqueueUpload(cl_mm_environment env, cl_mem devA, cl_mem devB, void* A, void* B, size_t bytes, cl_event wait, cl_event* done) {
+    CLU_ERRCHECK(clEnqueueWriteBuffer(env.transfer_queue, devA, CL_FALSE, 0, bytes, A, (wait) ? 1 : 0, (wait) ? &wait : NULL, NULL), "Failed to write matrix A to device");
+    CLU_ERRCHECK(clEnqueueWriteBuffer(env.transfer_queue, devB, CL_FALSE, 0, bytes, B, 0, NULL, done), "Failed to write matrix B to device");
+}
+
+double runPipelined(cl_mm_environment env, mm_precision p, int N, mm_inputs in, void* C) {
+
+    // two slots of device buffers -- while one is computed, the other is filled / drained
+    size_t bytes = N * N * PRECISIONS[p].in_size;
+    size_t out_bytes = N * N * PRECISIONS[p].out_size;
+    cl_mem devA[2], devB[2], devC[2];
+    for(int s=0; s<2; s++) {
+        cl_int err;
+        devA[s] = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+        devB[s] = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+        devC[s] = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, out_bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
+    }
+
+    // the per-slot events of the last upload, computation and download
+    cl_event written[2] = { NULL, NULL };
+    cl_event computed[2] = { NULL, NULL };
+    cl_event read[2] = { NULL, NULL };
+
+    double start = now();
+
+    enqueueUpload(env, devA[0], devB[0], in.a, in.b, bytes, NULL, &written[0]);
+    for(int r=0; r<NUM_PIPELINE_RUNS; r++) {
+        int s = r % 2;
+
+        // compute run r as soon as its inputs are there and the previous result in this slot is drained
+        cl_event deps[2] = { written[s], read[s] };
+        if (computed[s]) CLU_ERRCHECK(clReleaseEvent(computed[s]), "Failed to release event");
+        enqueueMatMul(env, N, devC[s], devA[s], devB[s], (read[s]) ? 2 : 1, deps, &computed[s]);
+        CLU_ERRCHECK(clFlush(env.queue), "Failed to flush command queue");
+
+        // the upload for the next run has to be queued before the download of this one,
+        // otherwise the in-order transfer queue would wait for the current computation
+        if (r+1 < NUM_PIPELINE_RUNS) {
+            int n = (r+1) % 2;
+            if (written[n]) CLU_ERRCHECK(clReleaseEvent(written[n]), "Failed to release event");
+            enqueueUpload(env, devA[n], devB[n], in.a, in.b, bytes, computed[n], &written[n]);
+        }
+
+        // drain the result of run r
+        if (read[s]) CLU_ERRCHECK(clReleaseEvent(read[s]), "Failed to release event");
+        CLU_ERRCHECK(clEnqueueReadBuffer(env.transfer_queue, devC[s], CL_FALSE, 0, out_bytes, C, 1, &computed[s], &read[s]), "Failed reading back result");
+        CLU_ERRCHECK(clFlush(env.transfer_queue), "Failed to flush transfer queue");
+    }
+
+    CLU_ERRCHECK(clFinish(env.queue), "Failed to wait for command queue completion");
+    CLU_ERRCHECK(clFinish(env.transfer_queue), "Failed to wait for transfer queue completion");
+    double duration = now() - start;
+
+    // cleanup
+    for(int s=0; s<2; s++) {
+        if (written[s]) CLU_ERRCHECK(clReleaseEvent(written[s]), "Failed to release event");
+        if (computed[s]) CLU_ERRCHECK(clReleaseEvent(computed[s]), "Failed to release event");
+        if (read[s]) CLU_ERRCHECK(clReleaseEvent(read[s]), "Failed to release event");
+        CLU_ERRCHECK(clReleaseMemObject(devA[s]), "Failed to release Matrix A");
+        CLU_ERRCHECK(clReleaseMemObject(devB[s]), "Failed to release Matrix B");
+        CLU_ERRCHECK(clReleaseMemObject(devC[s]), "Failed to release Matrix C");
+    }
+
+    return (NUM_PIPELINE_RUNS * (double)PRECISIONS[p].ops*N*N*N) / duration / 1e9;
+}
+
+double runHybrid(cl_mm_environment env, int N, mm_inputs in, float* C, double* share) {
+    int cpu_rows = hybridCPURows(*share, N);
+    int dev_rows = N - cpu_rows;
+    size_t row_bytes = sizeof(float) * N;
+
+    // the device computes rows cpu_rows.. of C, which need the same rows of A and all of B
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(env.program, "mat_mul_acc", &err);
+    CLU_ERRCHECK(err, "Failed to create mat_mul_acc kernel from program");
+    cl_mem devA = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, dev_rows * row_bytes, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+    cl_mem devB = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N * row_bytes, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+    cl_mem devC = clCreateBuffer(env.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, dev_rows * row_bytes, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
+
+    int accumulate = 0;
+    cluSetKernelArguments(kernel, 7,
+        sizeof(cl_mem), (void *)&devC,
+        sizeof(cl_mem), (void *)&devA,
+        sizeof(cl_mem), (void *)&devB,
+        sizeof(int), &dev_rows,
+        sizeof(int), &N,
+        sizeof(int), &N,
+        sizeof(int), &accumulate
+    );
+    size_t global[2] = { roundUpToMultiple(N,32), roundUpToMultiple(dev_rows,32) };
+
+    double start = now();
+
+    // the device part is queued first and runs while the CPU computes its rows
+    cl_event uploaded, downloaded;
+    CLU_ERRCHECK(clEnqueueWriteBuffer(env.queue, devA, CL_FALSE, 0, dev_rows * row_bytes, in.A + (size_t)cpu_rows * N, 0, NULL, &uploaded), "Failed to write matrix A to device");
+    CLU_ERRCHECK(clEnqueueWriteBuffer(env.queue, devB, CL_FALSE, 0, N * row_bytes, in.B, 0, NULL, NULL), "Failed to write matrix B to device");
+    CLU_ERRCHECK(clEnqueueNDRangeKernel(env.queue, kernel, 2, NULL, global, NULL, 0, NULL, NULL), "Failed to enqueue 2D kernel");
+    CLU_ERRCHECK(clEnqueueReadBuffer(env.queue, devC, CL_FALSE, 0, dev_rows * row_bytes, C + (size_t)cpu_rows * N, 0, NULL, &downloaded), "Failed reading back result");
+    CLU_ERRCHECK(clFlush(env.queue), "Failed to flush command queue");
+
+    double cpu_start = now();
+    gemmF32(C, in.A, in.B, cpu_rows, N, N);
+    double cpu_seconds = now() - cpu_start;
+
+    CLU_ERRCHECK(clWaitForEvents(1, &downloaded), "Failed to wait for result");
+    double seconds = now() - start;
+
+    // the device time covers the whole in-order sequence from the first upload to the download
+    cl_ulong dev_start, dev_end;
+    clGetEventProfilingInfo(uploaded, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &dev_start, NULL);
+    clGetEventProfilingInfo(downloaded, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &dev_end, NULL);
+    double dev_seconds = (dev_end - dev_start) / 1e9;
+
+    printf("\tCPU: %d rows in %2.3fs, device: %d rows in %2.3fs, total: %2.3fs, ", cpu_rows, cpu_seconds, dev_rows, dev_seconds, seconds);
+
+    // the side finishing first gets more rows next time (timer resolution permitting)
+    if (cpu_seconds > 0 && dev_seconds > 0) {
+        *share = learnShare(*share, balancedShare(cpu_rows / cpu_seconds, dev_rows / dev_seconds));
+    }
+
+    CLU_ERRCHECK(clReleaseEvent(uploaded), "Failed to release event");
+    CLU_ERRCHECK(clReleaseEvent(downloaded), "Failed to release event");
+    CLU_ERRCHECK(clReleaseMemObject(devA), "Failed to release Matrix A");
+    CLU_ERRCHECK(clReleaseMemObject(devB), "Failed to release Matrix B");
+    CLU_ERRCHECK(clReleaseMemObject(devC), "Failed to release Matrix C");
+    CLU_ERRCHECK(clReleaseKernel(kernel), "Failed to release kernel");
+
+    return (2.0*N*N*N) / seconds / 1e9;
+}
+
+// waits for the given kernel event and returns its execution time in seconds
+double kernelSeconds(cl_event event) {
+    CLU_ERRCHECK(clWaitForEvents(1,&event), "Failed to wait for kernel");
+    cl_int status;
+    clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+    if (status < 0) {
+        CLU_ERRCHECK(-status, "Kernel failed to execute succesfully.");
+    }
+    cl_ulong start, end;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+    CLU_ERRCHECK(clReleaseEvent(event), "Failed to release event");
+    return (end - start) / 1e9;
+}
+
+// sets the arguments of the epilogue kernel, starting at argument "first"
+void setEpilogueArguments(cl_kernel kernel, int first, const mm_epilogue* ep, cl_mem bias) {
+    CLU_ERRCHECK(clSetKernelArg(kernel, first+0, sizeof(float), &ep->alpha), "Failed to set alpha");
+    CLU_ERRCHECK(clSetKernelArg(kernel, first+1, sizeof(float), &ep->beta), "Failed to set beta");
+    CLU_ERRCHECK(clSetKernelArg(kernel, first+2, sizeof(cl_mem), (ep->bias) ? &bias : NULL), "Failed to set bias");
+    CLU_ERRCHECK(clSetKernelArg(kernel, first+3, sizeof(int), &ep->relu), "Failed to set relu");
+    CLU_ERRCHECK(clSetKernelArg(kernel, first+4, sizeof(float), &ep->lo), "Failed to set lo");
+    CLU_ERRCHECK(clSetKernelArg(kernel, first+5, sizeof(float), &ep->hi), "Failed to set hi");
+}
+
+// the number of rows of C verified in epilogue mode, a full reference is too costly for large N
+#define EPILOGUE_CHECK_ROWS 16
+
+mm_error_stats runEpilogue(cl_mm_environment env, int N, mm_inputs in, double* gflops) {
+    size_t bytes = sizeof(float) * N * N;
+
+    // products are around N, the epilogue scales them to around 1 and shifts them, such that
+    // the ReLU and the clamping affect a part of the elements each
+    float* C0 = malloc(bytes);
+    float* bias = malloc(sizeof(float) * N);
+    fillMatrixRandom(C0, N, N, SEED, 2, 0.5f, 1.5f);
+    fillMatrixRandom(bias, 1, N, SEED, 3, -2.0f, 0.0f);
+    mm_epilogue ep = defaultEpilogue();
+    ep.alpha = 1.0f / N;
+    ep.beta = 0.5f;
+    ep.bias = bias;
+    ep.relu = 1;
+    ep.hi = 0.75f;
+
+    cl_int err;
+    cl_mem devA = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, bytes, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+    cl_mem devB = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, bytes, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+    cl_mem devC = clCreateBuffer(env.context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
+    cl_mem devT = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, bytes, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for the intermediate product");
+    cl_mem devBias = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * N, bias, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for the bias");
+    CLU_ERRCHECK(clEnqueueWriteBuffer(env.queue, devA, CL_TRUE, 0, bytes, in.A, 0, NULL, NULL), "Failed to write matrix A to device");
+    CLU_ERRCHECK(clEnqueueWriteBuffer(env.queue, devB, CL_TRUE, 0, bytes, in.B, 0, NULL, NULL), "Failed to write matrix B to device");
+
+    cl_kernel fused = clCreateKernel(env.program, "mat_mul_ex", &err);
+    CLU_ERRCHECK(err, "Failed to create mat_mul_ex kernel from program");
+    cl_kernel separate = clCreateKernel(env.program, "mat_mul_epilogue", &err);
+    CLU_ERRCHECK(err, "Failed to create mat_mul_epilogue kernel from program");
+    cluSetKernelArguments(fused, 4,
+        sizeof(cl_mem), (void *)&devC,
+        sizeof(cl_mem), (void *)&devA,
+        sizeof(cl_mem), (void *)&devB,
+        sizeof(int), &N
+    );
+    setEpilogueArguments(fused, 4, &ep, devBias);
+    cluSetKernelArguments(separate, 3,
+        sizeof(cl_mem), (void *)&devC,
+        sizeof(cl_mem), (void *)&devT,
+        sizeof(int), &N
+    );
+    setEpilogueArguments(separate, 3, &ep, devBias);
+
+    // the separate passes use the plain kernel the fused one is derived from
+    cl_mm_environment plain = env;
+    plain.tuned_kernel = NULL;
+    size_t size[2] = { roundUpToMultiple(N,32), roundUpToMultiple(N,32) };
+
+    double best_fused = INFINITY, best_gemm = INFINITY, best_pass = INFINITY;
+    for(int r=0; r<NUM_REPETITION; r++) {
+        cl_event event;
+
+        // C is updated in place, every run starts from the same previous C
+        CLU_ERRCHECK(clEnqueueWriteBuffer(env.queue, devC, CL_TRUE, 0, bytes, C0, 0, NULL, NULL), "Failed to write matrix C to device");
+        enqueueMatMul(plain, N, devT, devA, devB, 0, NULL, &event);
+        double gemm = kernelSeconds(event);
+        CLU_ERRCHECK(clEnqueueNDRangeKernel(env.queue, separate, 2, NULL, size, NULL, 0, NULL, &event), "Failed to enqueue 2D kernel");
+        double pass = kernelSeconds(event);
+        if (gemm + pass < best_gemm + best_pass) {
+            best_gemm = gemm;
+            best_pass = pass;
+        }
+
+        CLU_ERRCHECK(clEnqueueWriteBuffer(env.queue, devC, CL_TRUE, 0, bytes, C0, 0, NULL, NULL), "Failed to write matrix C to device");
+        CLU_ERRCHECK(clEnqueueNDRangeKernel(env.queue, fused, 2, NULL, size, NULL, 0, NULL, &event), "Failed to enqueue 2D kernel");
+        double seconds = kernelSeconds(event);
+        if (seconds < best_fused) best_fused = seconds;
+    }
+    float* C = malloc(bytes);
+    CLU_ERRCHECK(clEnqueueReadBuffer(env.queue, devC, CL_TRUE, 0, bytes, C, 0, NULL, NULL), "Failed reading back result");
+
+    printf("\tFused: %2.3fms, separate: %2.3fms (GEMM %2.3fms + epilogue %2.3fms), speedup: %.2fx, ",
+        best_fused*1e3, (best_gemm+best_pass)*1e3, best_gemm*1e3, best_pass*1e3, (best_gemm+best_pass)/best_fused);
+    *gflops = (2.0*N*N*N) / best_fused / 1e9;
+
+    // the reference for a sample of rows, errors are relative to the magnitude of the summed terms
+    int rows = (N < EPILOGUE_CHECK_ROWS) ? N : EPILOGUE_CHECK_ROWS;
+    float* As = malloc(sizeof(float) * rows * N);
+    float* R = malloc(sizeof(float) * rows * N);
+    float* P = malloc(sizeof(float) * rows * N);
+    for(int s=0; s<rows; s++) {
+        long long i = (long long)s * N / rows;
+        memcpy(As + (long long)s*N, in.A + i*N, sizeof(float) * N);
+        memcpy(R + (long long)s*N, C0 + i*N, sizeof(float) * N);
+    }
+    gemmF32Ex(R, As, in.B, rows, N, N, &ep);
+    gemmF32(P, As, in.B, rows, N, N);
+
+    mm_error_stats stats;
+    stats.tolerance = verifyTolerance(N);
+    stats.max_rel_error = 0;
+    stats.mean_rel_error = 0;
+    stats.max_ulps = -1;
+    stats.num_failed = 0;
+    for(int s=0; s<rows; s++) {
+        long long i = (long long)s * N / rows;
+        for(long long j=0; j<N; j++) {
+            double scale = fabs(ep.alpha * P[s*N+j]) + fabs(ep.beta * C0[i*N+j]) + fabs(bias[j]);
+            double err = fabs(C[i*N+j] - R[s*N+j]) / scale;
+            if (!(err <= stats.tolerance)) stats.num_failed++;
+            if (err != err) err = INFINITY;
+            if (err > stats.max_rel_error) stats.max_rel_error = err;
+            stats.mean_rel_error += err / ((double)rows * N);
+        }
+    }
+    stats.success = (stats.num_failed == 0);
+
+    // cleanup
+    CLU_ERRCHECK(clReleaseKernel(fused), "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseKernel(separate), "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseMemObject(devA), "Failed to release Matrix A");
+    CLU_ERRCHECK(clReleaseMemObject(devB), "Failed to release Matrix B");
+    CLU_ERRCHECK(clReleaseMemObject(devC), "Failed to release Matrix C");
+    CLU_ERRCHECK(clReleaseMemObject(devT), "Failed to release intermediate product");
+    CLU_ERRCHECK(clReleaseMemObject(devBias), "Failed to release bias");
+    free(C0);
+    free(C);
+    free(bias);
+    free(As);
+    free(R);
+    free(P);
+    return stats;
+}
+
+// runs the current kernel of env NUM_REPETITION times, returns the best kernel time in seconds
+double timeKernel(cl_mm_environment env, int N, cl_mem C, cl_mem A, cl_mem B) {
+    double best = INFINITY;
+    for(int r=0; r<NUM_REPETITION; r++) {
+        cl_event event;
+        enqueueMatMul(env, N, C, A, B, 0, NULL, &event);
+        CLU_ERRCHECK(clWaitForEvents(1,&event), "Failed to wait for kernel");
+        cl_int status;
+        clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+        if (status < 0) {
+            CLU_ERRCHECK(-status, "Kernel failed to execute succesfully.");
+        }
+        cl_ulong start, end;
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+        CLU_ERRCHECK(clReleaseEvent(event), "Failed to release event");
+        if ((end - start) / 1e9 < best) best = (end - start) / 1e9;
+    }
+    return best;
+}
+
+int runAutotuning(cl_mm_environment* env) {
+    printf("Autotuning on %s ...\n", env->device_name);
+
+    mm_tuning_table table = loadTuningTable(TUNING_FILE);
+
+    // several benchmark sizes may fall into the same bucket, the fastest one wins
+    double bucket_gflops[64] = { 0 };
+
+    for(int i=0; i<NUM_SIZES; i++) {
+        int N = SIZES[i];
+        int bucket = sizeBucket(N);
+        printf("\nTuning N=%d (bucket %d) ..\n", N, bucket);
+
+        mm_inputs in = createInputs(PREC_F32, N);
+        float* C = malloc(sizeof(float) * N * N);
+        void* R = obtainReference(PREC_F32, in, N);
+
+        cl_int err;
+        size_t bytes = sizeof(float) * N * N;
+        cl_mem devA = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+        cl_mem devB = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+        cl_mem devC = clCreateBuffer(env->context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
+        CLU_ERRCHECK(clEnqueueWriteBuffer(env->queue, devA, CL_TRUE, 0, bytes, in.a, 0, NULL, NULL), "Failed to write matrix A to device");
+        CLU_ERRCHECK(clEnqueueWriteBuffer(env->queue, devB, CL_TRUE, 0, bytes, in.b, 0, NULL, NULL), "Failed to write matrix B to device");
+
+        // the default kernel is the baseline to beat, it is marked by TS=0
+        mm_tuning_config best = { 0, 0, 0, 0, 0 };
+        useTuning(env, NULL);
+        double best_gflops = (2.0*N*N*N) / timeKernel(*env, N, devC, devA, devB) / 1e9;
+        printf("\tdefault kernel: %8.3f GFLOPS\n", best_gflops);
+        double default_gflops = best_gflops;
+
+        mm_tuning_config candidates[TUNING_MAX_CANDIDATES];
+        int num = tuningCandidates(candidates, TUNING_MAX_CANDIDATES, env->device, N);
+        for(int c=0; c<num; c++) {
+            mm_tuning_config* config = &candidates[c];
+            printf("\tTS=%2d WPT=%d VW=%d UNROLL=%d USE_LOCAL=%d: ", config->ts, config->wpt, config->vw, config->unroll, config->use_local);
+            if (!useTuning(env, config)) {
+                printf("not supported by device\n");
+                continue;
+            }
+
+            // poison the result, such that cells skipped by the candidate fail the check instead of
+            // keeping the values of the previous one
+            const float nan = NAN;
+            CLU_ERRCHECK(clEnqueueFillBuffer(env->queue, devC, &nan, sizeof(float), 0, bytes, 0, NULL, NULL), "Failed to fill matrix C");
+            double gflops = (2.0*N*N*N) / timeKernel(*env, N, devC, devA, devB) / 1e9;
+            CLU_ERRCHECK(clEnqueueReadBuffer(env->queue, devC, CL_TRUE, 0, bytes, C, 0, NULL, NULL), "Failed reading back result");
+            mm_error_stats stats = checkResult(PREC_F32, in, C, R, N);
+            printf("%8.3f GFLOPS, Verification: ", gflops);
+            printErrorStats(stats);
+            printf("\n");
+
+            if (stats.success && gflops > best_gflops) {
+                best = *config;
+                best_gflops = gflops;
+            }
+        }
+
+        if (best.ts > 0) {
+            printf("\tBest: TS=%d WPT=%d VW=%d UNROLL=%d USE_LOCAL=%d, %5.3f GFLOPS (%.2fx default)\n",
+                best.ts, best.wpt, best.vw, best.unroll, best.use_local, best_gflops, best_gflops / default_gflops);
+        } else {
+            printf("\tBest: default kernel\n");
+        }
+        if (bucket_gflops[bucket] < best_gflops) {
+            bucket_gflops[bucket] = best_gflops;
+            updateTuning(&table, env->device_name, bucket, best, best_gflops);
+        }
+
+        CLU_ERRCHECK(clReleaseMemObject(devA), "Failed to release Matrix A");
+        CLU_ERRCHECK(clReleaseMemObject(devB), "Failed to release Matrix B");
+        CLU_ERRCHECK(clReleaseMemObject(devC), "Failed to release Matrix C");
+        releaseInputs(in);
+        free(C);
+        free(R);
+    }
+
+    useTuning(env, NULL);
+    storeTuningTable(&table, TUNING_FILE);
+    releaseTuningTable(table);
+    printf("\nTuning results written to %s\n", TUNING_FILE);
+    return EXIT_SUCCESS;
+}
+
+int runSelfTest() {
+    bool success = true;
+    for(int i=0; i<NUM_SIZES; i++) {
+        int N = SIZES[i];
+        if (N < FREIVALDS_THRESHOLD) continue;
+
+        printf("\nSetting up N=%d ..\n", N);
+        mm_inputs in = createInputs(PREC_F32, N);
+        float* R = malloc(sizeof(float) * N * N);
+        if (!loadReference(R, sizeof(float), PRECISIONS[PREC_F32].name, N, SEED)) {
+            computeReference(PREC_F32, in, R, N);
+            storeReference(R, sizeof(float), PRECISIONS[PREC_F32].name, N, SEED);
+        }
+
+        // a wrong result, as produced by a kernel skipping the first terms of the k loop
+        float* C = malloc(sizeof(float) * N * N);
+        #pragma omp parallel for schedule(static)
+        for(long long r = 0; r<N; r++) {
+            for(long long c = 0; c<N; c++) {
+                float sum = R[r*N+c];
+                for(long long k = 0; k<SELFTEST_MISSING_TERMS; k++) {
+                    sum -= in.A[r*N+k] * in.B[k*N+c];
+                }
+                C[r*N+c] = sum;
+            }
+        }
+
+        mm_error_stats correct = verifyFreivalds(in.A, in.B, R, N, N);
+        mm_error_stats wrong = verifyFreivalds(in.A, in.B, C, N, N);
+        mm_error_stats wrongFull = verifyWithReference(C, R, N);
+
+        printf("\tReference result, Freivalds' check: ");
+        printErrorStats(correct);
+        printf("\n\tWrong result, Freivalds' check: ");
+        printErrorStats(wrong);
+        printf("\n\tWrong result, full comparison: ");
+        printErrorStats(wrongFull);
+        printf("\n");
+
+        bool ok = correct.success && !wrong.success && !wrongFull.success;
+        printf("\tSelf-test: %s\n", (ok) ? "OK" : "FAILED");
+        success = success && ok;
+
+        releaseInputs(in);
+        free(C);
+        free(R);
+    }
+
+    printf("\nVerification self-test: %s\n", (success) ? "OK" : "FAILED");
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool useTuning(cl_mm_environment* env, const mm_tuning_config* config) {
+    if (env->tuned_kernel) {
+        CLU_ERRCHECK(clReleaseKernel(env->tuned_kernel),   "Failed to release tuned kernel");
+        CLU_ERRCHECK(clReleaseProgram(env->tuned_program), "Failed to release tuned program");
+        env->tuned_kernel = NULL;
+        env->tuned_program = NULL;
+    }
+    if (!config || config->ts == 0) return true;
+
+    char options[256];
+    tuningBuildOptions(config, options, sizeof(options));
+    cl_program program = tuningBuildProgram(env->context, env->device, "mat_mul_tuned.cl", options);
+    if (!program) return false;
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(program, "mat_mul_tuned", &err);
+    CLU_ERRCHECK(err, "Failed to create mat_mul_tuned kernel from program");
+
+    // the compiled kernel may support smaller work groups than the device (e.g. due to registers)
+    size_t global[2], local[2], max_group_size;
+    tuningLaunchSize(config, 1, global, local);
+    CLU_ERRCHECK(clGetKernelWorkGroupInfo(kernel, env->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, NULL), "Failed to get kernel work group size");
+    if (local[0] * local[1] > max_group_size) {
+        CLU_ERRCHECK(clReleaseKernel(kernel),   "Failed to release tuned kernel");
+        CLU_ERRCHECK(clReleaseProgram(program), "Failed to release tuned program");
+        return false;
+    }
+
+    env->tuned_program = program;
+    env->tuned_kernel = kernel;
+    env->tuning = *config;
+    return true;
+}
+
+void enqueueMatMul(cl_mm_environment env, int N, cl_mem C, cl_mem A, cl_mem B, cl_uint num_wait, const cl_event* wait, cl_event* event) {
+    cl_kernel kernel = (env.tuned_kernel) ? env.tuned_kernel : env.kernel;
+    cluSetKernelArguments(kernel, 4,
+        sizeof(cl_mem), (void *)&C,
+        sizeof(cl_mem), (void *)&A,
+        sizeof(cl_mem), (void *)&B,
+        sizeof(int), &N
+    );
+
+    size_t global[2], local[2];
+    if (env.tuned_kernel) {
+        tuningLaunchSize(&env.tuning, N, global, local);
+    } else {
+        global[0] = global[1] = roundUpToMultiple(N,32);
+        local[0] = local[1] = env.group;
+    }
+    bool fixed_group = env.tuned_kernel || env.group > 0;
+    CLU_ERRCHECK(clEnqueueNDRangeKernel(env.queue, kernel, 2, NULL, global, (fixed_group) ? local : NULL, num_wait, wait, event), "Failed to enqueue 2D kernel");
+}
+
+cl_mm_environment createMMEnvironment(mm_precision p) {
 
     cl_mm_environment res;
     
     // ocl initialization
     cl_device_id device_id = cluInitDeviceWithProperties(0, &res.context, &res.queue, CL_QUEUE_PROFILING_ENABLE);
+    res.device = device_id;
 
-    // create kernel from source
+    // a second queue for transfers, such that they may overlap with the computation
     cl_int err;
-    res.program = cluBuildProgramFromFile(res.context, device_id, "mat_mul.cl", NULL);
-    res.kernel = clCreateKernel(res.program, "mat_mul", &err);
-    CLU_ERRCHECK(err, "Failed to create mat_mul kernel from program");
+    res.transfer_queue = clCreateCommandQueue(res.context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    CLU_ERRCHECK(err, "Failed to create transfer command queue");
+
+    // create kernel from source, the generated kernels include their template from this directory
+    res.program = cluBuildProgramFromFile(res.context, device_id, PRECISIONS[p].source, "-I .");
+    res.kernel = clCreateKernel(res.program, PRECISIONS[p].kernel, &err);
+    res.group = PRECISIONS[p].group;
+    if (err == CL_INVALID_KERNEL_NAME && (p == PREC_F64 || p == PREC_C128)) {
+        fprintf(stderr, "The selected device does not support double precision (cl_khr_fp64)\n");
+        exit(EXIT_FAILURE);
+    }
+    CLU_ERRCHECK(err, "Failed to create %s kernel from program", PRECISIONS[p].kernel);
+
+    // the default kernel is used until a tuned configuration is selected
+    res.tuned_program = NULL;
+    res.tuned_kernel = NULL;
+    cluGetDeviceName(device_id, sizeof(res.device_name), res.device_name);
 
     // done
     return res;
@@ -270,11 +1160,14 @@ void destroyMMEnvironment(cl_mm_environment env) {
     // wait for completed operations (there should be none)
     CLU_ERRCHECK(clFlush(env.queue),            "Failed to flush command queue");
     CLU_ERRCHECK(clFinish(env.queue),           "Failed to wait for command queue completion");
+    CLU_ERRCHECK(clFinish(env.transfer_queue),  "Failed to wait for transfer queue completion");
+    useTuning(&env, NULL);
     CLU_ERRCHECK(clReleaseKernel(env.kernel),   "Failed to release kernel");
     CLU_ERRCHECK(clReleaseProgram(env.program), "Failed to release program");
 
     // free management resources
     CLU_ERRCHECK(clReleaseCommandQueue(env.queue), "Failed to release command queue");
+    CLU_ERRCHECK(clReleaseCommandQueue(env.transfer_queue), "Failed to release transfer queue");
     CLU_ERRCHECK(clReleaseContext(env.context),    "Failed to release OpenCL context");
 }
 
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "cl_utils.h"
+#include "matrix_io.h"
+#include "mm_cpu.h"
+#include "philox.h"
+#include "verify.h"
+
+// Multiplies matrices stored in files (see matrix_io.h for the format).
+//
+// The inputs are mapped into memory and handed to the CPU engine or to the device
+// without copying them, the result is streamed to its file in blocks of rows.
+
+typedef float value_t;
+
+// the number of rows of C computed / written at a time
+#define BLOCK_ROWS 256
+
+
+// -- commands --
+
+// creates a rows x cols fp32 file with random values in [0.5,1.5) from the given stream
+int generate(const char* fn, int rows, int cols, uint32_t stream);
+
+// computes C = A * B on the CPU or the OpenCL device
+int multiply(const char* fa, const char* fb, const char* fc, bool use_device);
+
+// C = A * B for the M x K matrix A and the K x N matrix B, C being streamed to w
+void multiplyCPU(mm_matrix_writer* w, const value_t* A, const value_t* B, int M, int N, int K);
+void multiplyDevice(mm_matrix_writer* w, const value_t* A, const value_t* B, int M, int N, int K);
+
+int roundUpToMultiple(int N, int B) {
+    if ((N % B) == 0) return N;
+    return N + (B - (N%B));
+}
+
+// ----------------------
+
+// the seed for generating input matrices
+uint64_t SEED = 0;
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    //  - gen <file> <rows> <cols> [stream]  ... creates a random matrix file
+    //  - mul <A> <B> <C> [cpu|ocl]         ... multiplies two matrix files, by default on the device
+    if (argc >= 5 && !strcmp(argv[1], "gen")) {
+        uint32_t stream = (argc > 5) ? atoi(argv[5]) : 0;
+        return generate(argv[2], atoi(argv[3]), atoi(argv[4]), stream);
+    }
+    if (argc >= 5 && !strcmp(argv[1], "mul")) {
+        bool use_device = !(argc > 5 && !strcmp(argv[5], "cpu"));
+        return multiply(argv[2], argv[3], argv[4], use_device);
+    }
+    printf("Usage: %s gen <file> <rows> <cols> [stream]\n", argv[0]);
+    printf("       %s mul <A> <B> <C> [cpu|ocl]\n", argv[0]);
+    return EXIT_FAILURE;
+}
+
+
+int generate(const char* fn, int rows, int cols, uint32_t stream) {
+    if (rows <= 0 || cols <= 0) {
+        printf("Invalid matrix size %d x %d\n", rows, cols);
+        return EXIT_FAILURE;
+    }
+    value_t* m = malloc(sizeof(value_t) * rows * cols);
+    fillMatrixRandom(m, rows, cols, SEED, stream, 0.5f, 1.5f);
+
+    mm_matrix_writer w = createMatrixWriter(fn, MM_DTYPE_F32, MM_LAYOUT_ROW_MAJOR, rows, cols);
+    writeMatrixRows(&w, m, rows);
+    closeMatrixWriter(&w);
+
+    free(m);
+    printf("Created %d x %d matrix in %s\n", rows, cols, fn);
+    return EXIT_SUCCESS;
+}
+
+int multiply(const char* fa, const char* fb, const char* fc, bool use_device) {
+
+    // ---------- setup ----------
+
+    mm_mapped_matrix a = mapMatrixFile(fa);
+    mm_mapped_matrix b = mapMatrixFile(fb);
+
+    const mm_file_header* ha = &a.header;
+    const mm_file_header* hb = &b.header;
+    if (ha->dtype != MM_DTYPE_F32 || hb->dtype != MM_DTYPE_F32 || ha->layout != MM_LAYOUT_ROW_MAJOR || hb->layout != MM_LAYOUT_ROW_MAJOR) {
+        printf("Only row-major fp32 matrices are supported, got %s and %s\n", dtypeName(ha->dtype), dtypeName(hb->dtype));
+        return EXIT_FAILURE;
+    }
+    if (ha->cols != hb->rows) {
+        printf("Incompatible matrices: %llu x %llu times %llu x %llu\n", (unsigned long long)ha->rows,
+            (unsigned long long)ha->cols, (unsigned long long)hb->rows, (unsigned long long)hb->cols);
+        return EXIT_FAILURE;
+    }
+    int M = ha->rows;
+    int N = hb->cols;
+    int K = ha->cols;
+    printf("Computing %d x %d times %d x %d on the %s ..\n", M, K, K, N, (use_device) ? "device" : "CPU");
+
+
+    // ---------- compute ----------
+
+    mm_matrix_writer w = createMatrixWriter(fc, MM_DTYPE_F32, MM_LAYOUT_ROW_MAJOR, M, N);
+
+    timestamp begin = now();
+    if (use_device) {
+        multiplyDevice(&w, a.data, b.data, M, N, K);
+    } else {
+        multiplyCPU(&w, a.data, b.data, M, N, K);
+    }
+    closeMatrixWriter(&w);
+    timestamp end = now();
+
+    double seconds = end - begin;
+    printf("Duration: %2.3fs, GFLOPS: %5.3f (incl. writing %s)\n", seconds, (2.0*M*N*K) / seconds / 1e9, fc);
+
+
+    // ---------- check ----------
+
+    // the written file is checked, Freivalds' check is limited to square matrices
+    bool success = true;
+    if (M == N && N == K) {
+        mm_mapped_matrix c = mapMatrixFile(fc);
+        mm_error_stats stats = verifyFreivalds(a.data, b.data, c.data, N, SEED);
+        printf("Verification: ");
+        printErrorStats(stats);
+        printf("\n");
+        success = stats.success;
+        unmapMatrixFile(c);
+    }
+
+
+    // ---------- cleanup ----------
+
+    unmapMatrixFile(a);
+    unmapMatrixFile(b);
+
+    // done
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void multiplyCPU(mm_matrix_writer* w, const value_t* A, const value_t* B, int M, int N, int K) {
+    // the rows of A and B are read straight from the mapped files
+    value_t* block = malloc(sizeof(value_t) * BLOCK_ROWS * N);
+    for(int i = 0; i < M; i += BLOCK_ROWS) {
+        int rows = (i + BLOCK_ROWS < M) ? BLOCK_ROWS : M - i;
+        gemmF32(block, A + (size_t)i * K, B, rows, N, K);
+        writeMatrixRows(w, block, rows);
+    }
+    free(block);
+}
+
+void multiplyDevice(mm_matrix_writer* w, const value_t* A, const value_t* B, int M, int N, int K) {
+
+    cl_context context;
+    cl_command_queue queue;
+    cl_device_id device = cluInitDevice(0, &context, &queue);
+
+    // the mapped files back the input buffers, the runtime fetches them as needed --
+    // they are never written, so the read-only mapping is fine
+    cl_int err;
+    cl_mem devA = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(value_t) * M * K, (void*)A, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix A");
+    cl_mem devB = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(value_t) * K * N, (void*)B, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix B");
+    cl_mem devC = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(value_t) * M * N, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create buffer for matrix C");
+
+    cl_program program = cluBuildProgramFromFile(context, device, "mat_mul.cl", NULL);
+    cl_kernel kernel = clCreateKernel(program, "mat_mul_acc", &err);
+    CLU_ERRCHECK(err, "Failed to create mat_mul_acc kernel from program");
+
+    int accumulate = 0;
+    cluSetKernelArguments(kernel, 7,
+        sizeof(cl_mem), (void *)&devC,
+        sizeof(cl_mem), (void *)&devA,
+        sizeof(cl_mem), (void *)&devB,
+        sizeof(int), &M,
+        sizeof(int), &N,
+        sizeof(int), &K,
+        sizeof(int), &accumulate
+    );
+    size_t size[2] = { roundUpToMultiple(N,32), roundUpToMultiple(M,32) };
+    CLU_ERRCHECK(clEnqueueNDRangeKernel(queue, kernel, 2, NULL, size, NULL, 0, NULL, NULL), "Failed to enqueue 2D kernel");
+
+    // stream the result to the file block by block
+    value_t* block = malloc(sizeof(value_t) * BLOCK_ROWS * N);
+    for(int i = 0; i < M; i += BLOCK_ROWS) {
+        int rows = (i + BLOCK_ROWS < M) ? BLOCK_ROWS : M - i;
+        err = clEnqueueReadBuffer(queue, devC, CL_TRUE, sizeof(value_t) * i * N, sizeof(value_t) * rows * N, block, 0, NULL, NULL);
+        CLU_ERRCHECK(err, "Failed reading back result");
+        writeMatrixRows(w, block, rows);
+    }
+    free(block);
+
+    // cleanup
+    CLU_ERRCHECK(clReleaseKernel(kernel), "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseProgram(program), "Failed to release program");
+    CLU_ERRCHECK(clReleaseMemObject(devA), "Failed to release Matrix A");
+    CLU_ERRCHECK(clReleaseMemObject(devB), "Failed to release Matrix B");
+    CLU_ERRCHECK(clReleaseMemObject(devC), "Failed to release Matrix C");
+    CLU_ERRCHECK(clReleaseCommandQueue(queue), "Failed to release command queue");
+    CLU_ERRCHECK(clReleaseContext(context), "Failed to release OpenCL context");
+}
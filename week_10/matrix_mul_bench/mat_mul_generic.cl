@@ -0,0 +1,19 @@
+
+// The kernels generated from the template shared with the CPU engine (see mm_generic.h),
+// built with "-I ." from this directory.
+
+// single precision complex numbers
+#define MM_TYPE MM_C64
+#include "mm_generic.h"
+
+// double precision real and complex numbers, only available on devices supporting cl_khr_fp64
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+#define MM_TYPE MM_F64
+#include "mm_generic.h"
+
+#define MM_TYPE MM_C128
+#include "mm_generic.h"
+
+#endif
@@ -0,0 +1,362 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "cl_utils.h"
+#include "philox.h"
+#include "verify.h"
+
+// An out-of-core matrix multiplication.
+//
+// C is computed tile by tile: for every T x T tile of C, the matching row panel of A
+// and column panel of B are streamed through the device in T x T blocks, which are
+// accumulated into the tile. Two sets of device buffers are used alternately, such
+// that the upload of the next blocks and the download of the previous tile overlap
+// with the current computation. The device thus never holds more than 6 blocks.
+//
+// On the host, matrices may be kept in memory-mapped files, such that the operating
+// system pages them in and out as needed.
+
+typedef float value_t;
+
+
+// -- host matrices --
+
+typedef value_t* Matrix;
+
+// an N x N matrix in main memory or in a memory-mapped file
+typedef struct _host_matrix {
+    Matrix data;
+    size_t bytes;
+    int fd;             // < descriptor of the mapped file, -1 for main memory
+    char file[512];
+} host_matrix;
+
+// creates an N x N matrix, in a file "name" in directory dir if dir is not NULL
+host_matrix createHostMatrix(int N, const char* dir, const char* name);
+
+// releases the matrix, deleting its file if there is one
+void releaseHostMatrix(host_matrix m);
+
+// -- out-of-core engine --
+
+typedef struct _cl_ooc_environment {
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_command_queue transfer_queue;    // < uploads and downloads, overlapping with the computation
+    cl_program program;
+    cl_kernel kernel;
+} cl_ooc_environment;
+
+cl_ooc_environment createOOCEnvironment();
+
+void destroyOOCEnvironment(cl_ooc_environment env);
+
+// the largest tile size such that all buffers fit into half of the device memory, a multiple
+// of 32 unless it covers the whole matrix; fails if not even a 32 x 32 tile fits
+int chooseTileSize(cl_ooc_environment env, int N);
+
+// computes C = A * B for N x N matrices using T x T tiles on the device,
+// returns the number of bytes transferred between host and device
+double multiplyOutOfCore(cl_ooc_environment env, const Matrix A, const Matrix B, Matrix C, int N, int T);
+
+int roundUpToMultiple(int N, int B) {
+    if ((N % B) == 0) return N;
+    return N + (B - (N%B));
+}
+
+// ----------------------
+
+// the seed for generating input matrices
+uint64_t SEED = 0;
+
+// ----------------------
+
+
+int main(int argc, char** argv) {
+
+    // 'parsing' optional input parameters
+    //  - N          ... the problem size (default 20000)
+    //  - tile=<T>   ... the tile size, by default derived from the device memory
+    //  - mmap=<dir> ... keep the matrices in memory-mapped files in the given directory
+    int N = 20000;
+    int T = 0;
+    const char* dir = NULL;
+    for(int a=1; a<argc; a++) {
+        if (!strncmp(argv[a], "tile=", 5)) {
+            T = atoi(argv[a] + 5);
+        } else if (!strncmp(argv[a], "mmap=", 5)) {
+            dir = argv[a] + 5;
+        } else if (atoi(argv[a]) > 0) {
+            N = atoi(argv[a]);
+        } else {
+            printf("Usage: %s [N] [tile=<T>] [mmap=<dir>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+
+    // ---------- setup ----------
+
+    cl_ooc_environment env = createOOCEnvironment();
+    if (T <= 0) T = chooseTileSize(env, N);
+    if (T > N) T = N;
+
+    printf("Computing out-of-core matrix-matrix product with N=%d, tile size %d (%d x %d tiles)\n", N, T, (N+T-1)/T, (N+T-1)/T);
+    printf("Host storage: %s\n", (dir) ? "memory-mapped files" : "main memory");
+
+    host_matrix A = createHostMatrix(N, dir, "A.bin");
+    host_matrix B = createHostMatrix(N, dir, "B.bin");
+    host_matrix C = createHostMatrix(N, dir, "C.bin");
+
+    // create input (in parallel, the result is independent of the number of threads)
+    fillMatrixRandom(A.data, N, N, SEED, 0, 0.5f, 1.5f);
+    fillMatrixRandom(B.data, N, N, SEED, 1, 0.5f, 1.5f);
+
+
+    // ---------- compute ----------
+
+    timestamp begin = now();
+    double bytes = multiplyOutOfCore(env, A.data, B.data, C.data, N, T);
+    timestamp end = now();
+
+    double seconds = end - begin;
+    printf("Total time: %.3f s\n", seconds);
+    printf("GFLOPS: %.3f\n", (2.0*N*N*N) / seconds / 1e9);
+    printf("Transferred: %.2f GB, %.2f GB/s\n", bytes / 1e9, bytes / 1e9 / seconds);
+
+
+    // ---------- check ----------
+
+    mm_error_stats stats = verifyFreivalds(A.data, B.data, C.data, N, SEED);
+    printf("Verification: ");
+    printErrorStats(stats);
+    printf("\n");
+
+
+    // ---------- cleanup ----------
+
+    releaseHostMatrix(A);
+    releaseHostMatrix(B);
+    releaseHostMatrix(C);
+    destroyOOCEnvironment(env);
+
+    // done
+    return (stats.success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+host_matrix createHostMatrix(int N, const char* dir, const char* name) {
+    host_matrix m;
+    m.bytes = sizeof(value_t) * N * N;
+    m.fd = -1;
+    m.file[0] = '\0';
+
+    if (!dir) {
+        m.data = malloc(m.bytes);
+        if (!m.data) {
+            fprintf(stderr, "Unable to allocate %zu bytes, consider using mmap=<dir>\n", m.bytes);
+            exit(EXIT_FAILURE);
+        }
+        return m;
+    }
+
+    snprintf(m.file, sizeof(m.file), "%s/%s", dir, name);
+    m.fd = open(m.file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m.fd < 0 || ftruncate(m.fd, m.bytes) != 0) {
+        fprintf(stderr, "Unable to create matrix file %s\n", m.file);
+        exit(EXIT_FAILURE);
+    }
+    m.data = mmap(NULL, m.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m.fd, 0);
+    if (m.data == MAP_FAILED) {
+        fprintf(stderr, "Unable to map matrix file %s\n", m.file);
+        exit(EXIT_FAILURE);
+    }
+    return m;
+}
+
+void releaseHostMatrix(host_matrix m) {
+    if (m.fd < 0) {
+        free(m.data);
+        return;
+    }
+    munmap(m.data, m.bytes);
+    close(m.fd);
+    remove(m.file);
+}
+
+int chooseTileSize(cl_ooc_environment env, int N) {
+    cl_ulong global_mem, max_alloc;
+    CLU_ERRCHECK(clGetDeviceInfo(env.device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, NULL), "Failed to get global memory size");
+    CLU_ERRCHECK(clGetDeviceInfo(env.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL), "Failed to get max allocation size");
+
+    // 2 blocks of A, 2 blocks of B and 2 tiles of C, each limited by the max allocation size
+    double budget = global_mem / 2.0 / 6.0;
+    if (budget > max_alloc) budget = max_alloc;
+    int T = (int)sqrt(budget / sizeof(value_t));
+    if (T >= N) return N;
+
+    // multiples of the work group size keep the kernel launches regular
+    T -= T % 32;
+    if (T == 0) {
+        fprintf(stderr, "Device memory of %llu bytes is too small for 32 x 32 tiles, consider using tile=<T>\n", (unsigned long long)global_mem);
+        exit(EXIT_FAILURE);
+    }
+    return T;
+}
+
+// enqueues the transfer of the rows x cols block at (row,col) of the N x N host matrix
+// to / from a device buffer holding it as a packed rows x cols matrix
+void enqueueBlockWrite(cl_command_queue queue, cl_mem buffer, const Matrix host, int N, int row, int col, int rows, int cols, cl_uint num_wait, const cl_event* wait, cl_event* event) {
+    size_t buffer_origin[3] = { 0, 0, 0 };
+    size_t host_origin[3] = { col * sizeof(value_t), row, 0 };
+    size_t region[3] = { cols * sizeof(value_t), rows, 1 };
+    CLU_ERRCHECK(clEnqueueWriteBufferRect(queue, buffer, CL_FALSE, buffer_origin, host_origin, region,
+        cols * sizeof(value_t), 0, N * sizeof(value_t), 0, host, num_wait, wait, event), "Failed to write block to device");
+}
+
+void enqueueBlockRead(cl_command_queue queue, cl_mem buffer, Matrix host, int N, int row, int col, int rows, int cols, cl_uint num_wait, const cl_event* wait, cl_event* event) {
+    size_t buffer_origin[3] = { 0, 0, 0 };
+    size_t host_origin[3] = { col * sizeof(value_t), row, 0 };
+    size_t region[3] = { cols * sizeof(value_t), rows, 1 };
+    CLU_ERRCHECK(clEnqueueReadBufferRect(queue, buffer, CL_FALSE, buffer_origin, host_origin, region,
+        cols * sizeof(value_t), 0, N * sizeof(value_t), 0, host, num_wait, wait, event), "Failed to read block from device");
+}
+
+double multiplyOutOfCore(cl_ooc_environment env, const Matrix A, const Matrix B, Matrix C, int N, int T) {
+
+    // two slots for blocks of A and B, and two for tiles of C
+    size_t block_bytes = sizeof(value_t) * T * T;
+    cl_mem devA[2], devB[2], devC[2];
+    for(int s=0; s<2; s++) {
+        cl_int err;
+        devA[s] = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, block_bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for blocks of A");
+        devB[s] = clCreateBuffer(env.context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, block_bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for blocks of B");
+        devC[s] = clCreateBuffer(env.context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, block_bytes, NULL, &err);
+        CLU_ERRCHECK(err, "Failed to create buffer for tiles of C");
+    }
+
+    // the steps are the (i,j,k) block triples, k running fastest
+    int tiles = (N + T - 1) / T;
+    long long steps = (long long)tiles * tiles * tiles;
+
+    // the per-slot events of the last upload and computation, and the last download per tile slot
+    cl_event written[2] = { NULL, NULL };
+    cl_event computed[2] = { NULL, NULL };
+    cl_event read[2] = { NULL, NULL };
+    double bytes = 0;
+
+    // uploads the blocks of step "step" into slot "s" once the previous computation using it is done
+    #define UPLOAD(step, s) { \
+        int bi = (step) / tiles / tiles, bj = (step) / tiles % tiles, bk = (step) % tiles; \
+        int rows = ((bi+1)*T < N) ? T : N - bi*T; \
+        int cols = ((bj+1)*T < N) ? T : N - bj*T; \
+        int depth = ((bk+1)*T < N) ? T : N - bk*T; \
+        if (written[s]) CLU_ERRCHECK(clReleaseEvent(written[s]), "Failed to release event"); \
+        enqueueBlockWrite(env.transfer_queue, devA[s], A, N, bi*T, bk*T, rows, depth, (computed[s]) ? 1 : 0, (computed[s]) ? &computed[s] : NULL, NULL); \
+        enqueueBlockWrite(env.transfer_queue, devB[s], B, N, bk*T, bj*T, depth, cols, 0, NULL, &written[s]); \
+        bytes += sizeof(value_t) * ((double)rows * depth + (double)depth * cols); \
+    }
+
+    UPLOAD(0, 0);
+    for(long long step = 0; step < steps; step++) {
+        int s = step % 2;
+        int bi = step / tiles / tiles, bj = step / tiles % tiles, bk = step % tiles;
+        int c = (bi * tiles + bj) % 2;
+        int rows = ((bi+1)*T < N) ? T : N - bi*T;
+        int cols = ((bj+1)*T < N) ? T : N - bj*T;
+        int depth = ((bk+1)*T < N) ? T : N - bk*T;
+
+        // the first block of a tile overwrites the tile slot, it has to be drained first
+        int accumulate = (bk > 0);
+        cl_event deps[2] = { written[s], read[c] };
+        cl_uint num_deps = (!accumulate && read[c]) ? 2 : 1;
+
+        cluSetKernelArguments(env.kernel, 7,
+            sizeof(cl_mem), (void *)&devC[c],
+            sizeof(cl_mem), (void *)&devA[s],
+            sizeof(cl_mem), (void *)&devB[s],
+            sizeof(int), &rows,
+            sizeof(int), &cols,
+            sizeof(int), &depth,
+            sizeof(int), &accumulate
+        );
+        size_t size[2] = { roundUpToMultiple(cols,16), roundUpToMultiple(rows,16) };
+        if (computed[s]) CLU_ERRCHECK(clReleaseEvent(computed[s]), "Failed to release event");
+        CLU_ERRCHECK(clEnqueueNDRangeKernel(env.queue, env.kernel, 2, NULL, size, NULL, num_deps, deps, &computed[s]), "Failed to enqueue 2D kernel");
+        CLU_ERRCHECK(clFlush(env.queue), "Failed to flush command queue");
+
+        // the upload of the next blocks has to be queued before the download of this tile,
+        // otherwise the in-order transfer queue would wait for the current computation
+        if (step+1 < steps) {
+            UPLOAD(step+1, (s+1)%2);
+        }
+
+        // drain the tile once all its blocks are accumulated
+        if (bk == tiles-1) {
+            if (read[c]) CLU_ERRCHECK(clReleaseEvent(read[c]), "Failed to release event");
+            enqueueBlockRead(env.transfer_queue, devC[c], C, N, bi*T, bj*T, rows, cols, 1, &computed[s], &read[c]);
+            bytes += sizeof(value_t) * (double)rows * cols;
+        }
+        CLU_ERRCHECK(clFlush(env.transfer_queue), "Failed to flush transfer queue");
+    }
+    #undef UPLOAD
+
+    CLU_ERRCHECK(clFinish(env.queue), "Failed to wait for command queue completion");
+    CLU_ERRCHECK(clFinish(env.transfer_queue), "Failed to wait for transfer queue completion");
+
+    // cleanup
+    for(int s=0; s<2; s++) {
+        if (written[s]) CLU_ERRCHECK(clReleaseEvent(written[s]), "Failed to release event");
+        if (computed[s]) CLU_ERRCHECK(clReleaseEvent(computed[s]), "Failed to release event");
+        if (read[s]) CLU_ERRCHECK(clReleaseEvent(read[s]), "Failed to release event");
+        CLU_ERRCHECK(clReleaseMemObject(devA[s]), "Failed to release blocks of A");
+        CLU_ERRCHECK(clReleaseMemObject(devB[s]), "Failed to release blocks of B");
+        CLU_ERRCHECK(clReleaseMemObject(devC[s]), "Failed to release tiles of C");
+    }
+
+    return bytes;
+}
+
+cl_ooc_environment createOOCEnvironment() {
+
+    cl_ooc_environment res;
+
+    // ocl initialization
+    res.device = cluInitDevice(0, &res.context, &res.queue);
+
+    // a second queue for transfers, such that they may overlap with the computation
+    cl_int err;
+    res.transfer_queue = clCreateCommandQueue(res.context, res.device, 0, &err);
+    CLU_ERRCHECK(err, "Failed to create transfer command queue");
+
+    // create kernel from source
+    res.program = cluBuildProgramFromFile(res.context, res.device, "mat_mul.cl", NULL);
+    res.kernel = clCreateKernel(res.program, "mat_mul_acc", &err);
+    CLU_ERRCHECK(err, "Failed to create mat_mul_acc kernel from program");
+
+    // done
+    return res;
+}
+
+void destroyOOCEnvironment(cl_ooc_environment env) {
+
+    // wait for completed operations (there should be none)
+    CLU_ERRCHECK(clFinish(env.queue),           "Failed to wait for command queue completion");
+    CLU_ERRCHECK(clFinish(env.transfer_queue),  "Failed to wait for transfer queue completion");
+    CLU_ERRCHECK(clReleaseKernel(env.kernel),   "Failed to release kernel");
+    CLU_ERRCHECK(clReleaseProgram(env.program), "Failed to release program");
+
+    // free management resources
+    CLU_ERRCHECK(clReleaseCommandQueue(env.queue), "Failed to release command queue");
+    CLU_ERRCHECK(clReleaseCommandQueue(env.transfer_queue), "Failed to release transfer queue");
+    CLU_ERRCHECK(clReleaseContext(env.context),    "Failed to release OpenCL context");
+}
@@ -0,0 +1,142 @@
+
+// A parameterized variant of the mat_mul kernel, specialized at build time
+// through the following options (see tuning.h for the search space):
+//
+//  - TS        ... the C tile computed by a work group is TS x TS
+//  - WPT       ... the number of rows of the tile computed by each work item
+//  - VW        ... the number of consecutive columns computed by each work item,
+//                  processed as one vector of width VW (1, 2, 4 or 8)
+//  - UNROLL    ... the unroll factor of the innermost (k) loop
+//  - USE_LOCAL ... if 1, tiles of A and B are staged in local memory
+//
+// The kernel has to be launched with work groups of size (TS/VW, TS/WPT) and a
+// global size of (ceil(N/TS)*TS/VW, ceil(N/TS)*TS/WPT).
+
+#ifndef TS
+#define TS 32
+#endif
+#ifndef WPT
+#define WPT 4
+#endif
+#ifndef VW
+#define VW 1
+#endif
+#ifndef UNROLL
+#define UNROLL 1
+#endif
+#ifndef USE_LOCAL
+#define USE_LOCAL 1
+#endif
+
+// the work group size
+#define GROUP_COLS (TS/VW)
+#define GROUP_ROWS (TS/WPT)
+
+#if VW == 1
+typedef float floatV;
+#elif VW == 2
+typedef float2 floatV;
+#elif VW == 4
+typedef float4 floatV;
+#elif VW == 8
+typedef float8 floatV;
+#else
+#error "Unsupported vector width"
+#endif
+
+#define QUOTE(x) #x
+#define PRAGMA(x) _Pragma(QUOTE(x))
+
+#define CONCAT(a,b) a##b
+#define VLOAD(n) CONCAT(vload,n)
+
+__kernel __attribute__((reqd_work_group_size(GROUP_COLS, GROUP_ROWS, 1)))
+void mat_mul_tuned(
+    __global float* c,
+    __global const float* a,
+    __global const float* b,
+    int N
+) {
+    const int lj = get_local_id(0);
+    const int li = get_local_id(1);
+    const int tile_i = get_group_id(1) * TS;
+    const int tile_j = get_group_id(0) * TS;
+
+    // this work item computes rows tile_i + li + w*GROUP_ROWS, w < WPT, and
+    // columns tile_j + lj*VW + v, v < VW
+    floatV acc[WPT] = { 0 };
+
+#if USE_LOCAL
+
+    __local float As[TS][TS];
+    __local float Bs[TS][TS];
+
+    for(int t = 0; t < N; t += TS) {
+
+        // load the tiles A[tile_i.., t..] and B[t.., tile_j..], zero padded
+        for(int w = 0; w < WPT; w++) {
+            int row = li + w*GROUP_ROWS;
+            for(int v = 0; v < VW; v++) {
+                int col = lj*VW + v;
+                As[row][col] = (tile_i+row < N && t+col < N) ? a[(tile_i+row)*N + t+col] : 0;
+                Bs[row][col] = (t+row < N && tile_j+col < N) ? b[(t+row)*N + tile_j+col] : 0;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        PRAGMA(unroll UNROLL)
+        for(int k = 0; k < TS; k++) {
+#if VW == 1
+            floatV bv = Bs[k][lj];
+#else
+            floatV bv = VLOAD(VW)(lj, &Bs[k][0]);
+#endif
+            for(int w = 0; w < WPT; w++) {
+                acc[w] += As[li + w*GROUP_ROWS][k] * bv;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+#else
+
+    // without local memory, B is read directly from global memory -- vector loads
+    // are only possible if the whole vector is within the matrix
+    int j = tile_j + lj*VW;
+    bool full = (j + VW <= N);
+
+    PRAGMA(unroll UNROLL)
+    for(int k = 0; k < N; k++) {
+        floatV bv;
+        if (full) {
+#if VW == 1
+            bv = b[k*N + j];
+#else
+            bv = VLOAD(VW)(0, b + k*N + j);
+#endif
+        } else {
+            float* bf = (float*)&bv;
+            for(int v = 0; v < VW; v++) {
+                bf[v] = (j+v < N) ? b[k*N + j+v] : 0;
+            }
+        }
+        for(int w = 0; w < WPT; w++) {
+            int i = tile_i + li + w*GROUP_ROWS;
+            float av = (i < N) ? a[i*N + k] : 0;
+            acc[w] += av * bv;
+        }
+    }
+
+#endif
+
+    // store the results within the matrix
+    for(int w = 0; w < WPT; w++) {
+        int i = tile_i + li + w*GROUP_ROWS;
+        if (i >= N) continue;
+        float* res = (float*)&acc[w];
+        for(int v = 0; v < VW; v++) {
+            int j = tile_j + lj*VW + v;
+            if (j < N) c[i*N + j] = res[v];
+        }
+    }
+}
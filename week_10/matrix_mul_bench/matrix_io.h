@@ -0,0 +1,234 @@
+#pragma once
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A binary file format for matrices.
+//
+// A file consists of a 64-byte header followed by the elements, starting at a
+// 64-byte aligned offset. All fields are stored in the byte order of the host
+// (little endian on all machines we use).
+//
+//     offset  size  field
+//          0     8  magic "MATRIX\0\0"
+//          8     4  version (1)
+//         12     4  element type (mm_dtype)
+//         16     4  layout (mm_layout)
+//         20     4  reserved (0)
+//         24     8  number of rows
+//         32     8  number of columns
+//         40     8  offset of the first element, a multiple of 64
+//         48    16  reserved (0)
+//
+// Files are read by mapping them into memory, such that the elements can be handed
+// to the CPU engine or to CL_MEM_USE_HOST_PTR buffers without copying them. Files
+// are written row by row, such that results never have to be held entirely in memory.
+
+
+#define MM_FILE_MAGIC "MATRIX\0\0"
+#define MM_FILE_VERSION 1
+
+// the alignment of the elements within a file (a cache line, enough for any vector load)
+#define MM_FILE_ALIGNMENT 64
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef enum _mm_dtype {
+    MM_DTYPE_F32 = 0,
+    MM_DTYPE_F64 = 1,
+    MM_DTYPE_F16 = 2,
+    MM_DTYPE_I8  = 3,
+    MM_DTYPE_I32 = 4
+} mm_dtype;
+
+typedef enum _mm_layout {
+    MM_LAYOUT_ROW_MAJOR = 0,
+    MM_LAYOUT_COL_MAJOR = 1
+} mm_layout;
+
+typedef struct _mm_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layout;
+    uint32_t reserved0;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t offset;
+    uint64_t reserved1[2];
+} mm_file_header;
+
+// a memory-mapped matrix file
+typedef struct _mm_mapped_matrix {
+    mm_file_header header;
+    void* data;             // < the first element, MM_FILE_ALIGNMENT aligned
+    void* base;             // < the start of the mapping
+    size_t length;          // < the length of the mapping
+} mm_mapped_matrix;
+
+// a matrix file being written row by row
+typedef struct _mm_matrix_writer {
+    mm_file_header header;
+    FILE* fp;
+    uint64_t rows_written;
+} mm_matrix_writer;
+
+// the size of an element of the given type, 0 for unknown types
+size_t dtypeSize(mm_dtype dtype);
+
+const char* dtypeName(mm_dtype dtype);
+
+// maps the given matrix file read-only into memory, aborts if it is not a valid matrix file
+mm_mapped_matrix mapMatrixFile(const char* fn);
+
+void unmapMatrixFile(mm_mapped_matrix m);
+
+// creates a matrix file, the header is written right away
+mm_matrix_writer createMatrixWriter(const char* fn, mm_dtype dtype, mm_layout layout, uint64_t rows, uint64_t cols);
+
+// appends the given number of rows (or columns for column-major files)
+void writeMatrixRows(mm_matrix_writer* w, const void* data, uint64_t rows);
+
+// completes the file, aborts if not all rows have been written
+void closeMatrixWriter(mm_matrix_writer* w);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+size_t dtypeSize(mm_dtype dtype) {
+    switch(dtype) {
+    case MM_DTYPE_F32: return 4;
+    case MM_DTYPE_F64: return 8;
+    case MM_DTYPE_F16: return 2;
+    case MM_DTYPE_I8:  return 1;
+    case MM_DTYPE_I32: return 4;
+    }
+    return 0;
+}
+
+const char* dtypeName(mm_dtype dtype) {
+    switch(dtype) {
+    case MM_DTYPE_F32: return "fp32";
+    case MM_DTYPE_F64: return "fp64";
+    case MM_DTYPE_F16: return "fp16";
+    case MM_DTYPE_I8:  return "int8";
+    case MM_DTYPE_I32: return "int32";
+    }
+    return "unknown";
+}
+
+mm_mapped_matrix mapMatrixFile(const char* fn) {
+    mm_mapped_matrix m;
+
+    int fd = open(fn, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Unable to open matrix file %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < sizeof(mm_file_header)) {
+        fprintf(stderr, "Invalid matrix file %s: too short\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    // the mapping stays valid after closing the file
+    m.length = st.st_size;
+    m.base = mmap(NULL, m.length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m.base == MAP_FAILED) {
+        fprintf(stderr, "Unable to map matrix file %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(&m.header, m.base, sizeof(mm_file_header));
+    const mm_file_header* h = &m.header;
+    size_t element = dtypeSize(h->dtype);
+    if (memcmp(h->magic, MM_FILE_MAGIC, 8) || h->version != MM_FILE_VERSION) {
+        fprintf(stderr, "Invalid matrix file %s: bad magic or version\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    if (element == 0 || h->layout > MM_LAYOUT_COL_MAJOR || h->offset % MM_FILE_ALIGNMENT || h->offset < sizeof(mm_file_header)) {
+        fprintf(stderr, "Invalid matrix file %s: bad element type, layout or offset\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    // the dimensions come from the file, the checks must not overflow -- callers use int dimensions
+    if (h->rows > INT_MAX || h->cols > INT_MAX) {
+        fprintf(stderr, "Invalid matrix file %s: %llu x %llu elements exceed the supported size\n", fn,
+            (unsigned long long)h->rows, (unsigned long long)h->cols);
+        exit(EXIT_FAILURE);
+    }
+    if (h->offset > m.length || (h->cols && h->rows > (m.length - h->offset) / element / h->cols)) {
+        fprintf(stderr, "Invalid matrix file %s: truncated, expected %llu x %llu elements\n", fn,
+            (unsigned long long)h->rows, (unsigned long long)h->cols);
+        exit(EXIT_FAILURE);
+    }
+
+    m.data = (char*)m.base + h->offset;
+    return m;
+}
+
+void unmapMatrixFile(mm_mapped_matrix m) {
+    munmap(m.base, m.length);
+}
+
+mm_matrix_writer createMatrixWriter(const char* fn, mm_dtype dtype, mm_layout layout, uint64_t rows, uint64_t cols) {
+    mm_matrix_writer w;
+    memset(&w.header, 0, sizeof(mm_file_header));
+    memcpy(w.header.magic, MM_FILE_MAGIC, 8);
+    w.header.version = MM_FILE_VERSION;
+    w.header.dtype = dtype;
+    w.header.layout = layout;
+    w.header.rows = rows;
+    w.header.cols = cols;
+    w.header.offset = MM_FILE_ALIGNMENT;    // the header fills exactly one aligned block
+    w.rows_written = 0;
+
+    w.fp = fopen(fn, "wb");
+    if (!w.fp) {
+        fprintf(stderr, "Unable to create matrix file %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fwrite(&w.header, sizeof(mm_file_header), 1, w.fp) != 1) {
+        fprintf(stderr, "Unable to write header of matrix file %s\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    return w;
+}
+
+void writeMatrixRows(mm_matrix_writer* w, const void* data, uint64_t rows) {
+    uint64_t len = (w->header.layout == MM_LAYOUT_ROW_MAJOR) ? w->header.cols : w->header.rows;
+    uint64_t max = (w->header.layout == MM_LAYOUT_ROW_MAJOR) ? w->header.rows : w->header.cols;
+    if (w->rows_written + rows > max) {
+        fprintf(stderr, "Writing beyond the end of a matrix file\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t count = rows * len;
+    if (fwrite(data, dtypeSize(w->header.dtype), count, w->fp) != count) {
+        fprintf(stderr, "Unable to write to matrix file\n");
+        exit(EXIT_FAILURE);
+    }
+    w->rows_written += rows;
+}
+
+void closeMatrixWriter(mm_matrix_writer* w) {
+    uint64_t max = (w->header.layout == MM_LAYOUT_ROW_MAJOR) ? w->header.rows : w->header.cols;
+    if (w->rows_written != max) {
+        fprintf(stderr, "Incomplete matrix file, %llu of %llu rows written\n",
+            (unsigned long long)w->rows_written, (unsigned long long)max);
+        exit(EXIT_FAILURE);
+    }
+    if (fclose(w->fp) != 0) {
+        fprintf(stderr, "Unable to complete matrix file\n");
+        exit(EXIT_FAILURE);
+    }
+    w->fp = NULL;
+}
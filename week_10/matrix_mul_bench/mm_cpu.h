@@ -0,0 +1,356 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__F16C__) || defined(__AVX512VNNI__) || defined(__AVXVNNI__)
+#include <immintrin.h>
+#endif
+
+// The CPU matrix multiplication engine.
+//
+// All matrices are stored row-major, the routines compute C (M x N) = A (M x K) * B (K x N).
+// Besides float, the engine supports
+//  - fp16 inputs with fp32 accumulation (half precision is a storage format only)
+//  - double precision, e.g. for validating the accuracy of float results
+//  - single and double precision complex numbers
+//  - int8 x int8 -> int32, using VNNI dot product instructions where available
+//
+// Instruction set extensions are selected at compile time (see -march=native). The
+// double precision and complex routines are generated from the template shared with
+// the OpenCL kernels (see mm_generic.h).
+//
+// All parallel loops distribute rows with a static schedule, like the initialization of the
+// inputs (see fillMatrixRandom). On NUMA machines, the pages of a thread's rows are thus
+// placed on its own node when it touches them first, as long as threads are pinned
+// (e.g. OMP_PLACES=cores OMP_PROC_BIND=close, see the Makefile).
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+// an IEEE 754 binary16 value
+typedef uint16_t half_t;
+
+// complex numbers, laid out like OpenCL's float2 / double2 (real part in x, imaginary part in y)
+typedef struct _float2 { float x, y; } float2;
+typedef struct _double2 { double x, y; } double2;
+
+// converts between float and half (round to nearest even)
+half_t floatToHalf(float f);
+float halfToFloat(half_t h);
+
+// converts n values between float and half
+void convertToHalf(const float* in, half_t* out, long long n);
+void convertFromHalf(const half_t* in, float* out, long long n);
+
+// C = A * B in single precision
+void gemmF32(float* C, const float* A, const float* B, int M, int N, int K);
+
+// the element-wise operations fused into gemmF32Ex, applied in this order:
+//   C = alpha * A * B + beta * C      (C is not read if beta is 0)
+//   C = C + bias                      (bias has one entry per column)
+//   C = max(C, 0)                     (ReLU)
+//   C = min(max(C, lo), hi)
+typedef struct _mm_epilogue {
+    float alpha;
+    float beta;
+    const float* bias;      // < NULL for none
+    int relu;               // < non-zero for applying ReLU
+    float lo, hi;           // < -INFINITY / INFINITY for no clamping
+} mm_epilogue;
+
+// the epilogue computing C = A * B
+mm_epilogue defaultEpilogue();
+
+// applies the epilogue to the product x and the previous value c of an element in column j
+static inline float applyEpilogue(const mm_epilogue* ep, float x, float c, int j);
+
+// C = epilogue(A * B) in single precision, every element of C is written exactly once
+void gemmF32Ex(float* C, const float* A, const float* B, int M, int N, int K, const mm_epilogue* ep);
+
+// C = A * B with half precision inputs, accumulating in single precision
+void gemmF16(float* C, const half_t* A, const half_t* B, int M, int N, int K);
+
+// C = A * B in double precision
+void gemmF64(double* C, const double* A, const double* B, int M, int N, int K);
+
+// C = A * B for complex numbers in single / double precision
+void gemmC64(float2* C, const float2* A, const float2* B, int M, int N, int K);
+void gemmC128(double2* C, const double2* A, const double2* B, int M, int N, int K);
+
+// C = A * B for int8 inputs with int32 results -- B is given transposed (N x K),
+// such that both operands of each dot product are contiguous in memory
+void gemmI8(int32_t* C, const int8_t* A, const int8_t* Bt, int M, int N, int K);
+
+// transposes the R x S int8 matrix in into the S x R matrix out
+void transposeI8(const int8_t* in, int8_t* out, int R, int S);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+half_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t exp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+
+    // infinity and NaN
+    if (exp == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+    int e = (int)exp - 127 + 15;
+
+    // overflow => infinity
+    if (e >= 31) return sign | 0x7c00;
+
+    // underflow => subnormal or zero
+    if (e <= 0) {
+        if (e < -10) return sign;
+        mant |= 0x800000;
+        int shift = 14 - e;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) h++;
+        return sign | h;
+    }
+
+    // normal numbers, a carry out of the mantissa correctly rounds up to the next exponent (or infinity)
+    uint32_t h = ((uint32_t)e << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | h;
+}
+
+float halfToFloat(half_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0 && mant == 0) {
+        x = sign;
+    } else if (exp == 0) {
+        // subnormal => normalize
+        int e = -1;
+        do {
+            e++;
+            mant <<= 1;
+        } while (!(mant & 0x400));
+        x = sign | ((uint32_t)(127 - 15 - e) << 23) | ((mant & 0x3ff) << 13);
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+}
+
+void convertToHalf(const float* in, half_t* out, long long n) {
+    long long i = 0;
+#ifdef __F16C__
+    #pragma omp parallel for schedule(static)
+    for(long long b = 0; b < n/8; b++) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + b*8), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(out + b*8), h);
+    }
+    i = n - n%8;
+#endif
+    for(; i < n; i++) out[i] = floatToHalf(in[i]);
+}
+
+void convertFromHalf(const half_t* in, float* out, long long n) {
+    long long i = 0;
+#ifdef __F16C__
+    #pragma omp parallel for schedule(static)
+    for(long long b = 0; b < n/8; b++) {
+        __m256 f = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + b*8)));
+        _mm256_storeu_ps(out + b*8, f);
+    }
+    i = n - n%8;
+#endif
+    for(; i < n; i++) out[i] = halfToFloat(in[i]);
+}
+
+void gemmF32(float* C, const float* A, const float* B, int M, int N, int K) {
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i<M; i++) {
+        // i-k-j order, such that the inner loop walks along rows of B and C
+        for(long long j = 0; j<N; j++) {
+            C[i*N+j] = 0;
+        }
+        for(long long k=0; k<K; k++) {
+            float a = A[i*K+k];
+            for(long long j=0; j<N; j++) {
+                C[i*N+j] += a * B[k*N+j];
+            }
+        }
+    }
+}
+
+mm_epilogue defaultEpilogue() {
+    mm_epilogue ep = { 1.0f, 0.0f, NULL, 0, -INFINITY, INFINITY };
+    return ep;
+}
+
+static inline float applyEpilogue(const mm_epilogue* ep, float x, float c, int j) {
+    float res = ep->alpha * x + ep->beta * c;
+    if (ep->bias) res += ep->bias[j];
+    if (ep->relu) res = fmaxf(res, 0.0f);
+    return fminf(fmaxf(res, ep->lo), ep->hi);
+}
+
+void gemmF32Ex(float* C, const float* A, const float* B, int M, int N, int K, const mm_epilogue* ep) {
+    #pragma omp parallel
+    {
+        // a row is accumulated in a cache-resident buffer, the epilogue is applied when storing it
+        float* acc = (float*)malloc(sizeof(float) * N);
+
+        #pragma omp for schedule(static)
+        for(long long i = 0; i<M; i++) {
+            for(long long j = 0; j<N; j++) {
+                acc[j] = 0;
+            }
+            for(long long k=0; k<K; k++) {
+                float a = A[i*K+k];
+                for(long long j=0; j<N; j++) {
+                    acc[j] += a * B[k*N+j];
+                }
+            }
+            for(long long j = 0; j<N; j++) {
+                float c = (ep->beta != 0) ? C[i*N+j] : 0;
+                C[i*N+j] = applyEpilogue(ep, acc[j], c, j);
+            }
+        }
+
+        free(acc);
+    }
+}
+
+void gemmF16(float* C, const half_t* A, const half_t* B, int M, int N, int K) {
+    // widening the inputs once is exact and cheaper than converting inside the O(N^3) loop
+    float* Af = (float*)malloc(sizeof(float) * M * K);
+    float* Bf = (float*)malloc(sizeof(float) * K * N);
+    convertFromHalf(A, Af, (long long)M * K);
+    convertFromHalf(B, Bf, (long long)K * N);
+    gemmF32(C, Af, Bf, M, N, K);
+    free(Af);
+    free(Bf);
+}
+
+#define MM_TYPE MM_F64
+#include "mm_generic.h"
+
+#define MM_TYPE MM_C64
+#include "mm_generic.h"
+
+#define MM_TYPE MM_C128
+#include "mm_generic.h"
+
+void transposeI8(const int8_t* in, int8_t* out, int R, int S) {
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i<R; i++) {
+        for(long long j = 0; j<S; j++) {
+            out[j*R+i] = in[i*S+j];
+        }
+    }
+}
+
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+
+// VNNI multiplies unsigned with signed bytes, thus A is shifted by +128 and
+// the surplus 128 * sum_k b_kj is subtracted from the result
+void gemmI8(int32_t* C, const int8_t* A, const int8_t* Bt, int M, int N, int K) {
+    uint8_t* Au = (uint8_t*)malloc((size_t)M * K);
+    int32_t* colSum = (int32_t*)malloc(sizeof(int32_t) * N);
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i < (long long)M*K; i++) Au[i] = (uint8_t)(A[i] + 128);
+    #pragma omp parallel for schedule(static)
+    for(long long j = 0; j<N; j++) {
+        int32_t sum = 0;
+        for(long long k = 0; k<K; k++) sum += Bt[j*K+k];
+        colSum[j] = sum;
+    }
+
+    __mmask64 tail = (K % 64) ? ((__mmask64)1 << (K % 64)) - 1 : 0;
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i<M; i++) {
+        const uint8_t* a = Au + i*K;
+        for(long long j = 0; j<N; j++) {
+            const int8_t* b = Bt + j*K;
+            __m512i acc = _mm512_setzero_si512();
+            long long k = 0;
+            for(; k + 64 <= K; k += 64) {
+                acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a + k), _mm512_loadu_si512(b + k));
+            }
+            if (tail) {
+                acc = _mm512_dpbusd_epi32(acc, _mm512_maskz_loadu_epi8(tail, a + k), _mm512_maskz_loadu_epi8(tail, b + k));
+            }
+            C[i*N+j] = _mm512_reduce_add_epi32(acc) - 128 * colSum[j];
+        }
+    }
+
+    free(Au);
+    free(colSum);
+}
+
+#elif defined(__AVXVNNI__)
+
+// same as above, using the 256-bit VEX encoded VNNI instructions
+void gemmI8(int32_t* C, const int8_t* A, const int8_t* Bt, int M, int N, int K) {
+    uint8_t* Au = (uint8_t*)malloc((size_t)M * K);
+    int32_t* colSum = (int32_t*)malloc(sizeof(int32_t) * N);
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i < (long long)M*K; i++) Au[i] = (uint8_t)(A[i] + 128);
+    #pragma omp parallel for schedule(static)
+    for(long long j = 0; j<N; j++) {
+        int32_t sum = 0;
+        for(long long k = 0; k<K; k++) sum += Bt[j*K+k];
+        colSum[j] = sum;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i<M; i++) {
+        const uint8_t* a = Au + i*K;
+        for(long long j = 0; j<N; j++) {
+            const int8_t* b = Bt + j*K;
+            __m256i acc = _mm256_setzero_si256();
+            long long k = 0;
+            for(; k + 32 <= K; k += 32) {
+                acc = _mm256_dpbusd_avx_epi32(acc, _mm256_loadu_si256((const __m256i*)(a + k)), _mm256_loadu_si256((const __m256i*)(b + k)));
+            }
+            int32_t lanes[8];
+            _mm256_storeu_si256((__m256i*)lanes, acc);
+            int32_t sum = 0;
+            for(int l = 0; l<8; l++) sum += lanes[l];
+            for(; k<K; k++) sum += (int32_t)a[k] * b[k];
+            C[i*N+j] = sum - 128 * colSum[j];
+        }
+    }
+
+    free(Au);
+    free(colSum);
+}
+
+#else
+
+void gemmI8(int32_t* C, const int8_t* A, const int8_t* Bt, int M, int N, int K) {
+    #pragma omp parallel for schedule(static)
+    for(long long i = 0; i<M; i++) {
+        const int8_t* a = A + i*K;
+        for(long long j = 0; j<N; j++) {
+            const int8_t* b = Bt + j*K;
+            // the compiler turns this into widening multiply-add instructions
+            int32_t sum = 0;
+            for(long long k = 0; k<K; k++) {
+                sum += (int32_t)a[k] * b[k];
+            }
+            C[i*N+j] = sum;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,193 @@
+// A tiled matrix multiplication, parametrized by its element type and shared by the
+// CPU engine (mm_cpu.h) and the OpenCL kernels (mat_mul_generic.cl).
+//
+// This file is a template: it has no include guard and is included once per element
+// type, selected by defining MM_TYPE before every inclusion as one of
+//
+//   MM_F64   ... double
+//   MM_C64   ... single precision complex numbers (float2, real part in x)
+//   MM_C128  ... double precision complex numbers (double2)
+//
+// Every inclusion generates, for the type T and its suffix S / s (e.g. F64 / f64),
+//
+//   C:      void gemmS(T* C, const T* A, const T* B, int M, int N, int K)
+//   OpenCL: __kernel void mat_mul_s(__global T* c, __global const T* a, __global const T* b, int N)
+//
+// Both split the matrices into MM_TILE x MM_TILE tiles. A and B tiles are copied to
+// local memory (OpenCL) or a per-thread buffer (CPU), zero padded at the borders, and
+// multiplied by the same micro kernel multiplyTileRowS -- the OpenCL kernel computes a
+// single element per work item, the CPU a whole row of the tile at a time. Work groups
+// thus have to be MM_TILE x MM_TILE work items.
+//
+// On the host, float2 / double2 are structs with the same layout as their OpenCL
+// counterparts (see mm_cpu.h), such that complex matrices are transferred as they are.
+
+#define MM_F64  1
+#define MM_C64  2
+#define MM_C128 3
+
+#ifndef MM_TILE
+#define MM_TILE 16
+#endif
+
+#ifndef MM_TYPE
+#error "MM_TYPE has to be defined before including mm_generic.h"
+#endif
+
+
+// -- language specific parts --
+
+#ifdef __OPENCL_VERSION__
+
+#define MM_FUNCTION
+#define MM_TILE_SPACE __local
+
+#else
+
+// float2 and double2 are provided by mm_cpu.h
+#define MM_FUNCTION static inline
+#define MM_TILE_SPACE
+
+#endif
+
+
+// -- element types --
+
+#if MM_TYPE == MM_F64
+#define MM_T double
+#define MM_COMPLEX 0
+#define MM_NAME(f) f##F64
+#define MM_KERNEL mat_mul_f64
+#elif MM_TYPE == MM_C64
+#define MM_T float2
+#define MM_COMPLEX 1
+#define MM_NAME(f) f##C64
+#define MM_KERNEL mat_mul_c64
+#elif MM_TYPE == MM_C128
+#define MM_T double2
+#define MM_COMPLEX 1
+#define MM_NAME(f) f##C128
+#define MM_KERNEL mat_mul_c128
+#else
+#error "Unsupported MM_TYPE"
+#endif
+
+
+// the additive identity
+MM_FUNCTION MM_T MM_NAME(zero)() {
+    MM_T res;
+#if MM_COMPLEX
+    res.x = 0;
+    res.y = 0;
+#else
+    res = 0;
+#endif
+    return res;
+}
+
+// c + a * b
+MM_FUNCTION MM_T MM_NAME(mulAdd)(MM_T a, MM_T b, MM_T c) {
+#if MM_COMPLEX
+    MM_T res;
+    res.x = c.x + a.x * b.x - a.y * b.y;
+    res.y = c.y + a.x * b.y + a.y * b.x;
+    return res;
+#else
+    return c + a * b;
+#endif
+}
+
+// acc[j - j0] += a_row * b for the columns j0 <= j < j1 of the tile b, a_row being a row of an A tile
+MM_FUNCTION void MM_NAME(multiplyTileRow)(MM_T* acc, const MM_TILE_SPACE MM_T* a_row, const MM_TILE_SPACE MM_T* b, int j0, int j1) {
+    for(int k = 0; k < MM_TILE; k++) {
+        MM_T a = a_row[k];
+        for(int j = j0; j < j1; j++) {
+            acc[j - j0] = MM_NAME(mulAdd)(a, b[k*MM_TILE + j], acc[j - j0]);
+        }
+    }
+}
+
+
+#ifdef __OPENCL_VERSION__
+
+__kernel void MM_KERNEL(
+    __global MM_T* c,
+    __global const MM_T* a,
+    __global const MM_T* b,
+    int N
+) {
+    const int li = get_local_id(1);
+    const int lj = get_local_id(0);
+    const int i = get_group_id(1) * MM_TILE + li;
+    const int j = get_group_id(0) * MM_TILE + lj;
+
+    __local MM_T As[MM_TILE * MM_TILE];
+    __local MM_T Bs[MM_TILE * MM_TILE];
+
+    MM_T acc = MM_NAME(zero)();
+    for(int t = 0; t < N; t += MM_TILE) {
+
+        // load the tiles A[i..,t..] and B[t..,j..], zero padded
+        As[li*MM_TILE + lj] = (i < N && t+lj < N) ? a[i*N + t+lj] : MM_NAME(zero)();
+        Bs[li*MM_TILE + lj] = (t+li < N && j < N) ? b[(t+li)*N + j] : MM_NAME(zero)();
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        MM_NAME(multiplyTileRow)(&acc, &As[li*MM_TILE], Bs, lj, lj+1);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (i < N && j < N) c[i*N + j] = acc;
+}
+
+#else
+
+void MM_NAME(gemm)(MM_T* C, const MM_T* A, const MM_T* B, int M, int N, int K) {
+    #pragma omp parallel
+    {
+        MM_T* As = (MM_T*)malloc(sizeof(MM_T) * MM_TILE * MM_TILE);
+        MM_T* Bs = (MM_T*)malloc(sizeof(MM_T) * MM_TILE * MM_TILE);
+        MM_T* acc = (MM_T*)malloc(sizeof(MM_T) * MM_TILE * MM_TILE);
+
+        // the tiles of C are distributed like rows elsewhere, a row of tiles per iteration
+        #pragma omp for schedule(static)
+        for(int ti = 0; ti < M; ti += MM_TILE) {
+            for(int tj = 0; tj < N; tj += MM_TILE) {
+                for(int e = 0; e < MM_TILE * MM_TILE; e++) acc[e] = MM_NAME(zero)();
+
+                for(int t = 0; t < K; t += MM_TILE) {
+                    for(int i = 0; i < MM_TILE; i++) {
+                        for(int j = 0; j < MM_TILE; j++) {
+                            As[i*MM_TILE + j] = (ti+i < M && t+j < K) ? A[(long long)(ti+i)*K + t+j] : MM_NAME(zero)();
+                            Bs[i*MM_TILE + j] = (t+i < K && tj+j < N) ? B[(long long)(t+i)*N + tj+j] : MM_NAME(zero)();
+                        }
+                    }
+                    for(int i = 0; i < MM_TILE; i++) {
+                        MM_NAME(multiplyTileRow)(&acc[i*MM_TILE], &As[i*MM_TILE], Bs, 0, MM_TILE);
+                    }
+                }
+
+                for(int i = 0; i < MM_TILE && ti+i < M; i++) {
+                    for(int j = 0; j < MM_TILE && tj+j < N; j++) {
+                        C[(long long)(ti+i)*N + tj+j] = acc[i*MM_TILE + j];
+                    }
+                }
+            }
+        }
+
+        free(As);
+        free(Bs);
+        free(acc);
+    }
+}
+
+#endif
+
+
+// ready for the next inclusion
+#undef MM_TYPE
+#undef MM_T
+#undef MM_COMPLEX
+#undef MM_NAME
+#undef MM_KERNEL
+#undef MM_FUNCTION
+#undef MM_TILE_SPACE
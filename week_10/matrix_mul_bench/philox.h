@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+
+// A counter-based random number generator (Philox4x32-10, Salmon et al., SC'11).
+//
+// Each call maps a 128-bit counter and a 64-bit key to 128 random bits without any
+// internal state. Element e of a matrix thus gets its random value from counter e,
+// so matrices can be filled in parallel and the result does not depend on the
+// number of threads or the iteration order.
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _philox_ctr {
+    uint32_t v[4];
+} philox_ctr;
+
+// computes 4 random 32-bit values for the given counter and key
+philox_ctr philox4x32(philox_ctr ctr, uint64_t key);
+
+// fills the N x M matrix m with uniformly distributed values in [lo,hi)
+// the result only depends on (seed, stream), different streams give independent matrices
+void fillMatrixRandom(float* m, int N, int M, uint64_t seed, uint32_t stream, float lo, float hi);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+philox_ctr philox4x32(philox_ctr ctr, uint64_t key) {
+    uint32_t k0 = (uint32_t)key;
+    uint32_t k1 = (uint32_t)(key >> 32);
+    for(int r=0; r<10; r++) {
+        // bump the key between rounds
+        if (r > 0) {
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        uint64_t p0 = (uint64_t)PHILOX_M0 * ctr.v[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * ctr.v[2];
+        philox_ctr next = {{
+            (uint32_t)(p1 >> 32) ^ ctr.v[1] ^ k0,
+            (uint32_t)p1,
+            (uint32_t)(p0 >> 32) ^ ctr.v[3] ^ k1,
+            (uint32_t)p0
+        }};
+        ctr = next;
+    }
+    return ctr;
+}
+
+void fillMatrixRandom(float* m, int N, int M, uint64_t seed, uint32_t stream, float lo, float hi) {
+    long long size = (long long)N * M;
+    long long blocks = (size + 3) / 4;
+
+    // each counter value provides 4 consecutive elements
+    #pragma omp parallel for schedule(static)
+    for(long long b = 0; b < blocks; b++) {
+        philox_ctr ctr = {{ (uint32_t)b, (uint32_t)(b >> 32), stream, 0 }};
+        philox_ctr rnd = philox4x32(ctr, seed);
+        for(int l=0; l<4; l++) {
+            long long e = b*4 + l;
+            if (e >= size) break;
+            // use the upper 24 bits, which are exactly representable as a float
+            float u = (rnd.v[l] >> 8) * (1.0f / 16777216.0f);
+            m[e] = lo + u * (hi - lo);
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+// An on-disk cache for reference results of the matrix multiplication benchmark.
+//
+// Since inputs are generated by a counter-based RNG, a reference result is fully
+// determined by its precision, the problem size N and the seed. Results are stored in
+// REF_CACHE_DIR/ref_<precision>_N<N>_s<seed>.bin such that repeated benchmark sessions
+// can skip the O(N^3) reference computation.
+
+
+#define REF_CACHE_DIR "ref_cache"
+
+// to be increased whenever the input generation changes, invalidating old entries
+#define REF_CACHE_VERSION 2
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+// tries to load the N x N reference result for (tag,N,seed) into R, returns false if not cached
+bool loadReference(void* R, size_t elem_size, const char* tag, int N, uint64_t seed);
+
+// stores the N x N reference result R for (tag,N,seed) in the cache
+void storeReference(const void* R, size_t elem_size, const char* tag, int N, uint64_t seed);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+typedef struct _ref_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t elem_size;
+    int32_t N;
+    uint64_t seed;
+    uint64_t checksum;
+} ref_cache_header;
+
+uint64_t refCacheChecksum(const void* R, long long bytes_size) {
+    // FNV-1a over the raw bytes
+    const unsigned char* bytes = (const unsigned char*)R;
+    uint64_t hash = 14695981039346656037ull;
+    for(long long i = 0; i < bytes_size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void refCacheFileName(char* buffer, size_t len, const char* tag, int N, uint64_t seed) {
+    snprintf(buffer, len, "%s/ref_%s_N%d_s%llu.bin", REF_CACHE_DIR, tag, N, (unsigned long long)seed);
+}
+
+bool loadReference(void* R, size_t elem_size, const char* tag, int N, uint64_t seed) {
+    char fn[256];
+    refCacheFileName(fn, sizeof(fn), tag, N, seed);
+
+    FILE* fp = fopen(fn, "rb");
+    if (!fp) return false;
+
+    long long size = (long long)N * N;
+    ref_cache_header header;
+    bool valid = fread(&header, sizeof(header), 1, fp) == 1
+        && !memcmp(header.magic, "MMREF", 6)
+        && header.version == REF_CACHE_VERSION
+        && header.elem_size == elem_size
+        && header.N == N
+        && header.seed == seed
+        && fread(R, elem_size, size, fp) == (size_t)size
+        && refCacheChecksum(R, size * elem_size) == header.checksum;
+    fclose(fp);
+
+    if (!valid) fprintf(stderr, "Ignoring invalid reference cache file %s\n", fn);
+    return valid;
+}
+
+void storeReference(const void* R, size_t elem_size, const char* tag, int N, uint64_t seed) {
+    // the cache directory may already exist
+    mkdir(REF_CACHE_DIR, 0755);
+
+    char fn[256], tmp[272];
+    refCacheFileName(fn, sizeof(fn), tag, N, seed);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+
+    long long size = (long long)N * N;
+    ref_cache_header header = { "MMREF", REF_CACHE_VERSION, elem_size, N, seed, refCacheChecksum(R, size * elem_size) };
+
+    // write to a temporary file first, such that concurrent sessions never see partial entries
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp) {
+        fprintf(stderr, "Unable to write reference cache file %s\n", tmp);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(R, elem_size, size, fp) == (size_t)size;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp, fn) != 0) {
+        fprintf(stderr, "Unable to write reference cache file %s\n", fn);
+        remove(tmp);
+    }
+}
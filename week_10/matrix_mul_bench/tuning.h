@@ -0,0 +1,267 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cl_utils.h"
+
+// Autotuning support for the parameterized GEMM kernel in mat_mul_tuned.cl.
+//
+// A configuration fixes the build options of the kernel. The search space is
+// enumerated, configurations which can not run on the device are dropped and the
+// remaining ones are ranked by a simple roofline cost model, such that only the
+// most promising ones have to be benchmarked.
+//
+// The best configuration per (device, size bucket) is kept in a plain text file,
+// one entry per line:
+//
+//     <bucket> <TS> <WPT> <VW> <UNROLL> <USE_LOCAL> <GFLOPS> <device name>
+//
+// where the size bucket of N is floor(log2(N)).
+
+
+#define TUNING_FILE "mm_tuning.txt"
+
+// the number of configurations benchmarked per problem size after pruning
+#define TUNING_MAX_CANDIDATES 16
+
+// the maximum number of accumulators per work item (WPT*VW), more would spill registers
+#define TUNING_MAX_ACCUMULATORS 32
+
+// the minimum work group size, smaller groups leave SIMD lanes idle
+#define TUNING_MIN_GROUP_SIZE 32
+
+// the assumed number of flops the device can perform per byte loaded from global memory
+#define TUNING_MACHINE_BALANCE 8.0
+
+// the same for bytes loaded from local memory or registers shared within a work group
+#define TUNING_ONCHIP_BALANCE 0.5
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _mm_tuning_config {
+    int ts;             // < tile size
+    int wpt;            // < work (rows) per work item
+    int vw;             // < vector width (columns per work item)
+    int unroll;         // < unroll factor of the k loop
+    int use_local;      // < whether tiles are staged in local memory
+} mm_tuning_config;
+
+typedef struct _mm_tuning_entry {
+    char device[256];
+    int bucket;
+    mm_tuning_config config;
+    double gflops;
+} mm_tuning_entry;
+
+typedef struct _mm_tuning_table {
+    mm_tuning_entry* entries;
+    int size;
+} mm_tuning_table;
+
+// the size bucket of problem size N
+int sizeBucket(int N);
+
+// the build options specializing mat_mul_tuned.cl for the given configuration
+void tuningBuildOptions(const mm_tuning_config* config, char* buffer, size_t len);
+
+// the launch geometry of the tuned kernel for problem size N
+void tuningLaunchSize(const mm_tuning_config* config, int N, size_t global[2], size_t local[2]);
+
+// the estimated cost of a configuration for problem size N, in units of floating point operations
+double tuningCost(const mm_tuning_config* config, int N);
+
+// fills "out" with up to "max" configurations feasible on the given device, cheapest first,
+// returns the number of configurations
+int tuningCandidates(mm_tuning_config* out, int max, cl_device_id device, int N);
+
+// builds a program like cluBuildProgramFromFile, but returns NULL instead of aborting on errors
+cl_program tuningBuildProgram(cl_context context, cl_device_id device, const char* fn, const char* options);
+
+// loads the tuning table from the given file, a missing file gives an empty table
+mm_tuning_table loadTuningTable(const char* fn);
+
+// obtains the configuration for the given device and size bucket, NULL if there is none
+const mm_tuning_config* lookupTuning(const mm_tuning_table* table, const char* device, int bucket);
+
+// adds or replaces the entry for the given device and size bucket
+void updateTuning(mm_tuning_table* table, const char* device, int bucket, mm_tuning_config config, double gflops);
+
+// writes the tuning table to the given file
+void storeTuningTable(const mm_tuning_table* table, const char* fn);
+
+void releaseTuningTable(mm_tuning_table table);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+int sizeBucket(int N) {
+    int bucket = 0;
+    while ((N >> (bucket+1)) > 0) bucket++;
+    return bucket;
+}
+
+void tuningBuildOptions(const mm_tuning_config* config, char* buffer, size_t len) {
+    snprintf(buffer, len, "-DTS=%d -DWPT=%d -DVW=%d -DUNROLL=%d -DUSE_LOCAL=%d",
+        config->ts, config->wpt, config->vw, config->unroll, config->use_local);
+}
+
+void tuningLaunchSize(const mm_tuning_config* config, int N, size_t global[2], size_t local[2]) {
+    size_t padded = (N + config->ts - 1) / config->ts * config->ts;
+    local[0] = config->ts / config->vw;
+    local[1] = config->ts / config->wpt;
+    global[0] = padded / config->vw;
+    global[1] = padded / config->wpt;
+}
+
+double tuningCost(const mm_tuning_config* config, int N) {
+    double padded = ceil((double)N / config->ts) * config->ts;
+
+    // with local memory, every work group loads TS x padded elements of A and B;
+    // without, every work item loads a column of A per row and a row of B per column
+    double loads_per_result = (config->use_local)
+        ? 2.0 * padded / config->ts
+        : padded * (1.0 / config->vw + 1.0 / config->wpt);
+    double bytes = padded * padded * loads_per_result * sizeof(float);
+    double flops = 2.0 * padded * padded * padded;
+
+    // the local memory tiles are read once per row (WPT) and column (VW) computed by a work item
+    double onchip_bytes = (config->use_local)
+        ? padded * padded * padded * (1.0 / config->vw + 1.0 / config->wpt) * sizeof(float)
+        : 0;
+
+    // roofline: whatever is the bottleneck determines the time, on-chip traffic
+    // is cheaper but not free (and breaks ties between otherwise equal tiles)
+    return fmax(flops, bytes * TUNING_MACHINE_BALANCE) + onchip_bytes * TUNING_ONCHIP_BALANCE;
+}
+
+int tuningCandidates(mm_tuning_config* out, int max, cl_device_id device, int N) {
+    static const int TILE_SIZES[] = { 8, 16, 32, 64 };
+    static const int WORK_PER_ITEM[] = { 1, 2, 4, 8 };
+    static const int VECTOR_WIDTHS[] = { 1, 2, 4, 8 };
+    static const int UNROLL_FACTORS[] = { 1, 4, 8 };
+
+    size_t max_group_size;
+    cl_ulong local_mem;
+    CLU_ERRCHECK(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, NULL), "Failed to get max work group size");
+    CLU_ERRCHECK(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem), &local_mem, NULL), "Failed to get local memory size");
+
+    // enumerate all feasible configurations
+    int num = 0;
+    mm_tuning_config all[4*4*4*3*2];
+    for(int t=0; t<4; t++) for(int w=0; w<4; w++) for(int v=0; v<4; v++) for(int u=0; u<3; u++) for(int l=0; l<2; l++) {
+        mm_tuning_config c = { TILE_SIZES[t], WORK_PER_ITEM[w], VECTOR_WIDTHS[v], UNROLL_FACTORS[u], l };
+        size_t group_size = (size_t)(c.ts / c.vw) * (c.ts / c.wpt);
+        if (c.ts % c.wpt || c.ts % c.vw) continue;
+        if (c.wpt * c.vw > TUNING_MAX_ACCUMULATORS) continue;
+        if (group_size < TUNING_MIN_GROUP_SIZE || group_size > max_group_size) continue;
+        if (c.use_local && 2 * c.ts * c.ts * sizeof(float) > local_mem) continue;
+        if (c.ts > N) continue;
+        all[num++] = c;
+    }
+
+    // keep the cheapest ones (selection sort, the space is small)
+    int count = (num < max) ? num : max;
+    for(int i=0; i<count; i++) {
+        int best = i;
+        for(int j=i+1; j<num; j++) {
+            if (tuningCost(&all[j], N) < tuningCost(&all[best], N)) best = j;
+        }
+        mm_tuning_config tmp = all[i];
+        all[i] = all[best];
+        all[best] = tmp;
+        out[i] = all[i];
+    }
+    return count;
+}
+
+cl_program tuningBuildProgram(cl_context context, cl_device_id device, const char* fn, const char* options) {
+    cl_int err;
+    char *source_str = (char*)malloc(MAX_KERNEL_SOURCE * sizeof(char));
+    cluLoadSource(fn, MAX_KERNEL_SOURCE, source_str);
+    const char *sources[1] = { source_str };
+    cl_program program = clCreateProgramWithSource(context, 1, sources, NULL, &err);
+    CLU_ERRCHECK(err, "Failed to create program from source file: %s", fn);
+    free(source_str);
+
+    // configurations may exceed device limits only detected by the compiler (e.g. registers)
+    err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        CLU_ERRCHECK(clReleaseProgram(program), "Failed to release program");
+        return NULL;
+    }
+    return program;
+}
+
+mm_tuning_table loadTuningTable(const char* fn) {
+    mm_tuning_table table = { NULL, 0 };
+    FILE* fp = fopen(fn, "r");
+    if (!fp) return table;
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        mm_tuning_entry e;
+        int offset = 0;
+        int read = sscanf(line, "%d %d %d %d %d %d %lf %n", &e.bucket, &e.config.ts, &e.config.wpt,
+            &e.config.vw, &e.config.unroll, &e.config.use_local, &e.gflops, &offset);
+        if (read != 7 || offset == 0) {
+            fprintf(stderr, "Ignoring invalid line in tuning file %s: %s", fn, line);
+            continue;
+        }
+        // the rest of the line is the device name
+        snprintf(e.device, sizeof(e.device), "%s", line + offset);
+        e.device[strcspn(e.device, "\r\n")] = '\0';
+        updateTuning(&table, e.device, e.bucket, e.config, e.gflops);
+    }
+    fclose(fp);
+    return table;
+}
+
+const mm_tuning_config* lookupTuning(const mm_tuning_table* table, const char* device, int bucket) {
+    for(int i=0; i<table->size; i++) {
+        if (table->entries[i].bucket == bucket && !strcmp(table->entries[i].device, device)) {
+            return &table->entries[i].config;
+        }
+    }
+    return NULL;
+}
+
+void updateTuning(mm_tuning_table* table, const char* device, int bucket, mm_tuning_config config, double gflops) {
+    mm_tuning_entry* e = NULL;
+    for(int i=0; i<table->size; i++) {
+        if (table->entries[i].bucket == bucket && !strcmp(table->entries[i].device, device)) {
+            e = &table->entries[i];
+        }
+    }
+    if (!e) {
+        table->entries = realloc(table->entries, sizeof(mm_tuning_entry) * (table->size + 1));
+        e = &table->entries[table->size++];
+        snprintf(e->device, sizeof(e->device), "%s", device);
+        e->bucket = bucket;
+    }
+    e->config = config;
+    e->gflops = gflops;
+}
+
+void storeTuningTable(const mm_tuning_table* table, const char* fn) {
+    FILE* fp = fopen(fn, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to write tuning file %s\n", fn);
+        return;
+    }
+    fprintf(fp, "# bucket TS WPT VW UNROLL USE_LOCAL GFLOPS device\n");
+    for(int i=0; i<table->size; i++) {
+        const mm_tuning_entry* e = &table->entries[i];
+        fprintf(fp, "%d %d %d %d %d %d %.3f %s\n", e->bucket, e->config.ts, e->config.wpt,
+            e->config.vw, e->config.unroll, e->config.use_local, e->gflops, e->device);
+    }
+    fclose(fp);
+}
+
+void releaseTuningTable(mm_tuning_table table) {
+    free(table.entries);
+}
@@ -0,0 +1,489 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+// Verification of matrix products C = A * B of size N x N.
+//
+// A float dot product of length N carries a rounding error of up to
+// N * eps/2 * sum_k |a_ik * b_kj|, with the actual error depending on the
+// summation order. Any reordered (e.g. tiled or vectorized) kernel thus deviates
+// from the reference, so results are accepted if the deviation is within this
+// bound instead of requiring bit-identical results.
+//
+// Two checks are offered:
+//  - a full comparison with a reference result R, reporting relative errors and ULPs
+//  - Freivalds' randomized check testing C*x == A*(B*x) for random vectors x in O(N^2)
+//
+// For the full comparison, relative errors are reported with respect to |R|, which
+// for the non-negative inputs used by the benchmark coincides with |A|*|B|.
+//
+// For Freivalds' check, the per-element errors E of C enter (C*x)_i as sum_j E_ij * x_j,
+// which the bound above limits to N * eps/2 * (|A|*(|B|*|x|))_i -- computed in O(N^2)
+// alongside the check, errors are reported relative to it. Rounding errors of random sign
+// cancel in this sum, but so do wrong elements if x has random signs. Thus every other
+// round uses a vector with entries in [0,1], such that errors of a consistent sign (like
+// terms missing from every dot product) add up instead.
+//
+// Double precision results are checked the same way with DBL_EPSILON (Freivalds' check
+// then accumulates in long double), integer results have to match exactly. Complex
+// results are checked on their moduli, with twice the tolerance since every complex
+// multiply-add rounds twice per component.
+
+
+// the safety factor applied to the theoretical error bound N * eps
+#define VERIFY_TOLERANCE_FACTOR 1.0
+
+// the number of random vectors tested by Freivalds' check, alternating non-negative and signed ones
+#define FREIVALDS_ROUNDS 2
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+typedef struct _mm_error_stats {
+    bool success;           // < whether all errors are within the tolerance
+    double tolerance;       // < the relative tolerance applied
+    double max_rel_error;   // < the maximum relative error encountered
+    double mean_rel_error;  // < the mean relative error (over elements or rows)
+    long long max_ulps;     // < the maximum distance in ULPs (full comparison only, -1 otherwise)
+    long long num_failed;   // < the number of elements (or rows) exceeding the tolerance
+} mm_error_stats;
+
+// the relative tolerance for a float product with inner dimension N
+double verifyTolerance(int N);
+
+// compares C element-wise with the reference result R
+mm_error_stats verifyWithReference(const float* C, const float* R, int N);
+
+// checks C == A * B using Freivalds' algorithm with FREIVALDS_ROUNDS random vectors
+mm_error_stats verifyFreivalds(const float* A, const float* B, const float* C, int N, unsigned seed);
+
+// the double precision versions of the checks above
+mm_error_stats verifyWithReferenceF64(const double* C, const double* R, int N);
+mm_error_stats verifyFreivaldsF64(const double* A, const double* B, const double* C, int N, unsigned seed);
+
+// the complex versions, matrices given as interleaved (real, imaginary) pairs of doubles and
+// eps being the machine epsilon of the computation (FLT_EPSILON or DBL_EPSILON)
+mm_error_stats verifyWithReferenceComplex(const double* C, const double* R, int N, double eps);
+mm_error_stats verifyFreivaldsComplex(const double* A, const double* B, const double* C, int N, double eps, unsigned seed);
+
+// exact checks for int8 x int8 -> int32 products, B is given transposed
+mm_error_stats verifyWithReferenceI32(const int32_t* C, const int32_t* R, int N);
+mm_error_stats verifyFreivaldsI8(const int8_t* A, const int8_t* Bt, const int32_t* C, int N, unsigned seed);
+
+// prints a one-line summary of the given error statistics
+void printErrorStats(mm_error_stats stats);
+
+// the distance of two floats in units in the last place
+long long ulpDistance(float a, float b);
+
+// the next entry of the random vector of the given round of Freivalds' check, in [0,1] for
+// even rounds and in [-1,1] for odd ones -- continuous values avoid cancellation of errors
+static inline double freivaldsEntry(uint32_t* state, int round);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+double verifyTolerance(int N) {
+    return VERIFY_TOLERANCE_FACTOR * N * FLT_EPSILON;
+}
+
+static inline double freivaldsEntry(uint32_t* state, int round) {
+    // a small xorshift generator is sufficient for picking the test vectors
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    double u = *state / (double)UINT32_MAX;
+    return (round % 2) ? u * 2.0 - 1.0 : u;
+}
+
+long long ulpDistance(float a, float b) {
+    // map floats to integers such that adjacent floats are adjacent integers
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(float));
+    memcpy(&ib, &b, sizeof(float));
+    long long la = (ia < 0) ? (long long)INT32_MIN - ia : ia;
+    long long lb = (ib < 0) ? (long long)INT32_MIN - ib : ib;
+    return (la < lb) ? lb - la : la - lb;
+}
+
+mm_error_stats verifyWithReference(const float* C, const float* R, int N) {
+    mm_error_stats res;
+    res.tolerance = verifyTolerance(N);
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long max_ulps = 0;
+    long long failed = 0;
+
+    #pragma omp parallel for reduction(max:max_err,max_ulps) reduction(+:sum_err,failed)
+    for(long long i = 0; i<N; i++) {
+        for(long long j = 0; j<N; j++) {
+            double c = C[i*N+j];
+            double r = R[i*N+j];
+            double scale = fabs(r) > DBL_MIN ? fabs(r) : 1.0;
+            double err = fabs(c - r) / scale;
+
+            // NaN must never pass
+            if (!(err <= res.tolerance)) failed++;
+            if (err != err) err = INFINITY;
+
+            long long ulps = ulpDistance(C[i*N+j], R[i*N+j]);
+            max_err = (err > max_err) ? err : max_err;
+            max_ulps = (ulps > max_ulps) ? ulps : max_ulps;
+            sum_err += err;
+        }
+    }
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*N);
+    res.max_ulps = max_ulps;
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+mm_error_stats verifyFreivalds(const float* A, const float* B, const float* C, int N, unsigned seed) {
+    mm_error_stats res;
+    res.tolerance = verifyTolerance(N);
+    res.max_ulps = -1;
+
+    double* x = (double*)malloc(sizeof(double)*N);
+    double* y = (double*)malloc(sizeof(double)*N);      // < B*x
+    double* u = (double*)malloc(sizeof(double)*N);      // < |B|*|x|
+    double* w = (double*)malloc(sizeof(double)*N);      // < C*x
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long failed = 0;
+
+    uint32_t state = seed * 2654435761u + 1;
+    for(int round = 0; round < FREIVALDS_ROUNDS; round++) {
+        for(int k = 0; k<N; k++) {
+            x[k] = freivaldsEntry(&state, round);
+        }
+
+        // y = B*x, u = |B|*|x| and w = C*x (in double precision)
+        #pragma omp parallel for
+        for(long long i = 0; i<N; i++) {
+            double sb = 0, su = 0, sc = 0;
+            for(long long j = 0; j<N; j++) {
+                sb += B[i*N+j] * x[j];
+                su += fabs(B[i*N+j] * x[j]);
+                sc += C[i*N+j] * x[j];
+            }
+            y[i] = sb;
+            u[i] = su;
+            w[i] = sc;
+        }
+
+        // compare A*y with w row by row, relative to the bound (|A|*u)_i
+        #pragma omp parallel for reduction(max:max_err) reduction(+:sum_err,failed)
+        for(long long i = 0; i<N; i++) {
+            double z = 0, bound = 0;
+            for(long long k = 0; k<N; k++) {
+                z += A[i*N+k] * y[k];
+                bound += fabs((double)A[i*N+k]) * u[k];
+            }
+            double err = fabs(w[i] - z) / ((bound > DBL_MIN) ? bound : 1.0);
+            if (!(err <= res.tolerance)) failed++;
+            if (err != err) err = INFINITY;
+            max_err = (err > max_err) ? err : max_err;
+            sum_err += err;
+        }
+    }
+
+    free(x);
+    free(y);
+    free(u);
+    free(w);
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*FREIVALDS_ROUNDS);
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+mm_error_stats verifyWithReferenceF64(const double* C, const double* R, int N) {
+    mm_error_stats res;
+    res.tolerance = VERIFY_TOLERANCE_FACTOR * N * DBL_EPSILON;
+    res.max_ulps = -1;
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long failed = 0;
+
+    #pragma omp parallel for reduction(max:max_err) reduction(+:sum_err,failed)
+    for(long long i = 0; i<(long long)N*N; i++) {
+        double scale = fabs(R[i]) > DBL_MIN ? fabs(R[i]) : 1.0;
+        double err = fabs(C[i] - R[i]) / scale;
+        if (!(err <= res.tolerance)) failed++;
+        if (err != err) err = INFINITY;
+        max_err = (err > max_err) ? err : max_err;
+        sum_err += err;
+    }
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*N);
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+mm_error_stats verifyFreivaldsF64(const double* A, const double* B, const double* C, int N, unsigned seed) {
+    mm_error_stats res;
+    res.tolerance = VERIFY_TOLERANCE_FACTOR * N * DBL_EPSILON;
+    res.max_ulps = -1;
+
+    long double* x = (long double*)malloc(sizeof(long double)*N);
+    long double* y = (long double*)malloc(sizeof(long double)*N);
+    long double* u = (long double*)malloc(sizeof(long double)*N);
+    long double* w = (long double*)malloc(sizeof(long double)*N);
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long failed = 0;
+
+    uint32_t state = seed * 2654435761u + 1;
+    for(int round = 0; round < FREIVALDS_ROUNDS; round++) {
+        for(int k = 0; k<N; k++) {
+            x[k] = freivaldsEntry(&state, round);
+        }
+
+        // y = B*x, u = |B|*|x| and w = C*x
+        #pragma omp parallel for
+        for(long long i = 0; i<N; i++) {
+            long double sb = 0, su = 0, sc = 0;
+            for(long long j = 0; j<N; j++) {
+                sb += B[i*N+j] * x[j];
+                su += fabsl(B[i*N+j] * x[j]);
+                sc += C[i*N+j] * x[j];
+            }
+            y[i] = sb;
+            u[i] = su;
+            w[i] = sc;
+        }
+
+        // compare A*y with w row by row, relative to the bound (|A|*u)_i
+        #pragma omp parallel for reduction(max:max_err) reduction(+:sum_err,failed)
+        for(long long i = 0; i<N; i++) {
+            long double z = 0, bound = 0;
+            for(long long k = 0; k<N; k++) {
+                z += A[i*N+k] * y[k];
+                bound += fabsl(A[i*N+k]) * u[k];
+            }
+            double err = (double)(fabsl(w[i] - z) / ((bound > DBL_MIN) ? bound : 1.0L));
+            if (!(err <= res.tolerance)) failed++;
+            if (err != err) err = INFINITY;
+            max_err = (err > max_err) ? err : max_err;
+            sum_err += err;
+        }
+    }
+
+    free(x);
+    free(y);
+    free(u);
+    free(w);
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*FREIVALDS_ROUNDS);
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+mm_error_stats verifyWithReferenceComplex(const double* C, const double* R, int N, double eps) {
+    mm_error_stats res;
+    res.tolerance = 2 * VERIFY_TOLERANCE_FACTOR * N * eps;
+    res.max_ulps = -1;
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long failed = 0;
+
+    #pragma omp parallel for reduction(max:max_err) reduction(+:sum_err,failed)
+    for(long long i = 0; i<(long long)N*N; i++) {
+        double modulus = hypot(R[2*i], R[2*i+1]);
+        double scale = modulus > DBL_MIN ? modulus : 1.0;
+        double err = hypot(C[2*i] - R[2*i], C[2*i+1] - R[2*i+1]) / scale;
+        if (!(err <= res.tolerance)) failed++;
+        if (err != err) err = INFINITY;
+        max_err = (err > max_err) ? err : max_err;
+        sum_err += err;
+    }
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*N);
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+mm_error_stats verifyFreivaldsComplex(const double* A, const double* B, const double* C, int N, double eps, unsigned seed) {
+    mm_error_stats res;
+    res.tolerance = 2 * VERIFY_TOLERANCE_FACTOR * N * eps;
+    res.max_ulps = -1;
+
+    // x and u = |B|*|x| are real, y = B*x and w = C*x are complex (interleaved like the matrices)
+    long double* x = (long double*)malloc(sizeof(long double)*N);
+    long double* y = (long double*)malloc(sizeof(long double)*2*N);
+    long double* u = (long double*)malloc(sizeof(long double)*N);
+    long double* w = (long double*)malloc(sizeof(long double)*2*N);
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long failed = 0;
+
+    uint32_t state = seed * 2654435761u + 1;
+    for(int round = 0; round < FREIVALDS_ROUNDS; round++) {
+        for(int k = 0; k<N; k++) {
+            x[k] = freivaldsEntry(&state, round);
+        }
+
+        #pragma omp parallel for
+        for(long long i = 0; i<N; i++) {
+            long double br = 0, bi = 0, bu = 0, cr = 0, ci = 0;
+            for(long long j = 0; j<N; j++) {
+                br += B[2*(i*N+j)] * x[j];
+                bi += B[2*(i*N+j)+1] * x[j];
+                bu += hypotl(B[2*(i*N+j)], B[2*(i*N+j)+1]) * fabsl(x[j]);
+                cr += C[2*(i*N+j)] * x[j];
+                ci += C[2*(i*N+j)+1] * x[j];
+            }
+            y[2*i] = br;
+            y[2*i+1] = bi;
+            u[i] = bu;
+            w[2*i] = cr;
+            w[2*i+1] = ci;
+        }
+
+        // compare A*y with w row by row, relative to the bound (|A|*u)_i
+        #pragma omp parallel for reduction(max:max_err) reduction(+:sum_err,failed)
+        for(long long i = 0; i<N; i++) {
+            long double zr = 0, zi = 0, bound = 0;
+            for(long long k = 0; k<N; k++) {
+                long double ar = A[2*(i*N+k)], ai = A[2*(i*N+k)+1];
+                zr += ar * y[2*k] - ai * y[2*k+1];
+                zi += ar * y[2*k+1] + ai * y[2*k];
+                bound += hypotl(ar, ai) * u[k];
+            }
+            double err = (double)(hypotl(w[2*i] - zr, w[2*i+1] - zi) / ((bound > DBL_MIN) ? bound : 1.0L));
+            if (!(err <= res.tolerance)) failed++;
+            if (err != err) err = INFINITY;
+            max_err = (err > max_err) ? err : max_err;
+            sum_err += err;
+        }
+    }
+
+    free(x);
+    free(y);
+    free(u);
+    free(w);
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*FREIVALDS_ROUNDS);
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+mm_error_stats verifyWithReferenceI32(const int32_t* C, const int32_t* R, int N) {
+    mm_error_stats res;
+    res.tolerance = 0;
+    res.max_ulps = -1;
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long failed = 0;
+
+    #pragma omp parallel for reduction(max:max_err) reduction(+:sum_err,failed)
+    for(long long i = 0; i<(long long)N*N; i++) {
+        if (C[i] == R[i]) continue;
+        double scale = (R[i] != 0) ? fabs((double)R[i]) : 1.0;
+        double err = fabs((double)C[i] - R[i]) / scale;
+        failed++;
+        max_err = (err > max_err) ? err : max_err;
+        sum_err += err;
+    }
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*N);
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+mm_error_stats verifyFreivaldsI8(const int8_t* A, const int8_t* Bt, const int32_t* C, int N, unsigned seed) {
+    mm_error_stats res;
+    res.tolerance = 0;
+    res.max_ulps = -1;
+
+    // with |x_j| <= 1024 all intermediate results fit into 64-bit integers, the check is exact
+    int64_t* x = (int64_t*)malloc(sizeof(int64_t)*N);
+    int64_t* y = (int64_t*)malloc(sizeof(int64_t)*N);
+    int64_t* w = (int64_t*)malloc(sizeof(int64_t)*N);
+
+    double max_err = 0;
+    double sum_err = 0;
+    long long failed = 0;
+
+    uint32_t state = seed * 2654435761u + 1;
+    for(int round = 0; round < FREIVALDS_ROUNDS; round++) {
+        for(int k = 0; k<N; k++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            x[k] = (int64_t)(state % 2049) - 1024;
+        }
+
+        // y = B*x (walking the transposed B column-wise) and w = C*x
+        #pragma omp parallel for
+        for(long long k = 0; k<N; k++) {
+            int64_t sum = 0;
+            for(long long j = 0; j<N; j++) sum += Bt[j*N+k] * x[j];
+            y[k] = sum;
+        }
+        #pragma omp parallel for
+        for(long long i = 0; i<N; i++) {
+            int64_t sum = 0;
+            for(long long j = 0; j<N; j++) sum += C[i*N+j] * x[j];
+            w[i] = sum;
+        }
+
+        // compare A*y with w row by row
+        #pragma omp parallel for reduction(max:max_err) reduction(+:sum_err,failed)
+        for(long long i = 0; i<N; i++) {
+            int64_t z = 0;
+            for(long long k = 0; k<N; k++) z += A[i*N+k] * y[k];
+            if (z == w[i]) continue;
+            double err = fabs((double)(w[i] - z)) / ((z != 0) ? fabs((double)z) : 1.0);
+            failed++;
+            max_err = (err > max_err) ? err : max_err;
+            sum_err += err;
+        }
+    }
+
+    free(x);
+    free(y);
+    free(w);
+
+    res.max_rel_error = max_err;
+    res.mean_rel_error = sum_err / ((double)N*FREIVALDS_ROUNDS);
+    res.num_failed = failed;
+    res.success = (failed == 0);
+    return res;
+}
+
+void printErrorStats(mm_error_stats stats) {
+    printf("%s (max err: %.2e, mean err: %.2e, tolerance: %.2e", (stats.success) ? "OK" : "FAILED", stats.max_rel_error, stats.mean_rel_error, stats.tolerance);
+    if (stats.max_ulps >= 0) printf(", max ULPs: %lld", stats.max_ulps);
+    if (!stats.success) printf(", %lld violations", stats.num_failed);
+    printf(")");
+}
@@ -6,6 +6,10 @@
 #include <string.h>
 
 #include "utils.h"
+#include "matrix_chain.h"
+
+// the relative tolerance of the comparison of the chain product with the left-to-right reference
+#define CHAIN_TOLERANCE 1e-5
 
 int main(int argc, char** argv) {
 
@@ -28,8 +32,9 @@ int main(int argc, char** argv) {
     l[i] = ((rand() /  (float)RAND_MAX) * (maxSize - minSize)) + minSize;
   }
 
-  // compute minimum costs
+  // compute minimum costs and the splits realizing them
   int* C = (int*)malloc(sizeof(int)*N*N);
+  int* split = (int*)malloc(sizeof(int)*N*N);
 
   double start = now();
 
@@ -48,11 +53,16 @@ int main(int argc, char** argv) {
 
       // find cheapest cut between i and j
       int min = INT_MAX;
+      int cut = i;
       for(int k=i; k<j; k++) {
         int costs = C[i*N+k] + C[(k+1)*N+j] + l[i] * l[k+1] * l[j+1];
-        min = (costs < min) ? costs : min;
+        if (costs < min) {
+          min = costs;
+          cut = k;
+        }
       }
       C[i*N+j] = min;
+      split[i*N+j] = cut;
     }
   }
 
@@ -61,10 +71,96 @@ int main(int argc, char** argv) {
   printf("Minimal costs: %d FLOPS\n", C[0*N+N-1]);
   printf("Total time: %.3fs\n", (end-start));
 
+  // the costs of the naive left-to-right order, for comparison
+  long long naive = 0;
+  for(int k=1; k<N; k++) {
+    naive += (long long)l[0] * l[k] * l[k+1];
+  }
+  printf("Left-to-right costs: %lld FLOPS\n", naive);
+
+  // create the matrices -- with non-negative entries and rows summing up to 1, all
+  // partial products have the same property, so values neither vanish nor explode
+  float** A = (float**)malloc(sizeof(float*)*N);
+  for(int m=0; m<N; m++) {
+    A[m] = (float*)malloc(sizeof(float)*l[m]*l[m+1]);
+    for(int i=0; i<l[m]; i++) {
+      float sum = 0;
+      for(int j=0; j<l[m+1]; j++) {
+        A[m][i*l[m+1]+j] = rand() / (float)RAND_MAX + 1e-3f;
+        sum += A[m][i*l[m+1]+j];
+      }
+      for(int j=0; j<l[m+1]; j++) {
+        A[m][i*l[m+1]+j] /= sum;
+      }
+    }
+  }
+
+  // multiply the chain in the optimal order
+  buffer_pool pool = createBufferPool();
+  start = now();
+  float* R = multiplyChain(A, l, split, N, &pool);
+  end = now();
+
+  printf("Execution time: %.3fs\n", (end-start));
+  printf("Buffers allocated: %d, reused: %d\n", pool.allocated, pool.reused);
+
+  // check: the rows of the result have to sum up to 1 as well
+  double error = 0;
+  for(int i=0; i<l[0]; i++) {
+    double sum = 0;
+    for(int j=0; j<l[N]; j++) {
+      sum += R[i*l[N]+j];
+    }
+    error = (fabs(sum - 1) > error) ? fabs(sum - 1) : error;
+  }
+
+  // any row-stochastic result passes the check above, thus the result is also compared with the
+  // plain left-to-right product (in double precision) -- cheap, since all matrices are small;
+  // in long chains the rows of the product converge to the same vector, such that errors in
+  // the first multiplications fade, while those in the last ones remain visible
+  double* ref = (double*)malloc(sizeof(double)*maxSize*maxSize);
+  double* tmp = (double*)malloc(sizeof(double)*maxSize*maxSize);
+  for(int e=0; e<l[0]*l[1]; e++) {
+    ref[e] = A[0][e];
+  }
+  for(int m=1; m<N; m++) {
+    for(int i=0; i<l[0]; i++) {
+      for(int j=0; j<l[m+1]; j++) {
+        double sum = 0;
+        for(int k=0; k<l[m]; k++) {
+          sum += ref[i*l[m]+k] * A[m][k*l[m+1]+j];
+        }
+        tmp[i*l[m+1]+j] = sum;
+      }
+    }
+    double* h = ref;
+    ref = tmp;
+    tmp = h;
+  }
+  double deviation = 0;
+  for(int e=0; e<l[0]*l[N]; e++) {
+    double rel = fabs(R[e] - ref[e]) / ref[e];
+    // NaN must never pass
+    deviation = (!(rel <= deviation)) ? rel : deviation;
+  }
+  free(ref);
+  free(tmp);
+
+  bool success = error < 1e-3 && deviation <= CHAIN_TOLERANCE;
+  printf("Verification: %s (max row sum error: %.2e, max relative deviation from left-to-right product: %.2e)\n",
+    (success) ? "OK" : "FAILED", error, deviation);
+
   // clean
+  releaseBuffer(&pool, R, (size_t)l[0]*l[N]);
+  releaseBufferPool(pool);
+  for(int m=0; m<N; m++) {
+    free(A[m]);
+  }
+  free(A);
+  free(split);
   free(C);
   free(l);
 
   // done
-  return EXIT_SUCCESS;
+  return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
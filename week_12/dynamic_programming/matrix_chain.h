@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// An executor for matrix chain products A_0 x ... x A_{N-1}, A_i being an
+// l[i] x l[i+1] matrix, following the split points computed by the dynamic
+// programming solver: the product A_i x ... x A_j is split into
+// (A_i x ... x A_k) x (A_{k+1} x ... x A_j) for k = split[i*N+j].
+//
+// The two sub-products of a split are independent and computed by separate
+// OpenMP tasks. Intermediate results are taken from a buffer pool and returned
+// as soon as they have been consumed, such that their memory is reused.
+
+
+// sub-chains of fewer matrices are computed by the current task, smaller ones are not worth a task
+#define CHAIN_TASK_CUTOFF 8
+
+
+// ------------------------------------------------------------------------------------------------ declarations
+
+// a pool of float buffers shared by all tasks
+typedef struct _buffer_pool {
+    float** buffers;        // < the free buffers
+    size_t* capacities;     // < their capacity in elements
+    int size;               // < the number of free buffers
+    int allocated;          // < the number of buffers allocated so far
+    int reused;             // < the number of requests served from the pool
+} buffer_pool;
+
+buffer_pool createBufferPool();
+
+// obtains a buffer of at least the given number of elements, reusing a free one if possible
+float* acquireBuffer(buffer_pool* pool, size_t elements);
+
+// returns a buffer obtained from acquireBuffer to the pool
+void releaseBuffer(buffer_pool* pool, float* buffer, size_t elements);
+
+void releaseBufferPool(buffer_pool pool);
+
+// C = A * B for the M x K matrix A and the K x N matrix B (the i-k-j kernel of the CPU engine)
+void gemm(float* C, const float* A, const float* B, int M, int N, int K);
+
+// computes the product of the chain of N matrices A using the given split table,
+// the result is an l[0] x l[N] matrix obtained from the pool
+float* multiplyChain(float** A, const int* l, const int* split, int N, buffer_pool* pool);
+
+
+// ------------------------------------------------------------------------------------------------ implementations
+
+buffer_pool createBufferPool() {
+    buffer_pool pool = { NULL, NULL, 0, 0, 0 };
+    return pool;
+}
+
+float* acquireBuffer(buffer_pool* pool, size_t elements) {
+    float* res = NULL;
+    #pragma omp critical (buffer_pool)
+    {
+        // the smallest sufficient free buffer
+        int best = -1;
+        for(int i=0; i<pool->size; i++) {
+            if (pool->capacities[i] < elements) continue;
+            if (best < 0 || pool->capacities[i] < pool->capacities[best]) best = i;
+        }
+        if (best >= 0) {
+            res = pool->buffers[best];
+            pool->size--;
+            pool->buffers[best] = pool->buffers[pool->size];
+            pool->capacities[best] = pool->capacities[pool->size];
+            pool->reused++;
+        } else {
+            pool->allocated++;
+        }
+    }
+    if (!res) res = (float*)malloc(sizeof(float) * elements);
+    return res;
+}
+
+void releaseBuffer(buffer_pool* pool, float* buffer, size_t elements) {
+    #pragma omp critical (buffer_pool)
+    {
+        // the list can not hold more buffers than have been allocated
+        pool->buffers = (float**)realloc(pool->buffers, sizeof(float*) * pool->allocated);
+        pool->capacities = (size_t*)realloc(pool->capacities, sizeof(size_t) * pool->allocated);
+        pool->buffers[pool->size] = buffer;
+        pool->capacities[pool->size] = elements;
+        pool->size++;
+    }
+}
+
+void releaseBufferPool(buffer_pool pool) {
+    for(int i=0; i<pool.size; i++) {
+        free(pool.buffers[i]);
+    }
+    free(pool.buffers);
+    free(pool.capacities);
+}
+
+void gemm(float* C, const float* A, const float* B, int M, int N, int K) {
+    for(long long i = 0; i<M; i++) {
+        // i-k-j order, such that the inner loop walks along rows of B and C
+        for(long long j = 0; j<N; j++) {
+            C[i*N+j] = 0;
+        }
+        for(long long k=0; k<K; k++) {
+            float a = A[i*K+k];
+            for(long long j=0; j<N; j++) {
+                C[i*N+j] += a * B[k*N+j];
+            }
+        }
+    }
+}
+
+// computes A_i x ... x A_j, the result is an input matrix for i == j and a pool buffer otherwise
+float* multiplyRange(float** A, const int* l, const int* split, int N, int i, int j, buffer_pool* pool) {
+    if (i == j) return A[i];
+
+    int k = split[i*N+j];
+    float* left;
+    float* right;
+
+    #pragma omp task shared(left) if(k - i >= CHAIN_TASK_CUTOFF)
+    left = multiplyRange(A, l, split, N, i, k, pool);
+
+    #pragma omp task shared(right) if(j - k - 1 >= CHAIN_TASK_CUTOFF)
+    right = multiplyRange(A, l, split, N, k+1, j, pool);
+
+    #pragma omp taskwait
+
+    float* res = acquireBuffer(pool, (size_t)l[i] * l[j+1]);
+    gemm(res, left, right, l[i], l[j+1], l[k+1]);
+
+    // the intermediate results are consumed
+    if (i < k) releaseBuffer(pool, left, (size_t)l[i] * l[k+1]);
+    if (k+1 < j) releaseBuffer(pool, right, (size_t)l[k+1] * l[j+1]);
+    return res;
+}
+
+float* multiplyChain(float** A, const int* l, const int* split, int N, buffer_pool* pool) {
+    float* res;
+
+    // a single chain of tasks, spawned from one thread of the team
+    #pragma omp parallel
+    #pragma omp single
+    res = multiplyRange(A, l, split, N, 0, N-1, pool);
+
+    // a chain of one matrix is its own product, the caller expects a pool buffer
+    if (N == 1) {
+        float* copy = acquireBuffer(pool, (size_t)l[0] * l[1]);
+        for(int e=0; e<l[0]*l[1]; e++) copy[e] = res[e];
+        res = copy;
+    }
+    return res;
+}